@@ -0,0 +1,355 @@
+#include "plagiarism.h"
+#include "perf.h"
+
+// Fuzzy Alignment
+// An exact passage ends at the first edited token. Here shared fingerprints
+// only seed candidate regions: seeds close together in the target and on
+// nearly the same diagonal (reference position minus target position) are
+// chained, and each chain's target span is aligned against the matching
+// stretch of the reference, widened by the band, with Myers' bit-parallel
+// edit distance over token IDs (in Hyyrö's blocked form for spans over 64
+// tokens). The alignment is semi-global: every target token of the span is
+// aligned, while the reference side may start and end anywhere in its
+// window. A span of m tokens against n costs O(n * ceil(m / 64)) word
+// operations, and only seeded regions are ever aligned.
+
+#define FUZZY_MAX_OCCURRENCES 8    // reference positions tried per shared fingerprint
+#define FUZZY_BAND 8               // diagonal drift allowed within a chain, in tokens
+#define FUZZY_MAX_GAP 32           // target tokens allowed between chained seeds, plus the window
+#define FUZZY_MAX_TOKENS 1024      // chains are cut at this target span
+
+double fuzzy_min_similarity = 0.0;
+
+typedef struct KeyedPosition {
+    uint64_t fingerprint;
+    int position;
+} KeyedPosition;
+
+typedef struct Seed {
+    int target;
+    int ref;
+} Seed;
+
+typedef struct SeedChain {
+    int target_first;
+    int target_last;
+    int ref_first;
+    int ref_last;
+    int diagonal;              // of the newest seed, so a chain may drift
+} SeedChain;
+
+static int compare_keyed_positions(const void* a, const void* b) {
+    const KeyedPosition* pa = (const KeyedPosition*)a;
+    const KeyedPosition* pb = (const KeyedPosition*)b;
+    if (pa->fingerprint != pb->fingerprint) return pa->fingerprint < pb->fingerprint ? -1 : 1;
+    return pa->position - pb->position;
+}
+
+static int compare_fuzzy_passages(const void* a, const void* b) {
+    const FuzzyPassage* pa = (const FuzzyPassage*)a;
+    const FuzzyPassage* pb = (const FuzzyPassage*)b;
+    if (pa->length != pb->length) return pb->length - pa->length;
+    return pa->target_start - pb->target_start;
+}
+
+// Seeds are the target's kept k-grams the reference also kept, each
+// paired with where the reference has it (at most FUZZY_MAX_OCCURRENCES
+// places for a fingerprint common there). The reference side is filtered
+// through the target's set first, so only shared k-grams are sorted and
+// indexed. Seeds come back ordered by target, then reference position.
+static int find_seeds(const Document* target, const Document* reference, Seed** seeds) {
+    int* positions;
+    uint64_t* fingerprints;
+    int ref_count = document_kept_kgrams(reference, &positions, &fingerprints);
+    KeyedPosition* shared = (KeyedPosition*)malloc((ref_count > 0 ? ref_count : 1) * sizeof(KeyedPosition));
+    int shared_count = 0;
+    for (int i = 0; i < ref_count; i++) {
+        if (!hash_set_contains_fingerprint(target->kgrams, fingerprints[i])) continue;
+        shared[shared_count].fingerprint = fingerprints[i];
+        shared[shared_count].position = positions[i];
+        shared_count++;
+    }
+    free(positions);
+    free(fingerprints);
+    if (shared_count > 1) {
+        qsort(shared, shared_count, sizeof(KeyedPosition), compare_keyed_positions);
+    }
+
+    // Fingerprint -> its first entry in `shared`, open-addressed
+    int size = 16;
+    while (size < 2 * shared_count) size <<= 1;
+    unsigned int mask = (unsigned int)size - 1;
+    int* first = (int*)malloc(size * sizeof(int));
+    for (int i = 0; i < size; i++) first[i] = -1;
+    for (int i = 0; i < shared_count; i++) {
+        if (i > 0 && shared[i].fingerprint == shared[i - 1].fingerprint) continue;
+        unsigned int slot = (unsigned int)shared[i].fingerprint & mask;
+        while (first[slot] != -1) slot = (slot + 1) & mask;
+        first[slot] = i;
+    }
+
+    int target_count = document_kept_kgrams(target, &positions, &fingerprints);
+    int count = 0, capacity = 0;
+    *seeds = NULL;
+    for (int i = 0; i < target_count; i++) {
+        unsigned int slot = (unsigned int)fingerprints[i] & mask;
+        while (first[slot] != -1 && shared[first[slot]].fingerprint != fingerprints[i]) {
+            slot = (slot + 1) & mask;
+        }
+        if (first[slot] == -1) continue;
+        int from = first[slot];
+        for (int o = from; o < shared_count && o < from + FUZZY_MAX_OCCURRENCES &&
+                           shared[o].fingerprint == fingerprints[i]; o++) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                *seeds = (Seed*)realloc(*seeds, capacity * sizeof(Seed));
+            }
+            (*seeds)[count].target = positions[i];
+            (*seeds)[count].ref = shared[o].position;
+            count++;
+        }
+    }
+
+    free(first);
+    free(positions);
+    free(fingerprints);
+    free(shared);
+    return count;
+}
+
+// Greedy chaining in target order: a seed joins the open chain nearest its
+// diagonal that it extends forward in both documents, or opens a new one.
+// Chains whose last seed is more than max_gap tokens behind are closed.
+static int chain_seeds(const Seed* seeds, int seed_count, int k, int max_gap, SeedChain** chains) {
+    int count = 0, capacity = 0;
+    int* open = (int*)malloc((seed_count > 0 ? seed_count : 1) * sizeof(int));
+    int open_count = 0;
+    *chains = NULL;
+
+    for (int s = 0; s < seed_count; s++) {
+        const Seed* seed = &seeds[s];
+        int diagonal = seed->ref - seed->target;
+        int best = -1, best_drift = FUZZY_BAND + 1;
+        int kept = 0;
+        for (int o = 0; o < open_count; o++) {
+            SeedChain* chain = &(*chains)[open[o]];
+            if (seed->target - chain->target_last > max_gap) continue;
+            open[kept++] = open[o];
+            int drift = abs(diagonal - chain->diagonal);
+            if (drift < best_drift && seed->target > chain->target_last &&
+                seed->ref > chain->ref_last && seed->target + k - chain->target_first <= FUZZY_MAX_TOKENS) {
+                best = open[o];
+                best_drift = drift;
+            }
+        }
+        open_count = kept;
+
+        if (best >= 0) {
+            SeedChain* chain = &(*chains)[best];
+            chain->target_last = seed->target;
+            chain->ref_last = seed->ref;
+            chain->diagonal = diagonal;
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            *chains = (SeedChain*)realloc(*chains, capacity * sizeof(SeedChain));
+        }
+        SeedChain* chain = &(*chains)[count];
+        chain->target_first = chain->target_last = seed->target;
+        chain->ref_first = chain->ref_last = seed->ref;
+        chain->diagonal = diagonal;
+        open[open_count++] = count++;
+    }
+
+    free(open);
+    return count;
+}
+
+// One column step of a 64-row block (Myers 1999, Hyyrö 2003). `hin` and
+// the return value are the horizontal score deltas entering the block's
+// top row and leaving the row marked by `high`.
+static inline int advance_block(uint64_t* pv_io, uint64_t* mv_io, uint64_t eq, int hin,
+                                uint64_t high) {
+    uint64_t pv = *pv_io, mv = *mv_io;
+    uint64_t hin_negative = (uint64_t)(hin < 0);
+    uint64_t xv = eq | mv;
+    eq |= hin_negative;
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+
+    int hout = 0;
+    if (ph & high) hout = 1;
+    if (mh & high) hout = -1;
+    ph = (ph << 1) | (uint64_t)(hin > 0);
+    mh = (mh << 1) | hin_negative;
+    *pv_io = mh | ~(xv | ph);
+    *mv_io = ph & xv;
+    return hout;
+}
+
+// Fewest edits turning pattern[0..m) into some run of text[0..n) (free
+// start and end in the text), with *end set to the first text index where
+// such a run ends. Tokens are matched through a table of the pattern's
+// distinct IDs, each with one match bit per pattern row.
+int token_edit_search(const uint32_t* pattern, int m, const uint32_t* text, int n, int* end) {
+    int words = (m + 63) / 64;
+    int size = 16;
+    while (size < 2 * m) size <<= 1;
+    uint32_t* keys = (uint32_t*)calloc(size, sizeof(uint32_t));   // token ID + 1, 0 = empty
+    int* rows = (int*)malloc(size * sizeof(int));
+    uint64_t* eq = (uint64_t*)calloc((size_t)(m + 1) * words, sizeof(uint64_t));  // row 0 matches nothing
+    int distinct = 0;
+    unsigned int mask = (unsigned int)size - 1;
+
+    for (int i = 0; i < m; i++) {
+        unsigned int slot = (unsigned int)fingerprint_mix(pattern[i]) & mask;
+        while (keys[slot] != 0 && keys[slot] != pattern[i] + 1) slot = (slot + 1) & mask;
+        if (keys[slot] == 0) {
+            keys[slot] = pattern[i] + 1;
+            rows[slot] = ++distinct;
+        }
+        eq[(size_t)rows[slot] * words + i / 64] |= 1ULL << (i % 64);
+    }
+
+    uint64_t* pv = (uint64_t*)malloc(words * sizeof(uint64_t));
+    uint64_t* mv = (uint64_t*)malloc(words * sizeof(uint64_t));
+    for (int b = 0; b < words; b++) {
+        pv[b] = ~0ULL;
+        mv[b] = 0;
+    }
+    uint64_t last_high = 1ULL << ((m - 1) % 64);
+
+    int score = m, best = m;
+    *end = -1;
+    for (int j = 0; j < n; j++) {
+        unsigned int slot = (unsigned int)fingerprint_mix(text[j]) & mask;
+        while (keys[slot] != 0 && keys[slot] != text[j] + 1) slot = (slot + 1) & mask;
+        const uint64_t* column = eq + (size_t)(keys[slot] != 0 ? rows[slot] : 0) * words;
+
+        int carry = 0;
+        for (int b = 0; b < words - 1; b++) {
+            carry = advance_block(&pv[b], &mv[b], column[b], carry, 1ULL << 63);
+        }
+        score += advance_block(&pv[words - 1], &mv[words - 1], column[words - 1], carry, last_high);
+        if (score < best) {
+            best = score;
+            *end = j;
+        }
+    }
+
+    free(mv);
+    free(pv);
+    free(eq);
+    free(rows);
+    free(keys);
+    return best;
+}
+
+// Aligns the chain's target span within its reference window. Fills
+// `passage` and returns 1 when the alignment reaches fuzzy_min_similarity.
+static int align_chain(const Document* target, const Document* reference, const SeedChain* chain,
+                       int k, FuzzyPassage* passage) {
+    int target_start = chain->target_first;
+    int m = chain->target_last + k - target_start;
+    int window_start = chain->ref_first - FUZZY_BAND;
+    int window_end = chain->ref_last + k + FUZZY_BAND;
+    if (window_start < 0) window_start = 0;
+    if (window_end > reference->token_count) window_end = reference->token_count;
+
+    const uint32_t* pattern = target->token_ids + target_start;
+    const uint32_t* text = reference->token_ids + window_start;
+    int end;
+    int edits = token_edit_search(pattern, m, text, window_end - window_start, &end);
+    if (end < 0) return 0;
+
+    // The same search over both sequences reversed, up to that end, finds
+    // the shortest run with the same score and so where it starts
+    uint32_t* reversed_pattern = (uint32_t*)malloc(m * sizeof(uint32_t));
+    uint32_t* reversed_text = (uint32_t*)malloc((end + 1) * sizeof(uint32_t));
+    for (int i = 0; i < m; i++) reversed_pattern[i] = pattern[m - 1 - i];
+    for (int i = 0; i <= end; i++) reversed_text[i] = text[end - i];
+    int reversed_end;
+    token_edit_search(reversed_pattern, m, reversed_text, end + 1, &reversed_end);
+    free(reversed_text);
+    free(reversed_pattern);
+
+    int ref_start = window_start + end - reversed_end;
+    int ref_length = reversed_end + 1;
+    int longer = m > ref_length ? m : ref_length;
+    double similarity = 1.0 - (double)edits / longer;
+    if (similarity < fuzzy_min_similarity) return 0;
+
+    passage->target_start = target_start;
+    passage->length = m;
+    passage->ref_start = ref_start;
+    passage->ref_length = ref_length;
+    passage->edits = edits;
+    passage->similarity = similarity;
+
+    const Token* first = &target->tokens[target_start];
+    const Token* last = &target->tokens[target_start + m - 1];
+    passage->target_char_start = first->source_offset;
+    passage->target_char_end = last->source_offset + last->source_length;
+    first = &reference->tokens[ref_start];
+    last = &reference->tokens[ref_start + ref_length - 1];
+    passage->ref_char_start = first->source_offset;
+    passage->ref_char_end = last->source_offset + last->source_length;
+    return 1;
+}
+
+// Fills result->fuzzy_passages with the passages of at least
+// FUZZY_PASSAGE_MIN_TOKENS target tokens whose edit similarity reaches
+// fuzzy_min_similarity, longest first; where two overlap in the target
+// only the longer is kept
+void find_fuzzy_passages(Document* target, Document* reference, SimilarityResult* result) {
+    result->fuzzy_passages = NULL;
+    result->fuzzy_passage_count = 0;
+    if (fuzzy_min_similarity <= 0.0 || target->k < 1) return;
+    if (ensure_document_tokens(target) != 0 || ensure_document_tokens(reference) != 0) return;
+    uint64_t start = perf_enabled ? perf_now_ns() : 0;
+
+    int k = target->k;
+    Seed* seeds;
+    int seed_count = find_seeds(target, reference, &seeds);
+    SeedChain* chains;
+    int chain_count = chain_seeds(seeds, seed_count, k, FUZZY_MAX_GAP + target->window, &chains);
+    free(seeds);
+
+    FuzzyPassage* passages = NULL;
+    int count = 0, capacity = 0, aligned = 0;
+    for (int c = 0; c < chain_count; c++) {
+        if (chains[c].target_last + k - chains[c].target_first < FUZZY_PASSAGE_MIN_TOKENS) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            passages = (FuzzyPassage*)realloc(passages, capacity * sizeof(FuzzyPassage));
+        }
+        aligned++;
+        count += align_chain(target, reference, &chains[c], k, &passages[count]);
+    }
+    free(chains);
+
+    if (count > 1) qsort(passages, count, sizeof(FuzzyPassage), compare_fuzzy_passages);
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        int overlaps = 0;
+        for (int j = 0; j < kept && !overlaps; j++) {
+            overlaps = passages[i].target_start < passages[j].target_start + passages[j].length &&
+                       passages[j].target_start < passages[i].target_start + passages[i].length;
+        }
+        if (!overlaps) passages[kept++] = passages[i];
+    }
+    if (kept == 0) {
+        free(passages);
+        passages = NULL;
+    }
+
+    result->fuzzy_passages = passages;
+    result->fuzzy_passage_count = kept;
+    if (perf_enabled) {
+        perf_add(PERF_ALIGNED_REGIONS, (uint64_t)aligned);
+        perf_add(PERF_FUZZY_PASSAGES, (uint64_t)kept);
+        perf_stage(PERF_STAGE_ALIGNMENT, start);
+    }
+}
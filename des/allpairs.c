@@ -0,0 +1,402 @@
+#define _POSIX_C_SOURCE 200809L
+#include "allpairs.h"
+#include "index.h"
+#include "perf.h"
+#include "threadpool.h"
+
+#include <time.h>
+
+typedef struct PairOverlap {
+    int a;                     // a < b
+    int b;
+    int shared;
+} PairOverlap;
+
+// The pairs found from one block of rows, ascending by (a, b)
+typedef struct PairBlock {
+    PairOverlap* pairs;
+    int count;
+    int capacity;
+    long walked;               // posting entries visited
+} PairBlock;
+
+typedef struct AllPairsJob {
+    const AllPairsConfig* config;
+    char** files;
+    Document** docs;
+    int doc_count;
+
+    // Fingerprints held by two or more documents, ascending
+    uint64_t* terms;
+    int* term_df;
+    int term_count;
+
+    // Posting lists of the walked terms: documents of term t, ascending,
+    // are postings[posting_start[t] .. posting_start[t + 1])
+    int* posting_start;
+    int* postings;
+
+    // Per document: indices of its walked terms, and its capped fingerprints
+    int** doc_terms;
+    int* doc_term_count;
+    uint64_t** doc_capped;
+    int* doc_capped_count;
+
+    PairBlock* blocks;
+} AllPairsJob;
+
+// Sorts every document's fingerprints together; runs of two or more give
+// the shared terms and their document frequencies
+static void build_terms(AllPairsJob* job) {
+    long total = 0;
+    for (int d = 0; d < job->doc_count; d++) total += job->docs[d]->kgrams->count;
+
+    uint64_t* all = (uint64_t*)malloc((total > 0 ? total : 1) * sizeof(uint64_t));
+    long n = 0;
+    for (int d = 0; d < job->doc_count; d++) {
+        const uint64_t* sorted = hash_set_sorted_fingerprints(job->docs[d]->kgrams);
+        memcpy(all + n, sorted, job->docs[d]->kgrams->count * sizeof(uint64_t));
+        n += job->docs[d]->kgrams->count;
+    }
+    uint64_t* scratch = (uint64_t*)malloc((total > 0 ? total : 1) * sizeof(uint64_t));
+    radix_sort_u64(all, scratch, (int)n);
+    free(scratch);
+
+    job->term_df = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+    job->term_count = 0;
+    for (long i = 0; i < n; ) {
+        long end = i + 1;
+        while (end < n && all[end] == all[i]) end++;
+        if (end - i >= 2) {
+            all[job->term_count] = all[i];
+            job->term_df[job->term_count] = (int)(end - i);
+            job->term_count++;
+        }
+        i = end;
+    }
+    job->terms = all;
+}
+
+static int find_term(const AllPairsJob* job, uint64_t fingerprint) {
+    int lo = 0, hi = job->term_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (job->terms[mid] < fingerprint) lo = mid + 1; else hi = mid;
+    }
+    return lo < job->term_count && job->terms[lo] == fingerprint ? lo : -1;
+}
+
+// Splits document d's shared fingerprints into walked terms and capped ones
+static void all_pairs_split_task(void* arg, int d) {
+    AllPairsJob* job = (AllPairsJob*)arg;
+    HashSet* set = job->docs[d]->kgrams;
+    const uint64_t* sorted = hash_set_sorted_fingerprints(set);
+    int cap = job->config->df_cap;
+    int size = set->count > 0 ? set->count : 1;
+    job->doc_terms[d] = (int*)malloc(size * sizeof(int));
+    job->doc_capped[d] = (uint64_t*)malloc(size * sizeof(uint64_t));
+    int walked = 0, capped = 0;
+    for (int i = 0; i < set->count; i++) {
+        int t = find_term(job, sorted[i]);
+        if (t < 0) continue;
+        if (cap > 0 && job->term_df[t] > cap) {
+            job->doc_capped[d][capped++] = sorted[i];
+        } else {
+            job->doc_terms[d][walked++] = t;
+        }
+    }
+    job->doc_term_count[d] = walked;
+    job->doc_capped_count[d] = capped;
+}
+
+static void build_postings(AllPairsJob* job) {
+    job->posting_start = (int*)calloc(job->term_count + 1, sizeof(int));
+    for (int d = 0; d < job->doc_count; d++) {
+        for (int i = 0; i < job->doc_term_count[d]; i++) {
+            job->posting_start[job->doc_terms[d][i] + 1]++;
+        }
+    }
+    for (int t = 0; t < job->term_count; t++) {
+        job->posting_start[t + 1] += job->posting_start[t];
+    }
+    int total = job->posting_start[job->term_count];
+    job->postings = (int*)malloc((total > 0 ? total : 1) * sizeof(int));
+    int* cursor = (int*)malloc((job->term_count > 0 ? job->term_count : 1) * sizeof(int));
+    memcpy(cursor, job->posting_start, job->term_count * sizeof(int));
+    // Documents in ascending order leave every posting list sorted
+    for (int d = 0; d < job->doc_count; d++) {
+        for (int i = 0; i < job->doc_term_count[d]; i++) {
+            job->postings[cursor[job->doc_terms[d][i]]++] = d;
+        }
+    }
+    free(cursor);
+}
+
+static int compare_ints(const void* a, const void* b) {
+    return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b);
+}
+
+static void add_pair(PairBlock* block, int a, int b, int shared) {
+    if (block->count == block->capacity) {
+        block->capacity = block->capacity > 0 ? block->capacity * 2 : 64;
+        block->pairs = (PairOverlap*)realloc(block->pairs, block->capacity * sizeof(PairOverlap));
+    }
+    PairOverlap* pair = &block->pairs[block->count++];
+    pair->a = a;
+    pair->b = b;
+    pair->shared = shared;
+}
+
+// Counts rows [block * ALLPAIRS_ROWS_PER_TASK, ...) of the overlap matrix,
+// upper triangle only
+static void all_pairs_row_task(void* arg, int block_index) {
+    AllPairsJob* job = (AllPairsJob*)arg;
+    PairBlock* block = &job->blocks[block_index];
+    int* counts = (int*)calloc(job->doc_count, sizeof(int));
+    int* touched = (int*)malloc(job->doc_count * sizeof(int));
+
+    int first = block_index * ALLPAIRS_ROWS_PER_TASK;
+    int last = first + ALLPAIRS_ROWS_PER_TASK;
+    if (last > job->doc_count) last = job->doc_count;
+    for (int a = first; a < last; a++) {
+        int touched_count = 0;
+        for (int i = 0; i < job->doc_term_count[a]; i++) {
+            int t = job->doc_terms[a][i];
+            // Skip to the documents after `a` in the posting list
+            int lo = job->posting_start[t], hi = job->posting_start[t + 1];
+            int end = hi;
+            while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if (job->postings[mid] <= a) lo = mid + 1; else hi = mid;
+            }
+            block->walked += end - lo;
+            for (int p = lo; p < end; p++) {
+                int b = job->postings[p];
+                if (counts[b]++ == 0) touched[touched_count++] = b;
+            }
+        }
+        qsort(touched, touched_count, sizeof(int), compare_ints);
+
+        int count_a = job->docs[a]->kgrams->count;
+        for (int i = 0; i < touched_count; i++) {
+            int b = touched[i];
+            int shared = counts[b] + sorted_intersection_size(job->doc_capped[a], job->doc_capped_count[a],
+                                                              job->doc_capped[b], job->doc_capped_count[b]);
+            counts[b] = 0;
+            if (similarity_min_score > 0.0) {
+                int count_b = job->docs[b]->kgrams->count;
+                int smaller = count_a < count_b ? count_a : count_b;
+                int larger = count_a < count_b ? count_b : count_a;
+                if (shared < required_intersection(similarity_min_score, smaller, larger)) continue;
+            }
+            add_pair(block, a, b, shared);
+        }
+    }
+    free(counts);
+    free(touched);
+}
+
+static void pair_scores(const AllPairsJob* job, const PairOverlap* pair, SimilarityResult* scores) {
+    int count_a = job->docs[pair->a]->kgrams->count;
+    int count_b = job->docs[pair->b]->kgrams->count;
+    if (count_a <= count_b) {
+        fill_similarity_scores(scores, pair->shared, count_a, count_b);
+    } else {
+        fill_similarity_scores(scores, pair->shared, count_b, count_a);
+    }
+}
+
+// Union-find over documents, with path halving
+static int find_root(int* parent, int x) {
+    while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+
+typedef struct Cluster {
+    int first;                 // offset of its members in the member array
+    int size;
+} Cluster;
+
+static int compare_clusters(const void* a, const void* b) {
+    const Cluster* ca = (const Cluster*)a;
+    const Cluster* cb = (const Cluster*)b;
+    if (ca->size != cb->size) return ca->size > cb->size ? -1 : 1;
+    return (ca->first > cb->first) - (ca->first < cb->first);
+}
+
+static void write_matrix_report(JsonBuffer* out, const AllPairsJob* job, int block_count,
+                                long capped_terms) {
+    const AllPairsConfig* config = job->config;
+    json_buffer_printf(out, "{\n");
+    json_buffer_printf(out, "  \"k_value\": %d,\n", config->k);
+    json_buffer_printf(out, "  \"window\": %d,\n", config->window);
+    json_buffer_printf(out, "  \"df_cap\": %d,\n", config->df_cap);
+    json_buffer_printf(out, "  \"capped_fingerprints\": %ld,\n", capped_terms);
+    json_buffer_printf(out, "  \"documents\": [\n");
+    for (int d = 0; d < job->doc_count; d++) {
+        json_buffer_printf(out, "    {\"id\": %d, \"filename\": ", d);
+        json_buffer_string(out, job->docs[d]->filename);
+        json_buffer_printf(out, ", \"fingerprints\": %d}%s\n", job->docs[d]->kgrams->count,
+                           d < job->doc_count - 1 ? "," : "");
+    }
+    json_buffer_printf(out, "  ],\n");
+
+    int* parent = (int*)malloc((job->doc_count > 0 ? job->doc_count : 1) * sizeof(int));
+    for (int d = 0; d < job->doc_count; d++) parent[d] = d;
+    json_buffer_printf(out, "  \"pairs\": [");
+    int written = 0;
+    for (int k = 0; k < block_count; k++) {
+        const PairBlock* block = &job->blocks[k];
+        for (int i = 0; i < block->count; i++) {
+            const PairOverlap* pair = &block->pairs[i];
+            SimilarityResult scores;
+            pair_scores(job, pair, &scores);
+            json_buffer_printf(out, "%s\n    {\"a\": %d, \"b\": %d, \"jaccard\": %.4f, "
+                               "\"containment\": %.4f, \"dice\": %.4f, \"overall\": %.4f, "
+                               "\"matching_kgrams\": %d}",
+                               written++ > 0 ? "," : "", pair->a, pair->b, scores.jaccard,
+                               scores.containment, scores.dice, scores.overall, pair->shared);
+            if (scores.overall >= config->cluster_threshold) {
+                int ra = find_root(parent, pair->a), rb = find_root(parent, pair->b);
+                if (ra != rb) parent[ra > rb ? ra : rb] = ra < rb ? ra : rb;
+            }
+        }
+    }
+    json_buffer_printf(out, "%s],\n", written > 0 ? "\n  " : "");
+
+    // Group the documents by root; roots are each component's lowest ID,
+    // so members come out ascending
+    int* size = (int*)calloc(job->doc_count > 0 ? job->doc_count : 1, sizeof(int));
+    for (int d = 0; d < job->doc_count; d++) size[find_root(parent, d)]++;
+    Cluster* clusters = (Cluster*)malloc((job->doc_count > 0 ? job->doc_count : 1) * sizeof(Cluster));
+    int* slot = (int*)malloc((job->doc_count > 0 ? job->doc_count : 1) * sizeof(int));
+    int cluster_count = 0, member_count = 0;
+    for (int d = 0; d < job->doc_count; d++) {
+        if (parent[d] != d || size[d] < 2) continue;
+        clusters[cluster_count].first = member_count;
+        clusters[cluster_count].size = size[d];
+        slot[d] = member_count;
+        member_count += size[d];
+        cluster_count++;
+    }
+    int* members = (int*)malloc((member_count > 0 ? member_count : 1) * sizeof(int));
+    for (int d = 0; d < job->doc_count; d++) {
+        int root = find_root(parent, d);
+        if (size[root] >= 2) members[slot[root]++] = d;
+    }
+    qsort(clusters, cluster_count, sizeof(Cluster), compare_clusters);
+
+    json_buffer_printf(out, "  \"cluster_threshold\": %.4f,\n", config->cluster_threshold);
+    json_buffer_printf(out, "  \"clusters\": [\n");
+    for (int c = 0; c < cluster_count; c++) {
+        json_buffer_printf(out, "    {\"size\": %d, \"members\": [", clusters[c].size);
+        for (int m = 0; m < clusters[c].size; m++) {
+            json_buffer_printf(out, "%s%d", m > 0 ? ", " : "", members[clusters[c].first + m]);
+        }
+        json_buffer_printf(out, "]}%s\n", c < cluster_count - 1 ? "," : "");
+    }
+    json_buffer_printf(out, "  ]\n");
+    json_buffer_printf(out, "}\n");
+    printf("Found %d pairs, %d clusters at overall >= %.2f\n", written, cluster_count,
+           config->cluster_threshold);
+
+    free(members);
+    free(slot);
+    free(clusters);
+    free(size);
+    free(parent);
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int run_all_pairs(const AllPairsConfig* config, const char** paths, int path_count, FILE* output) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    AllPairsJob job;
+    memset(&job, 0, sizeof(job));
+    job.config = config;
+    int file_count = 0;
+    job.files = collect_input_files(paths, path_count, &file_count);
+    job.docs = (Document**)calloc(file_count > 0 ? file_count : 1, sizeof(Document*));
+    PipelineConfig ingest = { config->k, config->window, config->threads, config->readers,
+                              config->queue_depth, config->io, config->cache_dir, NULL, NULL };
+    PipelineStats stats;
+    if (pipeline_load_documents(&ingest, (const char**)job.files, file_count, job.docs,
+                                &stats) != 0) {
+        printf("Error: Cannot start the ingestion pipeline\n");
+        return 1;
+    }
+
+    // Keep the readable ones, densely, so IDs index the array
+    for (int i = 0; i < file_count; i++) {
+        if (job.docs[i] != NULL) {
+            job.docs[job.doc_count++] = job.docs[i];
+        } else {
+            printf("Warning: Cannot open file %s, skipping\n", job.files[i]);
+        }
+        free(job.files[i]);
+    }
+    free(job.files);
+    job.files = NULL;
+    printf("Loaded %d documents", job.doc_count);
+    if (config->cache_dir != NULL) printf(" (%d from %s)", stats.cache_hits, config->cache_dir);
+    printf(" in %.2fs\n", elapsed_seconds(&start));
+    if (perf_enabled) print_pipeline_stats(&stats);
+
+    ThreadPool* pool = create_thread_pool(config->threads);
+
+    int size = job.doc_count > 0 ? job.doc_count : 1;
+    build_terms(&job);
+    job.doc_terms = (int**)malloc(size * sizeof(int*));
+    job.doc_term_count = (int*)malloc(size * sizeof(int));
+    job.doc_capped = (uint64_t**)malloc(size * sizeof(uint64_t*));
+    job.doc_capped_count = (int*)malloc(size * sizeof(int));
+    thread_pool_run(pool, job.doc_count, all_pairs_split_task, &job);
+    build_postings(&job);
+    long capped_terms = 0;
+    for (int t = 0; t < job.term_count; t++) {
+        if (config->df_cap > 0 && job.term_df[t] > config->df_cap) capped_terms++;
+    }
+
+    int block_count = (job.doc_count + ALLPAIRS_ROWS_PER_TASK - 1) / ALLPAIRS_ROWS_PER_TASK;
+    job.blocks = (PairBlock*)calloc(block_count > 0 ? block_count : 1, sizeof(PairBlock));
+    thread_pool_run(pool, block_count, all_pairs_row_task, &job);
+    long walked = 0;
+    for (int b = 0; b < block_count; b++) walked += job.blocks[b].walked;
+    printf("Counted %d shared fingerprints (%ld over the df cap) by walking %ld postings in %.2fs\n",
+           job.term_count, capped_terms, walked, elapsed_seconds(&start));
+
+    JsonBuffer out;
+    json_buffer_init(&out, output, ALLPAIRS_OUTPUT_BUFFER);
+    write_matrix_report(&out, &job, block_count, capped_terms);
+    int status = json_buffer_flush(&out) == 0 && fflush(output) == 0 ? 0 : 1;
+    if (status != 0) printf("Error: Writing the similarity matrix failed\n");
+    json_buffer_free(&out);
+
+    for (int b = 0; b < block_count; b++) free(job.blocks[b].pairs);
+    free(job.blocks);
+    for (int d = 0; d < job.doc_count; d++) {
+        free(job.doc_terms[d]);
+        free(job.doc_capped[d]);
+        free_document(job.docs[d]);
+    }
+    free(job.doc_terms);
+    free(job.doc_term_count);
+    free(job.doc_capped);
+    free(job.doc_capped_count);
+    free(job.postings);
+    free(job.posting_start);
+    free(job.terms);
+    free(job.term_df);
+    free(job.docs);
+    free_thread_pool(pool);
+    return status;
+}
@@ -0,0 +1,46 @@
+#ifndef ALLPAIRS_H
+#define ALLPAIRS_H
+
+#include "plagiarism.h"
+#include "pipeline.h"
+
+#define ALLPAIRS_DEFAULT_DF_CAP 256
+#define ALLPAIRS_DEFAULT_CLUSTER 0.5
+#define ALLPAIRS_ROWS_PER_TASK 8
+#define ALLPAIRS_OUTPUT_BUFFER (256 * 1024)
+
+// All-Pairs Similarity Matrix
+// Scores every pair of a document set in one pass. An inverted index maps
+// each fingerprint held by two or more documents to the ascending list of
+// documents holding it, and row i of the overlap matrix A·Aᵀ is counted by
+// walking the posting lists of document i's fingerprints into a dense
+// accumulator, blocks of rows in parallel. Only pairs that share a
+// fingerprint are ever touched.
+//
+// A fingerprint held by more than df_cap documents (template text, stock
+// phrases) would cost df² work on its own, so it is left out of the walk.
+// Pairs found through the other fingerprints get their capped overlap back
+// from a merge of the two documents' capped lists, which keeps their
+// scores exact; pairs sharing nothing but capped fingerprints are not
+// reported. A df_cap of 0 walks every fingerprint.
+//
+// Pair scores take the smaller document as the containment side, so the
+// matrix is symmetric. Pairs under similarity_min_score are dropped, and
+// pairs whose overall score reaches cluster_threshold join their documents
+// into the connected clusters of the report.
+
+typedef struct AllPairsConfig {
+    int k;
+    int window;
+    int threads;
+    int df_cap;
+    double cluster_threshold;
+    const char* cache_dir;     // NULL fingerprints documents from scratch
+    PipelineIo io;             // how the documents are read
+    int readers;
+    int queue_depth;
+} AllPairsConfig;
+
+int run_all_pairs(const AllPairsConfig* config, const char** paths, int path_count, FILE* output);
+
+#endif
@@ -0,0 +1,171 @@
+#include "arena.h"
+#include "perf.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Block Pool
+// Released standard-size blocks, reused by later arenas before asking
+// malloc. Loading threads share it, so it is guarded by one lock that is
+// taken once per block rather than once per allocation.
+static struct {
+    pthread_mutex_t lock;
+    ArenaBlock* blocks;
+    int count;
+} block_pool = { PTHREAD_MUTEX_INITIALIZER, NULL, 0 };
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static ArenaBlock* new_block(const ArenaAllocator* allocator, size_t size) {
+    ArenaBlock* block = NULL;
+    if (allocator == NULL && size == ARENA_BLOCK_SIZE) {
+        pthread_mutex_lock(&block_pool.lock);
+        block = block_pool.blocks;
+        if (block != NULL) {
+            block_pool.blocks = block->next;
+            block_pool.count--;
+        }
+        pthread_mutex_unlock(&block_pool.lock);
+        if (block != NULL) PERF_COUNT(PERF_ARENA_BLOCKS_REUSED, 1);
+    }
+    if (block == NULL) {
+        PERF_COUNT(PERF_ARENA_BLOCKS, 1);
+        block = (ArenaBlock*)(allocator != NULL
+                                  ? allocator->alloc(allocator->context, sizeof(ArenaBlock) + size)
+                                  : malloc(sizeof(ArenaBlock) + size));
+        if (block == NULL) return NULL;
+        block->size = size;
+    }
+    block->next = NULL;
+    block->used = 0;
+    block->last = 0;
+    return block;
+}
+
+static void release_blocks(const ArenaAllocator* allocator, ArenaBlock* block) {
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        if (allocator != NULL) {
+            allocator->free(allocator->context, block, sizeof(ArenaBlock) + block->size);
+            block = next;
+            continue;
+        }
+        int pooled = 0;
+        if (block->size == ARENA_BLOCK_SIZE) {
+            pthread_mutex_lock(&block_pool.lock);
+            if (block_pool.count < ARENA_POOL_MAX_BLOCKS) {
+                block->next = block_pool.blocks;
+                block_pool.blocks = block;
+                block_pool.count++;
+                pooled = 1;
+            }
+            pthread_mutex_unlock(&block_pool.lock);
+        }
+        if (!pooled) free(block);
+        block = next;
+    }
+}
+
+void arena_init(Arena* arena) {
+    arena_init_with(arena, NULL);
+}
+
+void arena_init_with(Arena* arena, const ArenaAllocator* allocator) {
+    arena->head = NULL;
+    arena->large = NULL;
+    arena->allocator = allocator;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = align_up(size > 0 ? size : 1);
+    if (perf_enabled) {
+        perf_add(PERF_ARENA_ALLOCATIONS, 1);
+        perf_add(PERF_ARENA_BYTES, size);
+    }
+
+    // Big requests are kept off the bump chain so they waste no block tail
+    if (size > ARENA_BLOCK_SIZE / 2) {
+        ArenaBlock* block = new_block(arena->allocator, size);
+        if (block == NULL) return NULL;
+        block->used = size;
+        block->next = arena->large;
+        arena->large = block;
+        return block->data;
+    }
+
+    ArenaBlock* head = arena->head;
+    if (head == NULL || head->used + size > head->size) {
+        head = new_block(arena->allocator, ARENA_BLOCK_SIZE);
+        if (head == NULL) return NULL;
+        head->next = arena->head;
+        arena->head = head;
+    }
+    head->last = head->used;
+    head->used += size;
+    return head->data + head->last;
+}
+
+void* arena_calloc(Arena* arena, size_t count, size_t size) {
+    void* ptr = arena_alloc(arena, count * size);
+    if (ptr != NULL) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+// Resizes in place when `ptr` is the newest allocation of the head block
+// (or a dedicated block with room), otherwise moves it; the old copy stays
+// in the arena until release.
+void* arena_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) return arena_alloc(arena, new_size);
+    new_size = align_up(new_size > 0 ? new_size : 1);
+
+    ArenaBlock* head = arena->head;
+    if (head != NULL && (char*)ptr == head->data + head->last &&
+        head->last + new_size <= head->size) {
+        head->used = head->last + new_size;
+        return ptr;
+    }
+    for (ArenaBlock* block = arena->large; block != NULL; block = block->next) {
+        if ((char*)ptr == block->data) {
+            if (new_size <= block->size) {
+                block->used = new_size;
+                return ptr;
+            }
+            break;
+        }
+    }
+    if (new_size <= align_up(old_size)) return ptr;
+
+    void* moved = arena_alloc(arena, new_size);
+    if (moved != NULL) memcpy(moved, ptr, old_size);
+    return moved;
+}
+
+// Returns a dedicated block or the newest bump allocation right away;
+// anything else is reclaimed on release
+void arena_free(Arena* arena, void* ptr) {
+    if (ptr == NULL) return;
+    ArenaBlock* head = arena->head;
+    if (head != NULL && (char*)ptr == head->data + head->last) {
+        head->used = head->last;
+        return;
+    }
+    for (ArenaBlock** link = &arena->large; *link != NULL; link = &(*link)->next) {
+        ArenaBlock* block = *link;
+        if ((char*)ptr == block->data) {
+            *link = block->next;
+            block->next = NULL;
+            release_blocks(arena->allocator, block);
+            return;
+        }
+    }
+}
+
+void arena_release(Arena* arena) {
+    release_blocks(arena->allocator, arena->head);
+    release_blocks(arena->allocator, arena->large);
+    arena->head = NULL;
+    arena->large = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+#define ARENA_POOL_MAX_BLOCKS 256
+
+// Bump Arena
+// Allocations are carved from a chain of blocks and are never freed one by
+// one: releasing the arena drops every block at once. Standard-size blocks
+// go back to a process-wide pool for the next arena; requests larger than
+// half a block get a block of their own, which arena_free can hand back
+// early (outgrown hash tables). The most recent allocation can be grown or
+// shrunk in place, which suits arrays filled by appending.
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;               // usable bytes in data
+    size_t used;
+    size_t last;               // offset of the most recent allocation
+    char data[];
+} ArenaBlock;
+
+// Caller-supplied source of blocks. An arena given one takes every block
+// from it and returns them to it, bypassing malloc and the pool.
+typedef struct ArenaAllocator {
+    void* (*alloc)(void* context, size_t size);
+    void (*free)(void* context, void* ptr, size_t size);
+    void* context;
+} ArenaAllocator;
+
+typedef struct Arena {
+    ArenaBlock* head;          // block currently bumped
+    ArenaBlock* large;         // dedicated blocks for big requests
+    const ArenaAllocator* allocator;  // NULL uses malloc and the pool
+} Arena;
+
+void arena_init(Arena* arena);
+void arena_init_with(Arena* arena, const ArenaAllocator* allocator);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_calloc(Arena* arena, size_t count, size_t size);
+void* arena_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+void arena_free(Arena* arena, void* ptr);
+void arena_release(Arena* arena);
+
+#endif
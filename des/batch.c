@@ -0,0 +1,226 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include "index.h"
+#include "lsh.h"
+#include "perf.h"
+#include "tfidf.h"
+#include "threadpool.h"
+
+#include <time.h>
+
+// One target of the chunk in flight. Slots, their buffers and result
+// arrays are reused from chunk to chunk. A slot keeps only the results
+// that pass --min-score, so its array grows with the matches, not with
+// the reference set.
+typedef struct BatchSlot {
+    char path[MAX_FILENAME_LENGTH];
+    JsonBuffer record;
+    SimilarityResult* results;
+    int result_capacity;
+    int* candidates;           // with --lsh only
+    int scored;                // -1 when the target could not be read
+} BatchSlot;
+
+typedef struct BatchJob {
+    const BatchConfig* config;
+    char** files;
+    Document** references;
+    int reference_count;
+    LshIndex* lsh;
+    IdfTable* idf;             // with --tfidf, built once for the whole batch
+    BatchSlot* slots;
+} BatchJob;
+
+static void batch_target_task(void* arg, int i) {
+    BatchJob* job = (BatchJob*)arg;
+    BatchSlot* slot = &job->slots[i];
+    slot->record.length = 0;
+
+    Document* target = load_document(slot->path, job->config->k, job->config->window);
+    if (target == NULL) {
+        slot->scored = -1;
+        json_buffer_printf(&slot->record, "{\"target_stats\": {\"filename\": ");
+        json_buffer_string(&slot->record, slot->path);
+        json_buffer_printf(&slot->record, "}, \"error\": \"cannot open target\"}\n");
+        return;
+    }
+
+    if (job->idf != NULL) tfidf_weigh_document(job->idf, target);
+
+    // Same candidate selection as the single-target mode
+    int candidate_count = job->reference_count;
+    if (job->lsh != NULL) candidate_count = lsh_query(job->lsh, target, slot->candidates);
+
+    // Pairs under --min-score are pruned and left out of the record
+    int scored = 0;
+    for (int c = 0; c < candidate_count; c++) {
+        Document* reference = job->references[job->lsh != NULL ? slot->candidates[c] : c];
+        SimilarityResult passing;
+        memset(&passing, 0, sizeof(passing));
+        HashSet* reference_set = document_kgrams(reference);
+        if (!compute_similarity_above(target->kgrams, reference_set, &passing)) continue;
+        if (scored == slot->result_capacity) {
+            slot->result_capacity = slot->result_capacity ? slot->result_capacity * 2
+                                                          : BATCH_INITIAL_RESULTS;
+            slot->results = (SimilarityResult*)realloc(
+                slot->results, slot->result_capacity * sizeof(SimilarityResult));
+        }
+        SimilarityResult* result = &slot->results[scored++];
+        *result = passing;
+        strcpy(result->filename, reference->filename);
+        result->tfidf_cosine = tfidf_cosine(target, reference);
+        compute_k_scores(target, reference, result);
+        find_common_phrases(target, reference, result);
+        compute_similarity_heatmap(target, reference, result);
+        find_fuzzy_passages(target, reference, result);
+    }
+    slot->scored = scored;
+
+    write_ndjson_record(&slot->record, slot->results, scored, target, job->config->k);
+    for (int r = 0; r < scored; r++) {
+        free_similarity_result(&slot->results[r]);
+    }
+    free_document(target);
+}
+
+// Reads the next target path from the manifest into `path`. Returns 0 at
+// the end of the manifest.
+static int next_manifest_path(FILE* manifest, char* path) {
+    char line[MAX_FILENAME_LENGTH * 2];
+    while (fgets(line, sizeof(line), manifest) != NULL) {
+        size_t length = strcspn(line, "\r\n");
+        if (line[length] == '\0' && !feof(manifest)) {
+            // Longer than any path we can open; drop the rest of the line
+            int c;
+            while ((c = fgetc(manifest)) != EOF && c != '\n') {
+            }
+        }
+        line[length] = '\0';
+        char* start = line;
+        while (*start == ' ' || *start == '\t') start++;
+        if (*start == '\0' || *start == '#') continue;
+        size_t copied = strlen(start);
+        if (copied > MAX_FILENAME_LENGTH - 1) copied = MAX_FILENAME_LENGTH - 1;
+        memcpy(path, start, copied);
+        path[copied] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int run_batch(const BatchConfig* config, const char* manifest_path, const char** paths,
+              int path_count, FILE* output) {
+    FILE* manifest = strcmp(manifest_path, "-") == 0 ? stdin : fopen(manifest_path, "r");
+    if (manifest == NULL) {
+        printf("Error: Cannot open manifest %s\n", manifest_path);
+        return 1;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Fingerprint the shared reference set once, through the pipeline
+    BatchJob job;
+    memset(&job, 0, sizeof(job));
+    job.config = config;
+    int file_count = 0;
+    job.files = collect_input_files(paths, path_count, &file_count);
+    job.references = (Document**)calloc(file_count > 0 ? file_count : 1, sizeof(Document*));
+    PipelineConfig ingest = { config->k, config->window, config->threads, config->readers,
+                              config->queue_depth, config->io, config->cache_dir, NULL, NULL };
+    PipelineStats stats;
+    if (pipeline_load_documents(&ingest, (const char**)job.files, file_count, job.references,
+                                &stats) != 0) {
+        printf("Error: Cannot start the ingestion pipeline\n");
+        if (manifest != stdin) fclose(manifest);
+        return 1;
+    }
+
+    // Keep the readable ones, densely, so LSH IDs index the array
+    for (int i = 0; i < file_count; i++) {
+        if (job.references[i] != NULL) {
+            job.references[job.reference_count++] = job.references[i];
+        } else {
+            printf("Warning: Cannot open reference file %s, skipping\n", job.files[i]);
+        }
+        free(job.files[i]);
+    }
+    free(job.files);
+    job.files = NULL;
+    printf("Loaded %d references", job.reference_count);
+    if (config->cache_dir != NULL) printf(" (%d from %s)", stats.cache_hits, config->cache_dir);
+    printf(" in %.2fs\n", elapsed_seconds(&start));
+    if (perf_enabled) print_pipeline_stats(&stats);
+
+    if (get_kgram_counts()) {
+        job.idf = build_idf_table(job.references, job.reference_count);
+        for (int i = 0; i < job.reference_count; i++) {
+            tfidf_weigh_document(job.idf, job.references[i]);
+        }
+    }
+    if (config->lsh_threshold > 0.0 && job.reference_count > 0) {
+        int bands, rows;
+        lsh_choose_bands(config->lsh_threshold, &bands, &rows);
+        job.lsh = create_lsh_index(bands, rows);
+        for (int i = 0; i < job.reference_count; i++) {
+            lsh_add(job.lsh, job.references[i], i);
+        }
+    }
+
+    ThreadPool* pool = create_thread_pool(config->threads);
+    int chunk = pool->thread_count * BATCH_TARGETS_PER_THREAD;
+    job.slots = (BatchSlot*)calloc(chunk, sizeof(BatchSlot));
+    for (int i = 0; i < chunk; i++) {
+        json_buffer_init(&job.slots[i].record, NULL, BATCH_RECORD_BUFFER);
+        if (job.lsh != NULL) {
+            job.slots[i].candidates = (int*)malloc(job.reference_count * sizeof(int));
+        }
+    }
+
+    // Stream the manifest a chunk at a time; records leave in manifest order
+    JsonBuffer out;
+    json_buffer_init(&out, output, BATCH_OUTPUT_BUFFER);
+    long targets = 0, unreadable = 0, comparisons = 0;
+    for (;;) {
+        int n = 0;
+        while (n < chunk && next_manifest_path(manifest, job.slots[n].path)) n++;
+        if (n == 0) break;
+
+        thread_pool_run(pool, n, batch_target_task, &job);
+        for (int i = 0; i < n; i++) {
+            const BatchSlot* slot = &job.slots[i];
+            json_buffer_write(&out, slot->record.data, slot->record.length);
+            if (slot->scored < 0) unreadable++; else comparisons += slot->scored;
+        }
+        targets += n;
+    }
+    int status = json_buffer_flush(&out) == 0 && fflush(output) == 0 ? 0 : 1;
+    if (status != 0) printf("Error: Writing batch results failed\n");
+
+    double seconds = elapsed_seconds(&start);
+    printf("Checked %ld targets (%ld unreadable) against %d references: %ld comparisons in %.2fs",
+           targets, unreadable, job.reference_count, comparisons, seconds);
+    printf(" (%.1f targets/s)\n", seconds > 0 ? targets / seconds : 0.0);
+
+    json_buffer_free(&out);
+    for (int i = 0; i < chunk; i++) {
+        json_buffer_free(&job.slots[i].record);
+        free(job.slots[i].results);
+        free(job.slots[i].candidates);
+    }
+    free(job.slots);
+    if (job.lsh != NULL) free_lsh_index(job.lsh);
+    if (job.idf != NULL) free_idf_table(job.idf);
+    for (int i = 0; i < job.reference_count; i++) {
+        free_document(job.references[i]);
+    }
+    free(job.references);
+    free_thread_pool(pool);
+    if (manifest != stdin) fclose(manifest);
+    return status;
+}
@@ -0,0 +1,36 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "plagiarism.h"
+#include "pipeline.h"
+
+#define BATCH_TARGETS_PER_THREAD 4
+#define BATCH_OUTPUT_BUFFER (256 * 1024)
+#define BATCH_RECORD_BUFFER (16 * 1024)
+#define BATCH_INITIAL_RESULTS 16
+
+// Batch Mode
+// Fingerprints the reference set once, then streams the manifest: one
+// target path per line ("-" reads it from stdin; blank lines and lines
+// starting with '#' are skipped). Targets are scored a chunk at a time,
+// in parallel, and each one's report is written to `output` as a single
+// NDJSON line in manifest order as soon as its chunk is done. Only one
+// chunk of targets is ever in memory, so memory stays flat however long
+// the manifest is. An unreadable target gets an "error" line instead.
+// References under similarity_min_score are left out of a target's line.
+
+typedef struct BatchConfig {
+    int k;
+    int window;
+    int threads;
+    double lsh_threshold;      // 0 scores every reference
+    const char* cache_dir;     // NULL fingerprints references from scratch
+    PipelineIo io;             // how the references are read
+    int readers;
+    int queue_depth;
+} BatchConfig;
+
+int run_batch(const BatchConfig* config, const char* manifest, const char** paths, int path_count,
+              FILE* output);
+
+#endif
@@ -0,0 +1,383 @@
+#define _POSIX_C_SOURCE 200809L
+#include "plagiarism.h"
+#include "normalize.h"
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Benchmark Harness
+// Generates a deterministic synthetic corpus for every point of a sweep
+// over document count, document length and k, writes it to a scratch
+// directory, and times each pipeline stage over it. Every configuration
+// is run --repeat times and the fastest time of each stage is kept. One
+// JSON object per configuration is written as a line (NDJSON) so runs can
+// be appended and compared across releases.
+
+#define BENCH_MAX_SWEEP 16
+#define BENCH_MIN_RUN 10
+#define BENCH_MAX_RUN 50
+
+typedef struct BenchConfig {
+    int docs[BENCH_MAX_SWEEP];
+    int doc_sweeps;
+    int lengths[BENCH_MAX_SWEEP];
+    int length_sweeps;
+    int ks[BENCH_MAX_SWEEP];
+    int k_sweeps;
+    int vocabulary;
+    double rate;               // fraction of the target copied from references
+    uint64_t seed;
+    int repeat;
+    const char* output;
+} BenchConfig;
+
+typedef struct StageTimes {
+    double ingest;
+    double preprocess;
+    double kgrams;
+    double similarity;
+    double phrases;
+} StageTimes;
+
+// Deterministic Generator
+typedef struct Rng {
+    uint64_t state;
+} Rng;
+
+static uint64_t rng_next(Rng* rng) {
+    // splitmix64
+    uint64_t z = (rng->state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double rng_uniform(Rng* rng) {
+    return (rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int rng_range(Rng* rng, int low, int high) {
+    return low + (int)(rng_next(rng) % (uint64_t)(high - low + 1));
+}
+
+// Word i spells i in base 90 with consonant-vowel syllables, so words are
+// distinct by construction; the few that happen to be stopwords get a
+// trailing 'n', which no syllable-only word has.
+static char** build_vocabulary(int size) {
+    static const char consonants[] = "bcdfghjklmnprstvwz";
+    static const char vowels[] = "aeiou";
+    char** words = (char**)malloc(size * sizeof(char*));
+    for (int i = 0; i < size; i++) {
+        char word[32];
+        int length = 0;
+        int value = i + 90;  // at least two syllables
+        while (value > 0) {
+            int syllable = value % 90;
+            word[length++] = consonants[syllable / 5];
+            word[length++] = vowels[syllable % 5];
+            value /= 90;
+        }
+        word[length] = '\0';
+        if (is_active_stopword(word, (size_t)length)) {
+            word[length++] = 'n';
+            word[length] = '\0';
+        }
+        words[i] = (char*)malloc(length + 1);
+        memcpy(words[i], word, length + 1);
+    }
+    return words;
+}
+
+// Zipf-like ranks: P(rank < r) = log(r + 1) / log(size + 1)
+static int zipf_word(Rng* rng, int size) {
+    int rank = (int)pow(size + 1.0, rng_uniform(rng)) - 1;
+    return rank < size ? rank : size - 1;
+}
+
+static void fill_words(Rng* rng, int* words, int count, int vocabulary) {
+    for (int i = 0; i < count; i++) {
+        words[i] = zipf_word(rng, vocabulary);
+    }
+}
+
+// The target interleaves runs copied verbatim from random references with
+// fresh runs, choosing a copied run with probability `rate`
+static void fill_target(Rng* rng, int* words, int count, int** references, int reference_count,
+                        int length, int vocabulary, double rate) {
+    int used = 0;
+    while (used < count) {
+        int run = rng_range(rng, BENCH_MIN_RUN, BENCH_MAX_RUN);
+        if (run > count - used) run = count - used;
+        if (reference_count > 0 && run <= length && rng_uniform(rng) < rate) {
+            const int* source = references[rng_range(rng, 0, reference_count - 1)];
+            int start = rng_range(rng, 0, length - run);
+            memcpy(words + used, source + start, run * sizeof(int));
+        } else {
+            fill_words(rng, words + used, run, vocabulary);
+        }
+        used += run;
+    }
+}
+
+// Writes words as prose: capitalized sentences, commas and paragraphs
+static size_t write_text(const char* path, Rng* rng, const int* words, int count, char** vocabulary) {
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) return 0;
+    size_t bytes = 0;
+    int sentence_start = 1;
+    for (int i = 0; i < count; i++) {
+        const char* word = vocabulary[words[i]];
+        if (sentence_start) {
+            fputc(toupper((unsigned char)word[0]), fp);
+            fputs(word + 1, fp);
+        } else {
+            fputs(word, fp);
+        }
+        bytes += strlen(word);
+        sentence_start = 0;
+
+        uint64_t roll = rng_next(rng) % 100;
+        if (roll < 7) {
+            fputs(roll == 0 ? ".\n\n" : ". ", fp);
+            bytes += roll == 0 ? 3 : 2;
+            sentence_start = 1;
+        } else if (roll < 13) {
+            fputs(", ", fp);
+            bytes += 2;
+        } else {
+            fputc(' ', fp);
+            bytes++;
+        }
+    }
+    fclose(fp);
+    return bytes;
+}
+
+// Timing
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static Document* timed_load(const char* path, int k, StageTimes* times) {
+    double start = now_ms();
+    MappedFile file;
+    if (map_text_file(path, &file) != 0) return NULL;
+    double mapped = now_ms();
+
+    Document* doc = create_document(path);
+    preprocess_document_buffer(doc, file.data, file.size);
+    double preprocessed = now_ms();
+    unmap_text_file(&file);
+    double unmapped = now_ms();
+
+    generate_kgrams(doc, k);
+    double fingerprinted = now_ms();
+
+    times->ingest += (mapped - start) + (unmapped - preprocessed);
+    times->preprocess += preprocessed - mapped;
+    times->kgrams += fingerprinted - unmapped;
+    return doc;
+}
+
+// One pass over a generated corpus: the target is scored against every
+// reference. Returns the number of tokens processed.
+static long run_once(char** paths, int doc_count, int k, StageTimes* times, double* max_containment) {
+    memset(times, 0, sizeof(StageTimes));
+    long tokens = 0;
+
+    Document* target = timed_load(paths[0], k, times);
+    Document** references = (Document**)malloc(doc_count * sizeof(Document*));
+    tokens += target->token_count;
+    for (int i = 0; i < doc_count; i++) {
+        references[i] = timed_load(paths[i + 1], k, times);
+        tokens += references[i]->token_count;
+    }
+
+    SimilarityResult* results = (SimilarityResult*)calloc(doc_count, sizeof(SimilarityResult));
+    double start = now_ms();
+    for (int i = 0; i < doc_count; i++) {
+        compute_similarity(target->kgrams, references[i]->kgrams, &results[i]);
+    }
+    double scored = now_ms();
+    for (int i = 0; i < doc_count; i++) {
+        find_common_phrases(target, references[i], &results[i]);
+    }
+    double phrased = now_ms();
+    times->similarity = scored - start;
+    times->phrases = phrased - scored;
+
+    *max_containment = 0.0;
+    for (int i = 0; i < doc_count; i++) {
+        if (results[i].containment > *max_containment) *max_containment = results[i].containment;
+        free_similarity_result(&results[i]);
+        free_document(references[i]);
+    }
+    free(results);
+    free(references);
+    free_document(target);
+    return tokens;
+}
+
+static void keep_fastest(StageTimes* best, const StageTimes* run, int first) {
+    if (first || run->ingest < best->ingest) best->ingest = run->ingest;
+    if (first || run->preprocess < best->preprocess) best->preprocess = run->preprocess;
+    if (first || run->kgrams < best->kgrams) best->kgrams = run->kgrams;
+    if (first || run->similarity < best->similarity) best->similarity = run->similarity;
+    if (first || run->phrases < best->phrases) best->phrases = run->phrases;
+}
+
+static void run_config(const BenchConfig* config, char** vocabulary, const char* directory,
+                       int doc_count, int length, int k, FILE* out) {
+    // Each configuration has its own stream, so results do not depend on
+    // which other points the sweep includes
+    Rng rng = { config->seed ^ ((uint64_t)doc_count << 40) ^ ((uint64_t)length << 8) };
+
+    int** words = (int**)malloc((doc_count + 1) * sizeof(int*));
+    char** paths = (char**)malloc((doc_count + 1) * sizeof(char*));
+    size_t bytes = 0;
+    for (int i = 0; i <= doc_count; i++) {
+        words[i] = (int*)malloc(length * sizeof(int));
+        paths[i] = (char*)malloc(strlen(directory) + 32);
+        sprintf(paths[i], "%s/doc-%06d.txt", directory, i);
+    }
+    for (int i = 1; i <= doc_count; i++) {
+        fill_words(&rng, words[i], length, config->vocabulary);
+    }
+    fill_target(&rng, words[0], length, words + 1, doc_count, length, config->vocabulary, config->rate);
+    for (int i = 0; i <= doc_count; i++) {
+        bytes += write_text(paths[i], &rng, words[i], length, vocabulary);
+    }
+
+    StageTimes best = { 0.0, 0.0, 0.0, 0.0, 0.0 }, times;
+    double max_containment = 0.0;
+    long tokens = 0;
+    for (int r = 0; r < config->repeat; r++) {
+        tokens = run_once(paths, doc_count, k, &times, &max_containment);
+        keep_fastest(&best, &times, r == 0);
+    }
+    double total = best.ingest + best.preprocess + best.kgrams + best.similarity + best.phrases;
+
+    fprintf(out, "{\"docs\": %d, \"length\": %d, \"k\": %d, \"vocabulary\": %d, \"rate\": %.3f, "
+                 "\"seed\": %llu, \"repeat\": %d, \"bytes\": %zu, \"tokens\": %ld, "
+                 "\"ingest_ms\": %.3f, \"preprocess_ms\": %.3f, \"kgrams_ms\": %.3f, "
+                 "\"similarity_ms\": %.3f, \"phrases_ms\": %.3f, \"total_ms\": %.3f, "
+                 "\"mb_per_sec\": %.2f, \"tokens_per_sec\": %.0f, \"max_containment\": %.4f, "
+                 "\"peak_rss_kb\": %ld}\n",
+            doc_count, length, k, config->vocabulary, config->rate,
+            (unsigned long long)config->seed, config->repeat, bytes, tokens,
+            best.ingest, best.preprocess, best.kgrams, best.similarity, best.phrases, total,
+            total > 0 ? bytes / 1048576.0 / (total / 1000.0) : 0.0,
+            total > 0 ? tokens / (total / 1000.0) : 0.0, max_containment, peak_rss_kb());
+    fflush(out);
+    fprintf(stderr, "docs %6d  length %7d  k %2d  %10.2f ms  %8.2f MB/s  rss %ld KB\n",
+            doc_count, length, k, total, total > 0 ? bytes / 1048576.0 / (total / 1000.0) : 0.0,
+            peak_rss_kb());
+
+    for (int i = 0; i <= doc_count; i++) {
+        unlink(paths[i]);
+        free(paths[i]);
+        free(words[i]);
+    }
+    free(paths);
+    free(words);
+}
+
+// Command Line
+static int parse_list(const char* text, int* values) {
+    int count = 0;
+    while (*text && count < BENCH_MAX_SWEEP) {
+        values[count++] = atoi(text);
+        const char* comma = strchr(text, ',');
+        if (comma == NULL) break;
+        text = comma + 1;
+    }
+    return count;
+}
+
+int main(int argc, char* argv[]) {
+    // Sweeps run smallest first, so peak RSS (which only grows) is still
+    // attributed to the first configuration that needed it
+    BenchConfig config = {
+        { 10, 50, 200 }, 3,
+        { 1000, 10000, 50000 }, 3,
+        { 3, 5, 7 }, 3,
+        20000, 0.3, 1, 3, NULL
+    };
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            printf("Missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--docs") == 0) {
+            config.doc_sweeps = parse_list(argv[++i], config.docs);
+        } else if (strcmp(argv[i], "--length") == 0) {
+            config.length_sweeps = parse_list(argv[++i], config.lengths);
+        } else if (strcmp(argv[i], "--k") == 0) {
+            config.k_sweeps = parse_list(argv[++i], config.ks);
+        } else if (strcmp(argv[i], "--vocabulary") == 0) {
+            config.vocabulary = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0) {
+            config.rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            config.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            config.repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0) {
+            config.output = argv[++i];
+        } else {
+            printf("Usage: %s [--docs n,...] [--length tokens,...] [--k k,...] [--vocabulary words]\n", argv[0]);
+            printf("          [--rate copied_fraction] [--seed n] [--repeat n] [--output file.ndjson]\n");
+            return 1;
+        }
+    }
+    if (config.vocabulary < 2) config.vocabulary = 2;
+    if (config.repeat < 1) config.repeat = 1;
+
+    FILE* out = stdout;
+    if (config.output != NULL) {
+        out = fopen(config.output, "a");
+        if (out == NULL) {
+            printf("Error: Cannot open %s\n", config.output);
+            return 1;
+        }
+    }
+
+    char directory[] = "/tmp/plagiarism-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        printf("Error: Cannot create a scratch directory\n");
+        return 1;
+    }
+
+    char** vocabulary = build_vocabulary(config.vocabulary);
+    for (int d = 0; d < config.doc_sweeps; d++) {
+        for (int l = 0; l < config.length_sweeps; l++) {
+            for (int q = 0; q < config.k_sweeps; q++) {
+                int k = config.ks[q] < 2 || config.ks[q] > KGRAM_MAX_LENGTH ? 3 : config.ks[q];
+                run_config(&config, vocabulary, directory, config.docs[d], config.lengths[l], k, out);
+            }
+        }
+    }
+
+    rmdir(directory);
+    for (int i = 0; i < config.vocabulary; i++) {
+        free(vocabulary[i]);
+    }
+    free(vocabulary);
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,215 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cache.h"
+#include "normalize.h"
+#include "perf.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Varint Coding
+static size_t put_varint(unsigned char* out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+// Returns bytes consumed, or 0 if the varint runs past `end`
+static size_t get_varint(const unsigned char* in, const unsigned char* end, uint64_t* value) {
+    uint64_t result = 0;
+    for (size_t n = 0; n < 10 && in + n < end; n++) {
+        result |= (uint64_t)(in[n] & 0x7f) << (7 * n);
+        if ((in[n] & 0x80) == 0) {
+            *value = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static void cache_path(char* path, size_t size, const char* cache_dir, const uint64_t hash[2],
+                       int k, int window) {
+    snprintf(path, size, "%s/%016llx%016llx-k%d-w%d-%016llx.fp", cache_dir,
+             (unsigned long long)hash[0], (unsigned long long)hash[1], k, window,
+             (unsigned long long)normalization_signature());
+}
+
+// Reader
+static Document* read_cache_file(const char* file_path, const char* path, const uint64_t hash[2],
+                                 int k, int window) {
+    MappedFile file;
+    if (map_text_file(file_path, &file) != 0) return NULL;
+
+    CacheHeader header;
+    size_t fixed = sizeof(CacheHeader) + MINHASH_SIZE * sizeof(uint64_t);
+    if (file.size < fixed) {
+        unmap_text_file(&file);
+        return NULL;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, 8) != 0 || header.version != CACHE_FORMAT_VERSION ||
+        header.k != (uint32_t)k || header.window != (uint32_t)window ||
+        header.content_hash[0] != hash[0] || header.content_hash[1] != hash[1] ||
+        header.normalization != normalization_signature() ||
+        header.payload_size != file.size - fixed ||
+        // Every varint takes at least one byte, so the count is bounded
+        // before anything is sized by it
+        header.fingerprint_count > header.payload_size || header.fingerprint_count > INT_MAX ||
+        header.token_count > INT_MAX || header.kgram_count > INT_MAX) {
+        unmap_text_file(&file);
+        return NULL;
+    }
+
+    Document* doc = create_document(path);
+    doc->k = k;
+    doc->window = window;
+    doc->token_count = (int)header.token_count;
+    doc->kgram_count = (int)header.kgram_count;
+    memcpy(doc->minhash, file.data + sizeof(CacheHeader), MINHASH_SIZE * sizeof(uint64_t));
+
+    int count = (int)header.fingerprint_count;
+    uint64_t* sorted = (uint64_t*)arena_alloc(&doc->arena, (count > 0 ? count : 1) * sizeof(uint64_t));
+    const unsigned char* in = (const unsigned char*)file.data + fixed;
+    const unsigned char* end = (const unsigned char*)file.data + file.size;
+    uint64_t previous = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t gap;
+        size_t used = get_varint(in, end, &gap);
+        // Fingerprints are distinct and ascending: only the first gap may
+        // be 0, and none may wrap
+        if (used == 0 || (i > 0 && (gap == 0 || previous + gap < previous))) {
+            unmap_text_file(&file);
+            free_document(doc);
+            return NULL;
+        }
+        in += used;
+        previous += gap;
+        sorted[i] = previous;
+        hash_set_add_fingerprint(doc->kgrams, previous);
+    }
+    int trailing = in != end;
+    unmap_text_file(&file);
+    if (trailing) {
+        free_document(doc);
+        return NULL;
+    }
+
+    doc->kgrams->sorted = sorted;
+    doc->kgrams->sorted_valid = 1;
+    doc->source_hash[0] = hash[0];
+    doc->source_hash[1] = hash[1];
+    doc->tokens_pending = 1;
+    return doc;
+}
+
+// Writer
+// Written to a temporary file and renamed into place, so a concurrent
+// reader sees either no entry or a complete one.
+static void write_cache_file(const char* cache_dir, const char* file_path, Document* doc,
+                             const uint64_t hash[2], int k) {
+    const uint64_t* sorted = hash_set_sorted_fingerprints(doc->kgrams);
+    int count = doc->kgrams->count;
+    unsigned char* payload = (unsigned char*)malloc((size_t)count * 10 + 1);
+    size_t payload_size = 0;
+    uint64_t previous = 0;
+    for (int i = 0; i < count; i++) {
+        payload_size += put_varint(payload + payload_size, sorted[i] - previous);
+        previous = sorted[i];
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.version = CACHE_FORMAT_VERSION;
+    header.k = (uint32_t)k;
+    header.window = (uint32_t)doc->window;
+    header.token_count = (uint32_t)doc->token_count;
+    header.kgram_count = (uint32_t)doc->kgram_count;
+    header.fingerprint_count = (uint32_t)count;
+    header.content_hash[0] = hash[0];
+    header.content_hash[1] = hash[1];
+    header.normalization = normalization_signature();
+    header.payload_size = payload_size;
+
+    char tmp_path[MAX_FILENAME_LENGTH + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/tmp-XXXXXX", cache_dir);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0 && errno == ENOENT && mkdir(cache_dir, 0755) == 0) {
+        snprintf(tmp_path, sizeof(tmp_path), "%s/tmp-XXXXXX", cache_dir);
+        fd = mkstemp(tmp_path);
+    }
+    if (fd >= 0) {
+        fchmod(fd, 0644);
+        FILE* fp = fdopen(fd, "wb");
+        int ok = fp != NULL &&
+                 fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                 fwrite(doc->minhash, sizeof(uint64_t), MINHASH_SIZE, fp) == MINHASH_SIZE &&
+                 fwrite(payload, 1, payload_size, fp) == payload_size;
+        if (fp != NULL) {
+            ok = fclose(fp) == 0 && ok;
+        } else {
+            close(fd);
+        }
+        if (!ok || rename(tmp_path, file_path) != 0) unlink(tmp_path);
+    }
+    free(payload);
+}
+
+// Loads `path`, whose `size` bytes are at `data`, from the cache when its
+// content, k, window and normalization match an entry; otherwise
+// processes it and stores it. Sets *hit to whether the cache answered.
+Document* load_cached_buffer(const char* cache_dir, const char* path, const char* data,
+                             size_t size, int k, int window, int* hit) {
+    *hit = 0;
+    uint64_t hash[2];
+    content_hash(data, size, hash);
+
+    Document* doc = create_document(path);
+    int k_min, k_max;
+    if (doc->kgrams->exact || get_kgram_range(&k_min, &k_max) || get_kgram_counts()) {
+        // Exact keys are dictionary IDs, which do not outlive the process;
+        // entries hold a single k and no occurrence counts
+        preprocess_document_buffer(doc, data, size);
+        generate_winnowed_kgrams(doc, k, window);
+        return doc;
+    }
+    free_document(doc);
+
+    char entry[MAX_FILENAME_LENGTH + 96];
+    cache_path(entry, sizeof(entry), cache_dir, hash, k, window);
+    doc = read_cache_file(entry, path, hash, k, window);
+    if (doc != NULL) {
+        *hit = 1;
+        PERF_COUNT(PERF_CACHE_HITS, 1);
+        return doc;
+    }
+    PERF_COUNT(PERF_CACHE_MISSES, 1);
+
+    doc = create_document(path);
+    preprocess_document_buffer(doc, data, size);
+    generate_winnowed_kgrams(doc, k, window);
+    write_cache_file(cache_dir, entry, doc, hash, k);
+    return doc;
+}
+
+// Maps `path` and loads it through load_cached_buffer. Returns NULL if
+// `path` cannot be read.
+Document* load_cached_document(const char* cache_dir, const char* path, int k, int window,
+                               int* hit) {
+    *hit = 0;
+    uint64_t start = perf_enabled ? perf_now_ns() : 0;
+    MappedFile file;
+    if (map_text_file(path, &file) != 0) return NULL;
+    if (perf_enabled) {
+        perf_stage(PERF_STAGE_INGEST, start);
+        perf_add(PERF_INPUT_BYTES, file.size);
+    }
+    Document* doc = load_cached_buffer(cache_dir, path, file.data, file.size, k, window, hit);
+    unmap_text_file(&file);
+    return doc;
+}
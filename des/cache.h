@@ -0,0 +1,38 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "plagiarism.h"
+
+#define CACHE_MAGIC "PLGFPC01"
+#define CACHE_FORMAT_VERSION 2
+
+// Fingerprint Cache
+// A cache directory holds one file per processed document, named by a
+// 128-bit hash of the file's bytes plus k, the winnowing window and the
+// normalization signature, so a changed file or setting simply misses.
+// Each file stores the header below, the MinHash signature, then the
+// sorted fingerprints as LEB128 varints of the gaps between them. Exact
+// mode keys depend on the per-process token dictionary and bypass the
+// cache, as do multi-k runs (set_kgram_range) and counting runs
+// (set_kgram_counts). Documents loaded from it have no tokens until a passage search
+// asks for them (ensure_document_tokens).
+
+typedef struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t k;
+    uint32_t window;
+    uint32_t token_count;
+    uint32_t kgram_count;
+    uint32_t fingerprint_count;
+    uint64_t content_hash[2];
+    uint64_t normalization;
+    uint64_t payload_size;     // varint bytes after the signature
+} CacheHeader;
+
+Document* load_cached_buffer(const char* cache_dir, const char* path, const char* data,
+                             size_t size, int k, int window, int* hit);
+Document* load_cached_document(const char* cache_dir, const char* path, int k, int window,
+                               int* hit);
+
+#endif
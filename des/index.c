@@ -0,0 +1,484 @@
+#define _POSIX_C_SOURCE 200809L
+#include "index.h"
+#include "normalize.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct Posting {
+    uint64_t fingerprint;
+    uint32_t doc_id;
+} Posting;
+
+typedef struct ScoredDoc {
+    int doc_id;
+    int intersection;
+    double overall;
+} ScoredDoc;
+
+// Meta File
+// Besides k and window, the meta file records what else decides the
+// fingerprints: the normalization signature (stopwords, stemming) and
+// whether k-grams were built in exact mode
+typedef struct IndexMeta {
+    int k;
+    int window;
+    unsigned long long normalization;
+    int exact;
+    int segments;
+    int documents;
+} IndexMeta;
+
+static int read_meta(const char* index_dir, IndexMeta* meta) {
+    char path[MAX_FILENAME_LENGTH + 16];
+    snprintf(path, sizeof(path), "%s/meta", index_dir);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) return 0;
+
+    int ok = fscanf(fp, "k %d\nwindow %d\nnormalization %llx\nexact %d\nsegments %d\ndocuments %d\n",
+                    &meta->k, &meta->window, &meta->normalization, &meta->exact,
+                    &meta->segments, &meta->documents) == 6;
+    fclose(fp);
+    return ok ? 1 : -1;
+}
+
+static int write_meta(const char* index_dir, int k, int window, int segments, int documents) {
+    char path[MAX_FILENAME_LENGTH + 16];
+    char tmp_path[MAX_FILENAME_LENGTH + 16];
+    snprintf(path, sizeof(path), "%s/meta", index_dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/meta.tmp", index_dir);
+
+    FILE* fp = fopen(tmp_path, "w");
+    if (fp == NULL) return -1;
+    fprintf(fp, "k %d\nwindow %d\nnormalization %016llx\nexact %d\nsegments %d\ndocuments %d\n", k,
+            window, (unsigned long long)normalization_signature(), get_kgram_exact_mode(), segments,
+            documents);
+    fclose(fp);
+
+    // Readers see either the old or the new segment count, never a mix
+    return rename(tmp_path, path);
+}
+
+static void segment_path(char* path, size_t size, const char* index_dir, int segment) {
+    snprintf(path, size, "%s/seg-%05d.idx", index_dir, segment);
+}
+
+// Fingerprints only compare when the tokens and k-grams behind them were
+// made the same way. Returns 1 when the current settings match the meta.
+static int meta_settings_match(const char* index_dir, const IndexMeta* meta) {
+    if (meta->normalization != (unsigned long long)normalization_signature()) {
+        printf("Error: Index %s was built with different stopwords or stemming\n", index_dir);
+        return 0;
+    }
+    if (meta->exact != get_kgram_exact_mode()) {
+        printf("Error: Index %s was built %s --exact\n", index_dir, meta->exact ? "with" : "without");
+        return 0;
+    }
+    return 1;
+}
+
+// Input Collection
+static int compare_strings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void append_path(char*** files, int* count, int* capacity, const char* path) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *files = (char**)realloc(*files, *capacity * sizeof(char*));
+    }
+    (*files)[*count] = (char*)malloc(strlen(path) + 1);
+    strcpy((*files)[*count], path);
+    (*count)++;
+}
+
+// Expands directories into their regular files, sorted by name so that
+// document IDs do not depend on readdir order.
+char** collect_input_files(const char** paths, int path_count, int* file_count) {
+    char** files = NULL;
+    int count = 0, capacity = 0;
+
+    for (int i = 0; i < path_count; i++) {
+        struct stat st;
+        if (stat(paths[i], &st) != 0) {
+            printf("Warning: Cannot access %s, skipping\n", paths[i]);
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            append_path(&files, &count, &capacity, paths[i]);
+            continue;
+        }
+
+        DIR* dir = opendir(paths[i]);
+        if (dir == NULL) continue;
+        int first = count;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            char full[MAX_FILENAME_LENGTH * 2];
+            snprintf(full, sizeof(full), "%s/%s", paths[i], entry->d_name);
+            if (stat(full, &st) == 0 && S_ISREG(st.st_mode)) {
+                append_path(&files, &count, &capacity, full);
+            }
+        }
+        closedir(dir);
+        qsort(files + first, count - first, sizeof(char*), compare_strings);
+    }
+
+    *file_count = count;
+    return files;
+}
+
+// Segment Writer
+static int compare_postings(const void* a, const void* b) {
+    const Posting* pa = (const Posting*)a;
+    const Posting* pb = (const Posting*)b;
+    if (pa->fingerprint != pb->fingerprint) return pa->fingerprint < pb->fingerprint ? -1 : 1;
+    return (pa->doc_id > pb->doc_id) - (pa->doc_id < pb->doc_id);
+}
+
+static void write_padding(FILE* fp, uint64_t* offset) {
+    static const char zeros[8] = {0};
+    size_t pad = (size_t)((8 - (*offset & 7)) & 7);
+    fwrite(zeros, 1, pad, fp);
+    *offset += pad;
+}
+
+static int write_segment(const char* path, uint32_t base_doc, uint32_t doc_count,
+                         char** names, const uint32_t* sizes,
+                         Posting* postings, uint64_t posting_count) {
+    qsort(postings, posting_count, sizeof(Posting), compare_postings);
+
+    uint64_t term_count = 0;
+    for (uint64_t i = 0; i < posting_count; i++) {
+        if (i == 0 || postings[i].fingerprint != postings[i - 1].fingerprint) term_count++;
+    }
+
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+
+    IndexSegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, 8);
+    header.base_doc = base_doc;
+    header.doc_count = doc_count;
+    header.term_count = term_count;
+    header.posting_count = posting_count;
+
+    uint64_t offset = sizeof(header);
+    fseek(fp, (long)offset, SEEK_SET);
+
+    header.sizes_offset = offset;
+    fwrite(sizes, sizeof(uint32_t), doc_count, fp);
+    offset += (uint64_t)doc_count * sizeof(uint32_t);
+    write_padding(fp, &offset);
+
+    header.names_offset = offset;
+    uint32_t name_offset = 0;
+    for (uint32_t i = 0; i < doc_count; i++) {
+        fwrite(&name_offset, sizeof(uint32_t), 1, fp);
+        name_offset += (uint32_t)strlen(names[i]) + 1;
+    }
+    offset += (uint64_t)doc_count * sizeof(uint32_t);
+
+    header.blob_offset = offset;
+    for (uint32_t i = 0; i < doc_count; i++) {
+        fwrite(names[i], 1, strlen(names[i]) + 1, fp);
+    }
+    offset += name_offset;
+    write_padding(fp, &offset);
+
+    header.terms_offset = offset;
+    uint64_t start = 0;
+    for (uint64_t i = 0; i < posting_count; i++) {
+        if (i + 1 == posting_count || postings[i + 1].fingerprint != postings[i].fingerprint) {
+            IndexTerm term;
+            term.fingerprint = postings[i].fingerprint;
+            term.postings_start = start;
+            term.postings_length = (uint32_t)(i + 1 - start);
+            term.reserved = 0;
+            fwrite(&term, sizeof(term), 1, fp);
+            start = i + 1;
+        }
+    }
+    offset += term_count * sizeof(IndexTerm);
+
+    header.postings_offset = offset;
+    for (uint64_t i = 0; i < posting_count; i++) {
+        fwrite(&postings[i].doc_id, sizeof(uint32_t), 1, fp);
+    }
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fp);
+    int failed = ferror(fp);
+    fclose(fp);
+    return failed ? -1 : 0;
+}
+
+// Adds documents (files or directories of files) to the index at
+// `index_dir`, creating it if needed. Existing segments are left untouched;
+// new documents go into new segments. Returns the number of documents
+// added, or -1 if the index exists with different k, window,
+// normalization or exact mode settings.
+int index_add_documents(const char* index_dir, int k, int window,
+                        const char** paths, int path_count) {
+    IndexMeta meta;
+    int status = read_meta(index_dir, &meta);
+    int segments = status == 1 ? meta.segments : 0;
+    int documents = status == 1 ? meta.documents : 0;
+    if (status < 0) {
+        printf("Error: Corrupt index meta in %s\n", index_dir);
+        return -1;
+    }
+    if (status == 0) {
+        if (mkdir(index_dir, 0755) != 0 && errno != EEXIST) {
+            printf("Error: Cannot create index directory %s\n", index_dir);
+            return -1;
+        }
+    } else if (meta.k != k || meta.window != window) {
+        printf("Error: Index %s was built with k=%d window=%d\n", index_dir, meta.k, meta.window);
+        return -1;
+    } else if (!meta_settings_match(index_dir, &meta)) {
+        return -1;
+    }
+
+    int file_count = 0;
+    char** files = collect_input_files(paths, path_count, &file_count);
+    int added = 0;
+
+    for (int batch = 0; batch < file_count; batch += INDEX_SEGMENT_DOCS) {
+        int batch_end = batch + INDEX_SEGMENT_DOCS < file_count ? batch + INDEX_SEGMENT_DOCS : file_count;
+        char** names = (char**)malloc((batch_end - batch) * sizeof(char*));
+        uint32_t* sizes = (uint32_t*)malloc((batch_end - batch) * sizeof(uint32_t));
+        Posting* postings = NULL;
+        uint64_t posting_count = 0, posting_capacity = 0;
+        uint32_t doc_count = 0;
+
+        for (int i = batch; i < batch_end; i++) {
+            Document* doc = load_document(files[i], k, window);
+            if (doc == NULL) {
+                printf("Warning: Cannot open reference file %s, skipping\n", files[i]);
+                continue;
+            }
+
+            const uint64_t* fingerprints = hash_set_sorted_fingerprints(doc->kgrams);
+            int count = doc->kgrams->count;
+            if (posting_count + count > posting_capacity) {
+                while (posting_count + count > posting_capacity) {
+                    posting_capacity = posting_capacity ? posting_capacity * 2 : 65536;
+                }
+                postings = (Posting*)realloc(postings, posting_capacity * sizeof(Posting));
+            }
+            for (int j = 0; j < count; j++) {
+                postings[posting_count].fingerprint = fingerprints[j];
+                postings[posting_count].doc_id = (uint32_t)(documents + doc_count);
+                posting_count++;
+            }
+
+            names[doc_count] = files[i];
+            sizes[doc_count] = (uint32_t)count;
+            doc_count++;
+            free_document(doc);
+        }
+
+        if (doc_count > 0) {
+            char path[MAX_FILENAME_LENGTH + 32];
+            segment_path(path, sizeof(path), index_dir, segments);
+            if (write_segment(path, (uint32_t)documents, doc_count, names, sizes,
+                              postings, posting_count) != 0 ||
+                write_meta(index_dir, k, window, segments + 1, documents + (int)doc_count) != 0) {
+                printf("Error: Cannot write index segment %s\n", path);
+                added = -1;
+            } else {
+                segments++;
+                documents += (int)doc_count;
+                added += (int)doc_count;
+            }
+        }
+
+        free(postings);
+        free(sizes);
+        free(names);
+        if (added < 0) break;
+    }
+
+    if (status == 0 && added == 0) {
+        write_meta(index_dir, k, window, 0, 0);
+    }
+    for (int i = 0; i < file_count; i++) {
+        free(files[i]);
+    }
+    free(files);
+    return added;
+}
+
+// Index Reader
+static int map_segment(const char* path, IndexSegment* segment) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexSegmentHeader)) {
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const char* base = (const char*)map;
+    segment->map = map;
+    segment->map_size = (size_t)st.st_size;
+    segment->header = (const IndexSegmentHeader*)map;
+    if (memcmp(segment->header->magic, INDEX_MAGIC, 8) != 0 ||
+        segment->header->postings_offset + segment->header->posting_count * sizeof(uint32_t) >
+            segment->map_size) {
+        munmap(map, segment->map_size);
+        return -1;
+    }
+    segment->sizes = (const uint32_t*)(base + segment->header->sizes_offset);
+    segment->name_offsets = (const uint32_t*)(base + segment->header->names_offset);
+    segment->names = base + segment->header->blob_offset;
+    segment->terms = (const IndexTerm*)(base + segment->header->terms_offset);
+    segment->postings = (const uint32_t*)(base + segment->header->postings_offset);
+    return 0;
+}
+
+// Opens the index for queries with the current settings, so it fails
+// when they differ from the ones the index was built with
+Index* index_open(const char* index_dir) {
+    IndexMeta meta;
+    if (read_meta(index_dir, &meta) != 1 || !meta_settings_match(index_dir, &meta)) {
+        return NULL;
+    }
+    Index* index = (Index*)malloc(sizeof(Index));
+    index->k = meta.k;
+    index->window = meta.window;
+    index->segment_count = meta.segments;
+    index->doc_count = meta.documents;
+    strncpy(index->path, index_dir, MAX_FILENAME_LENGTH - 1);
+    index->path[MAX_FILENAME_LENGTH - 1] = '\0';
+    index->segments = (IndexSegment*)calloc(index->segment_count > 0 ? index->segment_count : 1,
+                                            sizeof(IndexSegment));
+
+    for (int i = 0; i < index->segment_count; i++) {
+        char path[MAX_FILENAME_LENGTH + 32];
+        segment_path(path, sizeof(path), index_dir, i);
+        if (map_segment(path, &index->segments[i]) != 0) {
+            printf("Error: Cannot map index segment %s\n", path);
+            index->segment_count = i;
+            index_close(index);
+            return NULL;
+        }
+    }
+    return index;
+}
+
+static const IndexSegment* find_segment(Index* index, int doc_id) {
+    for (int i = 0; i < index->segment_count; i++) {
+        const IndexSegmentHeader* header = index->segments[i].header;
+        if ((uint32_t)doc_id >= header->base_doc &&
+            (uint32_t)doc_id < header->base_doc + header->doc_count) {
+            return &index->segments[i];
+        }
+    }
+    return NULL;
+}
+
+const char* index_document_name(Index* index, int doc_id) {
+    const IndexSegment* segment = find_segment(index, doc_id);
+    if (segment == NULL) return NULL;
+    return segment->names + segment->name_offsets[doc_id - segment->header->base_doc];
+}
+
+static int compare_scored(const void* a, const void* b) {
+    const ScoredDoc* sa = (const ScoredDoc*)a;
+    const ScoredDoc* sb = (const ScoredDoc*)b;
+    if (sa->overall != sb->overall) return sa->overall < sb->overall ? 1 : -1;
+    return sa->doc_id - sb->doc_id;
+}
+
+// Scores `target` against every indexed document that shares at least one
+// fingerprint with it. The sorted target fingerprints are merged with each
+// segment's term table, so only matching posting lists are touched.
+// Returns the number of results (at most `top`, best first).
+int index_query(Index* index, Document* target, int top, SimilarityResult** results) {
+    const uint64_t* fingerprints = hash_set_sorted_fingerprints(target->kgrams);
+    int target_count = target->kgrams->count;
+    uint32_t* counts = (uint32_t*)calloc(index->doc_count > 0 ? index->doc_count : 1,
+                                         sizeof(uint32_t));
+
+    for (int s = 0; s < index->segment_count; s++) {
+        const IndexSegment* segment = &index->segments[s];
+        uint64_t lo = 0, term_count = segment->header->term_count;
+
+        for (int i = 0; i < target_count && lo < term_count; i++) {
+            // Lower bound of this fingerprint in the remaining terms
+            uint64_t hi = term_count;
+            while (lo < hi) {
+                uint64_t mid = lo + (hi - lo) / 2;
+                if (segment->terms[mid].fingerprint < fingerprints[i]) lo = mid + 1;
+                else hi = mid;
+            }
+            if (lo < term_count && segment->terms[lo].fingerprint == fingerprints[i]) {
+                const IndexTerm* term = &segment->terms[lo];
+                const uint32_t* postings = segment->postings + term->postings_start;
+                for (uint32_t p = 0; p < term->postings_length; p++) {
+                    counts[postings[p]]++;
+                }
+                lo++;
+            }
+        }
+    }
+
+    ScoredDoc* scored = NULL;
+    int scored_count = 0, scored_capacity = 0;
+    for (int s = 0; s < index->segment_count; s++) {
+        const IndexSegment* segment = &index->segments[s];
+        for (uint32_t d = 0; d < segment->header->doc_count; d++) {
+            int doc_id = (int)(segment->header->base_doc + d);
+            if (counts[doc_id] == 0) continue;
+            SimilarityResult scores;
+            fill_similarity_scores(&scores, (int)counts[doc_id], target_count, (int)segment->sizes[d]);
+            if (scores.overall < similarity_min_score) continue;
+            if (scored_count == scored_capacity) {
+                scored_capacity = scored_capacity ? scored_capacity * 2 : 256;
+                scored = (ScoredDoc*)realloc(scored, scored_capacity * sizeof(ScoredDoc));
+            }
+            scored[scored_count].doc_id = doc_id;
+            scored[scored_count].intersection = (int)counts[doc_id];
+            scored[scored_count].overall = scores.overall;
+            scored_count++;
+        }
+    }
+    free(counts);
+
+    qsort(scored, scored_count, sizeof(ScoredDoc), compare_scored);
+    if (top > 0 && scored_count > top) scored_count = top;
+
+    *results = (SimilarityResult*)calloc(scored_count > 0 ? scored_count : 1, sizeof(SimilarityResult));
+    for (int i = 0; i < scored_count; i++) {
+        const IndexSegment* segment = find_segment(index, scored[i].doc_id);
+        uint32_t local = (uint32_t)scored[i].doc_id - segment->header->base_doc;
+        SimilarityResult* result = &(*results)[i];
+        strncpy(result->filename, segment->names + segment->name_offsets[local], MAX_FILENAME_LENGTH - 1);
+        fill_similarity_scores(result, scored[i].intersection, target_count, (int)segment->sizes[local]);
+        // Segments keep fingerprints only, so no passages can be recovered
+        result->passages = NULL;
+        result->passage_count = 0;
+    }
+    free(scored);
+    return scored_count;
+}
+
+void index_close(Index* index) {
+    for (int i = 0; i < index->segment_count; i++) {
+        munmap(index->segments[i].map, index->segments[i].map_size);
+    }
+    free(index->segments);
+    free(index);
+}
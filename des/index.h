@@ -0,0 +1,68 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "plagiarism.h"
+
+#define INDEX_MAGIC "PLGIDX01"
+#define INDEX_SEGMENT_DOCS 4096
+#define INDEX_DEFAULT_TOP 20
+
+// On-disk inverted index
+// An index directory holds a text `meta` file (k, window, normalization
+// signature, exact mode, segment and document counts) and numbered
+// segment files (seg-00000.idx, ...). Each segment is written once and never modified:
+// it stores the names and fingerprint counts of the documents it added and
+// a sorted term table mapping fingerprint -> posting list of global
+// document IDs. Appending documents writes new segments; queries mmap
+// every segment read-only.
+
+typedef struct IndexSegmentHeader {
+    char magic[8];
+    uint32_t base_doc;
+    uint32_t doc_count;
+    uint64_t term_count;
+    uint64_t posting_count;
+    uint64_t sizes_offset;     // uint32_t[doc_count] fingerprint counts
+    uint64_t names_offset;     // uint32_t[doc_count] offsets into the name blob
+    uint64_t blob_offset;      // NUL-terminated document names
+    uint64_t terms_offset;     // IndexTerm[term_count], ascending fingerprint
+    uint64_t postings_offset;  // uint32_t[posting_count] document IDs
+} IndexSegmentHeader;
+
+typedef struct IndexTerm {
+    uint64_t fingerprint;
+    uint64_t postings_start;
+    uint32_t postings_length;
+    uint32_t reserved;
+} IndexTerm;
+
+typedef struct IndexSegment {
+    void* map;
+    size_t map_size;
+    const IndexSegmentHeader* header;
+    const uint32_t* sizes;
+    const uint32_t* name_offsets;
+    const char* names;
+    const IndexTerm* terms;
+    const uint32_t* postings;
+} IndexSegment;
+
+typedef struct Index {
+    char path[MAX_FILENAME_LENGTH];
+    int k;
+    int window;
+    int segment_count;
+    int doc_count;
+    IndexSegment* segments;
+} Index;
+
+char** collect_input_files(const char** paths, int path_count, int* file_count);
+int index_add_documents(const char* index_dir, int k, int window,
+                        const char** paths, int path_count);
+Index* index_open(const char* index_dir);
+const char* index_document_name(Index* index, int doc_id);
+int index_query(Index* index, Document* target, int top,
+                SimilarityResult** results);
+void index_close(Index* index);
+
+#endif
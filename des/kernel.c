@@ -0,0 +1,374 @@
+#include "plagiarism.h"
+#include "perf.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNEL_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define KERNEL_NEON 1
+#endif
+
+// Sorted Fingerprint Intersection
+// Both inputs are ascending and duplicate free. The vector variants compare
+// a block of `a` against every lane of a block of `b` by rotating `b`, then
+// advance whichever block ends with the smaller fingerprint. Each fingerprint
+// of `a` equals at most one of `b`, so a match is never counted twice.
+
+static int intersect_scalar(const uint64_t* a, int a_count, const uint64_t* b, int b_count,
+                            int i, int j) {
+    int count = 0;
+    while (i < a_count && j < b_count) {
+        uint64_t x = a[i], y = b[j];
+        count += (x == y);
+        i += (x <= y);
+        j += (y <= x);
+    }
+    return count;
+}
+
+#ifdef KERNEL_X86
+__attribute__((target("avx2")))
+static int intersect_avx2(const uint64_t* a, int a_count, const uint64_t* b, int b_count) {
+    int i = 0, j = 0, count = 0;
+    int a_end = a_count & ~3, b_end = b_count & ~3;
+
+    while (i < a_end && j < b_end) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + j));
+
+        __m256i m = _mm256_cmpeq_epi64(va, vb);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39)));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4e)));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93)));
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+
+        uint64_t a_max = a[i + 3], b_max = b[j + 3];
+        i += (a_max <= b_max) ? 4 : 0;
+        j += (b_max <= a_max) ? 4 : 0;
+    }
+    return count + intersect_scalar(a, a_count, b, b_count, i, j);
+}
+
+__attribute__((target("sse4.1")))
+static int intersect_sse41(const uint64_t* a, int a_count, const uint64_t* b, int b_count) {
+    int i = 0, j = 0, count = 0;
+    int a_end = a_count & ~1, b_end = b_count & ~1;
+
+    while (i < a_end && j < b_end) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+
+        __m128i m = _mm_cmpeq_epi64(va, vb);
+        m = _mm_or_si128(m, _mm_cmpeq_epi64(va, _mm_shuffle_epi32(vb, 0x4e)));
+        count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(m)));
+
+        uint64_t a_max = a[i + 1], b_max = b[j + 1];
+        i += (a_max <= b_max) ? 2 : 0;
+        j += (b_max <= a_max) ? 2 : 0;
+    }
+    return count + intersect_scalar(a, a_count, b, b_count, i, j);
+}
+#endif
+
+#ifdef KERNEL_NEON
+static int intersect_neon(const uint64_t* a, int a_count, const uint64_t* b, int b_count) {
+    int i = 0, j = 0, count = 0;
+    int a_end = a_count & ~1, b_end = b_count & ~1;
+
+    while (i < a_end && j < b_end) {
+        uint64x2_t va = vld1q_u64(a + i);
+        uint64x2_t vb = vld1q_u64(b + j);
+
+        uint64x2_t m = vorrq_u64(vceqq_u64(va, vb), vceqq_u64(va, vextq_u64(vb, vb, 1)));
+        count += (int)(vgetq_lane_u64(m, 0) & 1) + (int)(vgetq_lane_u64(m, 1) & 1);
+
+        uint64_t a_max = a[i + 1], b_max = b[j + 1];
+        i += (a_max <= b_max) ? 2 : 0;
+        j += (b_max <= a_max) ? 2 : 0;
+    }
+    return count + intersect_scalar(a, a_count, b, b_count, i, j);
+}
+#endif
+
+typedef int (*IntersectFn)(const uint64_t*, int, const uint64_t*, int);
+
+static int intersect_scalar_entry(const uint64_t* a, int a_count, const uint64_t* b, int b_count) {
+    return intersect_scalar(a, a_count, b, b_count, 0, 0);
+}
+
+static IntersectFn intersect = intersect_scalar_entry;
+static pthread_once_t intersect_once = PTHREAD_ONCE_INIT;
+
+static void select_intersect(void) {
+#ifdef KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        intersect = intersect_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        intersect = intersect_sse41;
+    }
+#endif
+#ifdef KERNEL_NEON
+    intersect = intersect_neon;
+#endif
+}
+
+int sorted_intersection_size(const uint64_t* a, int a_count, const uint64_t* b, int b_count) {
+    pthread_once(&intersect_once, select_intersect);
+    if (a_count == 0 || b_count == 0) return 0;
+    return intersect(a, a_count, b, b_count);
+}
+
+// Fills every set-based score of `result` from a single intersection of the
+// two fingerprint sets. Exact-mode sets keep the verifying hash probe.
+void compute_similarity(HashSet* set1, HashSet* set2, SimilarityResult* result) {
+    uint64_t start = perf_enabled ? perf_now_ns() : 0;
+    int intersection;
+    if (set1->exact && set2->exact) {
+        intersection = hash_set_intersection_size(set1, set2);
+    } else {
+        const uint64_t* a = hash_set_sorted_fingerprints(set1);
+        const uint64_t* b = hash_set_sorted_fingerprints(set2);
+        intersection = sorted_intersection_size(a, set1->count, b, set2->count);
+    }
+
+    fill_similarity_scores(result, intersection, set1->count, set2->count);
+    if (perf_enabled) {
+        result->similarity_ms = (perf_now_ns() - start) / 1e6;
+        perf_add(PERF_COMPARISONS, 1);
+        perf_stage(PERF_STAGE_SIMILARITY, start);
+    }
+}
+
+// Sparse Weighted Dot Product
+// The same block merge as the intersection, carrying a weight per
+// fingerprint: each rotation of the `b` block that matches a lane of the
+// `a` block contributes the product of the two weights in that lane.
+
+static double dot_scalar(const uint64_t* a, const double* wa, int a_count,
+                         const uint64_t* b, const double* wb, int b_count, int i, int j) {
+    double sum = 0.0;
+    while (i < a_count && j < b_count) {
+        uint64_t x = a[i], y = b[j];
+        if (x == y) sum += wa[i] * wb[j];
+        i += (x <= y);
+        j += (y <= x);
+    }
+    return sum;
+}
+
+#ifdef KERNEL_X86
+__attribute__((target("avx2")))
+static double dot_avx2(const uint64_t* a, const double* wa, int a_count,
+                       const uint64_t* b, const double* wb, int b_count) {
+    int i = 0, j = 0;
+    int a_end = a_count & ~3, b_end = b_count & ~3;
+    __m256d sum = _mm256_setzero_pd();
+
+    while (i < a_end && j < b_end) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + j));
+        __m256d xa = _mm256_loadu_pd(wa + i);
+        __m256d xb = _mm256_loadu_pd(wb + j);
+
+        __m256d m = _mm256_castsi256_pd(_mm256_cmpeq_epi64(va, vb));
+        sum = _mm256_add_pd(sum, _mm256_and_pd(m, _mm256_mul_pd(xa, xb)));
+        m = _mm256_castsi256_pd(_mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39)));
+        sum = _mm256_add_pd(sum, _mm256_and_pd(m, _mm256_mul_pd(xa, _mm256_permute4x64_pd(xb, 0x39))));
+        m = _mm256_castsi256_pd(_mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4e)));
+        sum = _mm256_add_pd(sum, _mm256_and_pd(m, _mm256_mul_pd(xa, _mm256_permute4x64_pd(xb, 0x4e))));
+        m = _mm256_castsi256_pd(_mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93)));
+        sum = _mm256_add_pd(sum, _mm256_and_pd(m, _mm256_mul_pd(xa, _mm256_permute4x64_pd(xb, 0x93))));
+
+        uint64_t a_max = a[i + 3], b_max = b[j + 3];
+        i += (a_max <= b_max) ? 4 : 0;
+        j += (b_max <= a_max) ? 4 : 0;
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_scalar(a, wa, a_count, b, wb, b_count, i, j);
+}
+#endif
+
+typedef double (*DotFn)(const uint64_t*, const double*, int, const uint64_t*, const double*, int);
+
+static double dot_scalar_entry(const uint64_t* a, const double* wa, int a_count,
+                               const uint64_t* b, const double* wb, int b_count) {
+    return dot_scalar(a, wa, a_count, b, wb, b_count, 0, 0);
+}
+
+static DotFn weighted_dot = dot_scalar_entry;
+static pthread_once_t weighted_dot_once = PTHREAD_ONCE_INIT;
+
+static void select_weighted_dot(void) {
+#ifdef KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        weighted_dot = dot_avx2;
+    }
+#endif
+}
+
+// Sum of a_weights[i] * b_weights[j] over every fingerprint a[i] == b[j]
+double sorted_weighted_dot(const uint64_t* a, const double* a_weights, int a_count,
+                           const uint64_t* b, const double* b_weights, int b_count) {
+    pthread_once(&weighted_dot_once, select_weighted_dot);
+    if (a_count == 0 || b_count == 0) return 0.0;
+    return weighted_dot(a, a_weights, a_count, b, b_weights, b_count);
+}
+
+// Threshold Join
+// With a minimum overall score, a pair needs some minimum number of shared
+// fingerprints to qualify. Pairs whose set sizes cannot supply it are
+// skipped without touching the sets (size filter). The rest are intersected
+// chunk by chunk with the vector kernel. Scoring stops once the matches so
+// far plus the fingerprints left on the shorter side fall below the
+// requirement. That bound fails after the first chunk when the leading
+// fingerprints share nothing, which is the prefix filter of AllPairs and
+// PPJoin under the fingerprint order.
+double similarity_min_score = 0.0;
+
+// Smallest intersection whose overall score reaches `min_score`, or
+// min(count1, count2) + 1 when none can. Every score grows with the
+// intersection, so a binary search finds it.
+int required_intersection(double min_score, int count1, int count2) {
+    int lo = 0, hi = (count1 < count2 ? count1 : count2) + 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        SimilarityResult scores;
+        fill_similarity_scores(&scores, mid, count1, count2);
+        if (scores.overall >= min_score) hi = mid; else lo = mid + 1;
+    }
+    return lo;
+}
+
+// Upper bound of b[from, b_count) elements not greater than `limit`
+static int upper_bound_u64(const uint64_t* b, int from, int b_count, uint64_t limit) {
+    int lo = from, hi = b_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (b[mid] <= limit) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Returns |a ∩ b|, or -1 as soon as it provably falls short of `required`
+int bounded_intersection_size(const uint64_t* a, int a_count, const uint64_t* b, int b_count,
+                              int required) {
+    pthread_once(&intersect_once, select_intersect);
+    if (a_count > b_count) {
+        const uint64_t* t = a; a = b; b = t;
+        int c = a_count; a_count = b_count; b_count = c;
+    }
+    if (a_count < required) return -1;
+
+    // Chunks as long as the prefix that must hold a match, within limits
+    int chunk = a_count - required + 1;
+    if (chunk < INTERSECT_MIN_CHUNK) chunk = INTERSECT_MIN_CHUNK;
+    if (chunk > INTERSECT_MAX_CHUNK) chunk = INTERSECT_MAX_CHUNK;
+
+    int i = 0, j = 0, count = 0;
+    while (i < a_count && j < b_count) {
+        int a_left = a_count - i, b_left = b_count - j;
+        if (count + (a_left < b_left ? a_left : b_left) < required) return -1;
+        int i_end = i + chunk < a_count ? i + chunk : a_count;
+        int j_end = upper_bound_u64(b, j, b_count, a[i_end - 1]);
+        if (j_end > j) count += intersect(a + i, i_end - i, b + j, j_end - j);
+        i = i_end;
+        j = j_end;
+    }
+    return count >= required ? count : -1;
+}
+
+// compute_similarity behind a `min_score` threshold (overall). Returns 0,
+// leaving `result` untouched, for a pair that cannot reach it. Exact sets
+// are filtered on their fingerprints, which can only overcount shared
+// k-grams, then scored exactly.
+int compute_similarity_min(HashSet* set1, HashSet* set2, double min_score,
+                           SimilarityResult* result) {
+    if (min_score <= 0.0) {
+        compute_similarity(set1, set2, result);
+        return 1;
+    }
+    int required = required_intersection(min_score, set1->count, set2->count);
+    if (required > (set1->count < set2->count ? set1->count : set2->count)) {
+        PERF_COUNT(PERF_PAIRS_SIZE_PRUNED, 1);
+        return 0;
+    }
+
+    uint64_t start = perf_enabled ? perf_now_ns() : 0;
+    const uint64_t* a = hash_set_sorted_fingerprints(set1);
+    const uint64_t* b = hash_set_sorted_fingerprints(set2);
+    int intersection = bounded_intersection_size(a, set1->count, b, set2->count, required);
+    if (intersection < 0) {
+        if (perf_enabled) {
+            perf_add(PERF_PAIRS_BOUND_PRUNED, 1);
+            perf_stage(PERF_STAGE_SIMILARITY, start);
+        }
+        return 0;
+    }
+    if (set1->exact && set2->exact) {
+        compute_similarity(set1, set2, result);
+        return result->overall >= min_score;
+    }
+
+    fill_similarity_scores(result, intersection, set1->count, set2->count);
+    if (perf_enabled) {
+        result->similarity_ms = (perf_now_ns() - start) / 1e6;
+        perf_add(PERF_COMPARISONS, 1);
+        perf_stage(PERF_STAGE_SIMILARITY, start);
+    }
+    return result->overall >= min_score;
+}
+
+int compute_similarity_above(HashSet* set1, HashSet* set2, SimilarityResult* result) {
+    return compute_similarity_min(set1, set2, similarity_min_score, result);
+}
+
+// Scores every k both documents were fingerprinted at (see
+// set_kgram_range); a no-op for single-k documents
+void compute_k_scores(Document* target, Document* reference, SimilarityResult* result) {
+    result->k_scores = NULL;
+    result->k_score_count = 0;
+    int k_min, k_max;
+    if (!get_kgram_range(&k_min, &k_max)) return;
+
+    result->k_scores = (KgramScores*)malloc((k_max - k_min + 1) * sizeof(KgramScores));
+    for (int k = k_min; k <= k_max; k++) {
+        HashSet* set1 = target->kgrams_by_k[k];
+        HashSet* set2 = reference->kgrams_by_k[k];
+        if (set1 == NULL || set2 == NULL) continue;
+
+        SimilarityResult scores;
+        compute_similarity(set1, set2, &scores);
+        KgramScores* entry = &result->k_scores[result->k_score_count++];
+        entry->k = k;
+        entry->jaccard = scores.jaccard;
+        entry->cosine = scores.cosine;
+        entry->containment = scores.containment;
+        entry->dice = scores.dice;
+        entry->overall = scores.overall;
+        entry->matching_kgrams = scores.matching_kgrams;
+    }
+}
+
+// Derives every set-based score from the intersection and the two set
+// sizes; count1 is the target side for containment.
+void fill_similarity_scores(SimilarityResult* result, int intersection, int count1, int count2) {
+    int union_size = count1 + count2 - intersection;
+    double magnitude = sqrt(count1) * sqrt(count2);
+
+    result->matching_kgrams = intersection;
+    result->jaccard = union_size > 0 && count1 > 0 && count2 > 0
+                          ? (double)intersection / union_size : 0.0;
+    result->cosine = magnitude > 0 ? intersection / magnitude : 0.0;
+    result->containment = count1 > 0 ? (double)intersection / count1 : 0.0;
+    result->dice = count1 > 0 && count2 > 0
+                       ? (2.0 * intersection) / (count1 + count2) : 0.0;
+    result->overall = (result->jaccard + result->cosine +
+                       result->containment + result->dice) / 4.0;
+}
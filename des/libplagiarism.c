@@ -0,0 +1,355 @@
+#define _POSIX_C_SOURCE 200809L
+#include "libplagiarism.h"
+#include "plagiarism.h"
+
+#include <pthread.h>
+
+#define PLAG_CORPUS_INITIAL 16
+
+struct PlagCorpus {
+    int k;
+    int window;
+    PlagAllocator allocator;   // the caller's, or malloc behind it
+    ArenaAllocator blocks;     // the caller's, for document arenas
+    int custom;                // whether the caller supplied an allocator
+    pthread_rwlock_t lock;     // snapshots read, adds write
+    TokenDictionary* dictionary;  // token IDs of this corpus and its documents
+    Document** docs;
+    int count;
+    int capacity;
+};
+
+struct PlagDocument {
+    PlagCorpus* corpus;
+    Document* doc;
+};
+
+struct PlagSession {
+    PlagCorpus* corpus;
+    PlagSessionOptions options;
+    PlagPassage* passages;     // handed to the callback, reused between matches
+    int passage_capacity;
+    Document** references;     // the corpus as of the running check
+    int reference_capacity;
+};
+
+// Allocation
+static void* default_alloc(void* context, size_t size) {
+    (void)context;
+    return malloc(size);
+}
+
+static void default_free(void* context, void* ptr, size_t size) {
+    (void)context;
+    (void)size;
+    free(ptr);
+}
+
+static void* corpus_alloc(PlagCorpus* corpus, size_t size) {
+    return corpus->allocator.alloc(corpus->allocator.context, size);
+}
+
+static void corpus_free(PlagCorpus* corpus, void* ptr, size_t size) {
+    if (ptr != NULL) corpus->allocator.free(corpus->allocator.context, ptr, size);
+}
+
+// Tokenizes and fingerprints `text` into a document whose storage comes
+// from the corpus allocator
+static Document* fingerprint_text(PlagCorpus* corpus, const char* name, const char* text,
+                                  size_t length) {
+    Document* doc = create_document_with(name, corpus->custom ? &corpus->blocks : NULL);
+    if (doc == NULL) return NULL;
+    doc->dictionary = corpus->dictionary;
+    preprocess_document_buffer(doc, text, length);
+    generate_winnowed_kgrams(doc, corpus->k, corpus->window);
+    return doc;
+}
+
+static Document* fingerprint_file(PlagCorpus* corpus, const char* path) {
+    MappedFile file;
+    if (map_text_file(path, &file) != 0) return NULL;
+    Document* doc = fingerprint_text(corpus, path, file.data, file.size);
+    unmap_text_file(&file);
+    return doc;
+}
+
+const char* plag_status_string(PlagStatus status) {
+    switch (status) {
+    case PLAG_OK: return "ok";
+    case PLAG_ERROR_ARGUMENT: return "invalid argument";
+    case PLAG_ERROR_MEMORY: return "out of memory";
+    case PLAG_ERROR_IO: return "cannot read file";
+    case PLAG_STOPPED: return "stopped by callback";
+    }
+    return "unknown status";
+}
+
+// Corpus
+PlagStatus plag_corpus_create(const PlagCorpusOptions* options, PlagCorpus** corpus) {
+    if (corpus == NULL) return PLAG_ERROR_ARGUMENT;
+    *corpus = NULL;
+    if (options == NULL || options->k < 2 || options->k > KGRAM_MAX_LENGTH ||
+        options->window < 1) {
+        return PLAG_ERROR_ARGUMENT;
+    }
+    const PlagAllocator* allocator = options->allocator;
+    if (allocator != NULL && (allocator->alloc == NULL || allocator->free == NULL)) {
+        return PLAG_ERROR_ARGUMENT;
+    }
+
+    PlagCorpus* created = allocator != NULL
+                              ? (PlagCorpus*)allocator->alloc(allocator->context, sizeof(PlagCorpus))
+                              : (PlagCorpus*)malloc(sizeof(PlagCorpus));
+    if (created == NULL) return PLAG_ERROR_MEMORY;
+    memset(created, 0, sizeof(*created));
+    created->k = options->k;
+    created->window = options->window;
+    created->custom = allocator != NULL;
+    if (allocator != NULL) {
+        created->allocator = *allocator;
+    } else {
+        created->allocator.alloc = default_alloc;
+        created->allocator.free = default_free;
+    }
+    created->blocks.alloc = created->allocator.alloc;
+    created->blocks.free = created->allocator.free;
+    created->blocks.context = created->allocator.context;
+    created->dictionary = create_token_dictionary();
+    if (created->dictionary == NULL) {
+        created->allocator.free(created->allocator.context, created, sizeof(PlagCorpus));
+        return PLAG_ERROR_MEMORY;
+    }
+    pthread_rwlock_init(&created->lock, NULL);
+    *corpus = created;
+    return PLAG_OK;
+}
+
+static PlagStatus corpus_append(PlagCorpus* corpus, Document* doc, int* id) {
+    pthread_rwlock_wrlock(&corpus->lock);
+    if (corpus->count == corpus->capacity) {
+        int capacity = corpus->capacity > 0 ? corpus->capacity * 2 : PLAG_CORPUS_INITIAL;
+        Document** docs = (Document**)corpus_alloc(corpus, capacity * sizeof(Document*));
+        if (docs == NULL) {
+            pthread_rwlock_unlock(&corpus->lock);
+            return PLAG_ERROR_MEMORY;
+        }
+        if (corpus->count > 0) memcpy(docs, corpus->docs, corpus->count * sizeof(Document*));
+        corpus_free(corpus, corpus->docs, corpus->capacity * sizeof(Document*));
+        corpus->docs = docs;
+        corpus->capacity = capacity;
+    }
+    if (id != NULL) *id = corpus->count;
+    corpus->docs[corpus->count++] = doc;
+    pthread_rwlock_unlock(&corpus->lock);
+    return PLAG_OK;
+}
+
+// Fingerprinting happens outside the lock, so adds do not hold up checks
+PlagStatus plag_corpus_add_text(PlagCorpus* corpus, const char* name, const char* text,
+                                size_t length, int* id) {
+    if (corpus == NULL || name == NULL || (text == NULL && length > 0)) return PLAG_ERROR_ARGUMENT;
+    if (length > MAX_DOCUMENT_BYTES) return PLAG_ERROR_ARGUMENT;
+    Document* doc = fingerprint_text(corpus, name, text != NULL ? text : "", length);
+    if (doc == NULL) return PLAG_ERROR_MEMORY;
+    PlagStatus status = corpus_append(corpus, doc, id);
+    if (status != PLAG_OK) free_document(doc);
+    return status;
+}
+
+PlagStatus plag_corpus_add_file(PlagCorpus* corpus, const char* path, int* id) {
+    if (corpus == NULL || path == NULL) return PLAG_ERROR_ARGUMENT;
+    Document* doc = fingerprint_file(corpus, path);
+    if (doc == NULL) return PLAG_ERROR_IO;
+    PlagStatus status = corpus_append(corpus, doc, id);
+    if (status != PLAG_OK) free_document(doc);
+    return status;
+}
+
+int plag_corpus_size(PlagCorpus* corpus) {
+    if (corpus == NULL) return 0;
+    pthread_rwlock_rdlock(&corpus->lock);
+    int count = corpus->count;
+    pthread_rwlock_unlock(&corpus->lock);
+    return count;
+}
+
+// Every document and session of the corpus must be gone first
+void plag_corpus_destroy(PlagCorpus* corpus) {
+    if (corpus == NULL) return;
+    for (int i = 0; i < corpus->count; i++) {
+        free_document(corpus->docs[i]);
+    }
+    corpus_free(corpus, corpus->docs, corpus->capacity * sizeof(Document*));
+    free_token_dictionary(corpus->dictionary);
+    pthread_rwlock_destroy(&corpus->lock);
+    PlagAllocator allocator = corpus->allocator;
+    allocator.free(allocator.context, corpus, sizeof(PlagCorpus));
+}
+
+// Documents
+static PlagStatus wrap_document(PlagCorpus* corpus, Document* doc, PlagDocument** document) {
+    PlagDocument* wrapped = (PlagDocument*)corpus_alloc(corpus, sizeof(PlagDocument));
+    if (wrapped == NULL) {
+        free_document(doc);
+        return PLAG_ERROR_MEMORY;
+    }
+    wrapped->corpus = corpus;
+    wrapped->doc = doc;
+    *document = wrapped;
+    return PLAG_OK;
+}
+
+PlagStatus plag_document_create(PlagCorpus* corpus, const char* name, const char* text,
+                                size_t length, PlagDocument** document) {
+    if (document == NULL) return PLAG_ERROR_ARGUMENT;
+    *document = NULL;
+    if (corpus == NULL || name == NULL || (text == NULL && length > 0)) return PLAG_ERROR_ARGUMENT;
+    if (length > MAX_DOCUMENT_BYTES) return PLAG_ERROR_ARGUMENT;
+    Document* doc = fingerprint_text(corpus, name, text != NULL ? text : "", length);
+    if (doc == NULL) return PLAG_ERROR_MEMORY;
+    return wrap_document(corpus, doc, document);
+}
+
+PlagStatus plag_document_load(PlagCorpus* corpus, const char* path, PlagDocument** document) {
+    if (document == NULL) return PLAG_ERROR_ARGUMENT;
+    *document = NULL;
+    if (corpus == NULL || path == NULL) return PLAG_ERROR_ARGUMENT;
+    Document* doc = fingerprint_file(corpus, path);
+    if (doc == NULL) return PLAG_ERROR_IO;
+    return wrap_document(corpus, doc, document);
+}
+
+int plag_document_tokens(const PlagDocument* document) {
+    return document != NULL ? document->doc->token_count : 0;
+}
+
+void plag_document_destroy(PlagDocument* document) {
+    if (document == NULL) return;
+    PlagCorpus* corpus = document->corpus;
+    free_document(document->doc);
+    corpus_free(corpus, document, sizeof(PlagDocument));
+}
+
+// Sessions
+PlagStatus plag_session_create(PlagCorpus* corpus, const PlagSessionOptions* options,
+                               PlagSession** session) {
+    if (session == NULL) return PLAG_ERROR_ARGUMENT;
+    *session = NULL;
+    if (corpus == NULL) return PLAG_ERROR_ARGUMENT;
+    PlagSession* created = (PlagSession*)corpus_alloc(corpus, sizeof(PlagSession));
+    if (created == NULL) return PLAG_ERROR_MEMORY;
+    memset(created, 0, sizeof(*created));
+    created->corpus = corpus;
+    if (options != NULL) {
+        created->options = *options;
+    } else {
+        created->options.passages = 1;
+    }
+    if (created->options.min_passage_tokens < 1) {
+        created->options.min_passage_tokens = COMMON_PASSAGE_MIN_TOKENS;
+    }
+    *session = created;
+    return PLAG_OK;
+}
+
+// Converts the engine's passages into session->passages
+static int collect_passages(PlagSession* session, Document* target, Document* reference) {
+    if (ensure_document_tokens(target) != 0 || ensure_document_tokens(reference) != 0) return 0;
+    CommonPassage* found = NULL;
+    int count = find_common_passages(target, reference, session->options.min_passage_tokens, &found);
+    if (count > session->passage_capacity) {
+        PlagCorpus* corpus = session->corpus;
+        PlagPassage* grown = (PlagPassage*)corpus_alloc(corpus, count * sizeof(PlagPassage));
+        if (grown == NULL) {
+            free(found);
+            return -1;
+        }
+        corpus_free(corpus, session->passages, session->passage_capacity * sizeof(PlagPassage));
+        session->passages = grown;
+        session->passage_capacity = count;
+    }
+    for (int i = 0; i < count; i++) {
+        session->passages[i].tokens = found[i].length;
+        session->passages[i].target_start = found[i].target_char_start;
+        session->passages[i].target_end = found[i].target_char_end;
+        session->passages[i].reference_start = found[i].ref_char_start;
+        session->passages[i].reference_end = found[i].ref_char_end;
+    }
+    free(found);
+    return count;
+}
+
+// Copies the corpus's document list into session->references under the
+// read lock. Documents stay put until the corpus is destroyed, so the
+// check can then run, and call back, without holding the lock. Returns
+// the number of references, or -1 when out of memory.
+static int snapshot_references(PlagSession* session) {
+    PlagCorpus* corpus = session->corpus;
+    pthread_rwlock_rdlock(&corpus->lock);
+    int count = corpus->count;
+    if (count > session->reference_capacity) {
+        Document** grown = (Document**)corpus_alloc(corpus, count * sizeof(Document*));
+        if (grown == NULL) {
+            pthread_rwlock_unlock(&corpus->lock);
+            return -1;
+        }
+        corpus_free(corpus, session->references, session->reference_capacity * sizeof(Document*));
+        session->references = grown;
+        session->reference_capacity = count;
+    }
+    if (count > 0) memcpy(session->references, corpus->docs, count * sizeof(Document*));
+    pthread_rwlock_unlock(&corpus->lock);
+    return count;
+}
+
+// Scores `document` against the corpus as it stands when the check starts,
+// streaming each reference that reaches min_score to `callback`. No lock
+// is held during the callback, so it may add to the corpus; those
+// additions are seen by later checks.
+PlagStatus plag_session_check(PlagSession* session, PlagDocument* document,
+                              PlagMatchCallback callback, void* user) {
+    if (session == NULL || document == NULL || callback == NULL ||
+        document->corpus != session->corpus) {
+        return PLAG_ERROR_ARGUMENT;
+    }
+    Document* target = document->doc;
+    int reference_count = snapshot_references(session);
+    if (reference_count < 0) return PLAG_ERROR_MEMORY;
+    for (int i = 0; i < reference_count; i++) {
+        Document* reference = session->references[i];
+        SimilarityResult result;
+        memset(&result, 0, sizeof(result));
+        if (!compute_similarity_min(target->kgrams, reference->kgrams, session->options.min_score,
+                                    &result)) {
+            continue;
+        }
+
+        PlagMatch match;
+        match.reference = i;
+        match.name = reference->filename;
+        match.jaccard = result.jaccard;
+        match.cosine = result.cosine;
+        match.containment = result.containment;
+        match.dice = result.dice;
+        match.overall = result.overall;
+        match.matching_kgrams = result.matching_kgrams;
+        match.passages = NULL;
+        match.passage_count = 0;
+        if (session->options.passages) {
+            int count = collect_passages(session, target, reference);
+            if (count < 0) return PLAG_ERROR_MEMORY;
+            match.passages = session->passages;
+            match.passage_count = count;
+        }
+        if (callback(user, &match) != 0) return PLAG_STOPPED;
+    }
+    return PLAG_OK;
+}
+
+void plag_session_destroy(PlagSession* session) {
+    if (session == NULL) return;
+    PlagCorpus* corpus = session->corpus;
+    corpus_free(corpus, session->passages, session->passage_capacity * sizeof(PlagPassage));
+    corpus_free(corpus, session->references, session->reference_capacity * sizeof(Document*));
+    corpus_free(corpus, session, sizeof(PlagSession));
+}
@@ -0,0 +1,129 @@
+#ifndef LIBPLAGIARISM_H
+#define LIBPLAGIARISM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define PLAG_API __attribute__((visibility("default")))
+#else
+#define PLAG_API
+#endif
+
+// libplagiarism
+// The checker's engine as an embeddable library (libplagiarism.so or
+// libplagiarism.a). Three opaque handles:
+//
+//   PlagCorpus    reference documents fingerprinted with one k and window
+//   PlagDocument  a fingerprinted target, checked against a corpus
+//   PlagSession   per-check settings and scratch space
+//
+// Thread safety: a corpus may be checked from any number of threads at
+// once, and documents added to it meanwhile, including from a match
+// callback; a check sees the corpus as it was when the check started. A
+// document may be checked by several sessions at once. A session belongs
+// to one thread at a time.
+//
+// State: each corpus has its own token dictionary, so its memory goes
+// with the corpus. Some engine settings are still process-wide globals:
+// normalization (stopwords, stemming), exact k-gram mode, the k range and
+// occurrence counting. The library never changes them and relies on their
+// defaults, so a program that also drives the engine directly must leave
+// them alone while corpora are in use.
+//
+// Memory: with an allocator, the corpus, its documents and their
+// fingerprint storage all come from it; the engine's short-lived scratch
+// buffers still use malloc. The allocator must outlive the corpus and be
+// safe to call from the threads that use it.
+
+typedef struct PlagCorpus PlagCorpus;
+typedef struct PlagDocument PlagDocument;
+typedef struct PlagSession PlagSession;
+
+typedef enum PlagStatus {
+    PLAG_OK = 0,
+    PLAG_ERROR_ARGUMENT,       // NULL handle, bad k or window, text over 2 GB
+    PLAG_ERROR_MEMORY,
+    PLAG_ERROR_IO,             // a file could not be read
+    PLAG_STOPPED               // a callback asked to stop
+} PlagStatus;
+
+typedef struct PlagAllocator {
+    void* (*alloc)(void* context, size_t size);
+    void (*free)(void* context, void* ptr, size_t size);
+    void* context;
+} PlagAllocator;
+
+typedef struct PlagCorpusOptions {
+    int k;                     // k-gram length, 2..10
+    int window;                // winnowing window, 1 keeps every k-gram
+    const PlagAllocator* allocator;  // NULL uses malloc
+} PlagCorpusOptions;
+
+typedef struct PlagSessionOptions {
+    double min_score;          // references under this overall score are skipped
+    int passages;              // report common passages
+    int min_passage_tokens;    // 0 uses the engine default
+} PlagSessionOptions;
+
+// A maximal run of tokens shared by target and reference; offsets are
+// bytes into the original texts
+typedef struct PlagPassage {
+    int tokens;
+    size_t target_start;
+    size_t target_end;
+    size_t reference_start;
+    size_t reference_end;
+} PlagPassage;
+
+// One reference's scores. Valid only for the duration of the callback.
+typedef struct PlagMatch {
+    int reference;             // corpus ID
+    const char* name;
+    double jaccard;
+    double cosine;
+    double containment;        // share of the target found in the reference
+    double dice;
+    double overall;
+    int matching_kgrams;
+    const PlagPassage* passages;  // longest first
+    int passage_count;
+} PlagMatch;
+
+// Receives each reference that reaches the session's min_score, in corpus
+// order. Returning nonzero stops the check with PLAG_STOPPED.
+typedef int (*PlagMatchCallback)(void* user, const PlagMatch* match);
+
+PLAG_API const char* plag_status_string(PlagStatus status);
+
+PLAG_API PlagStatus plag_corpus_create(const PlagCorpusOptions* options, PlagCorpus** corpus);
+PLAG_API PlagStatus plag_corpus_add_text(PlagCorpus* corpus, const char* name, const char* text,
+                                         size_t length, int* id);
+PLAG_API PlagStatus plag_corpus_add_file(PlagCorpus* corpus, const char* path, int* id);
+PLAG_API int plag_corpus_size(PlagCorpus* corpus);
+PLAG_API void plag_corpus_destroy(PlagCorpus* corpus);
+
+// Documents are fingerprinted with their corpus's k and window and can
+// only be checked against that corpus; they must not outlive it
+PLAG_API PlagStatus plag_document_create(PlagCorpus* corpus, const char* name, const char* text,
+                                         size_t length, PlagDocument** document);
+PLAG_API PlagStatus plag_document_load(PlagCorpus* corpus, const char* path,
+                                       PlagDocument** document);
+PLAG_API int plag_document_tokens(const PlagDocument* document);
+PLAG_API void plag_document_destroy(PlagDocument* document);
+
+// NULL options use min_score 0 with passages on
+PLAG_API PlagStatus plag_session_create(PlagCorpus* corpus, const PlagSessionOptions* options,
+                                        PlagSession** session);
+PLAG_API PlagStatus plag_session_check(PlagSession* session, PlagDocument* document,
+                                       PlagMatchCallback callback, void* user);
+PLAG_API void plag_session_destroy(PlagSession* session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
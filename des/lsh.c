@@ -0,0 +1,144 @@
+#include "lsh.h"
+
+// Picks the band layout whose S-curve midpoint (1/b)^(1/r) is the largest
+// one not above `threshold`, so pairs at the threshold are likely kept.
+void lsh_choose_bands(double threshold, int* bands, int* rows) {
+    *bands = MINHASH_SIZE;
+    *rows = 1;
+    double best = 0.0;
+
+    for (int r = 1; r <= MINHASH_SIZE; r++) {
+        int b = MINHASH_SIZE / r;
+        double midpoint = pow(1.0 / b, 1.0 / r);
+        if (midpoint <= threshold && midpoint > best) {
+            best = midpoint;
+            *bands = b;
+            *rows = r;
+        }
+    }
+}
+
+LshIndex* create_lsh_index(int bands, int rows) {
+    LshIndex* index = (LshIndex*)malloc(sizeof(LshIndex));
+    if (bands * rows > MINHASH_SIZE) bands = MINHASH_SIZE / rows;
+    index->bands = bands;
+    index->rows = rows;
+    index->band_tables = (LshBand*)malloc(bands * sizeof(LshBand));
+    for (int b = 0; b < bands; b++) {
+        index->band_tables[b].size = 64;
+        index->band_tables[b].count = 0;
+        index->band_tables[b].keys = (uint64_t*)calloc(64, sizeof(uint64_t));
+        index->band_tables[b].heads = (int*)malloc(64 * sizeof(int));
+    }
+    index->entries = NULL;
+    index->entry_count = 0;
+    index->entry_capacity = 0;
+    index->doc_count = 0;
+    return index;
+}
+
+static uint64_t band_hash(const LshIndex* index, const Document* doc, int band) {
+    const uint64_t* slots = doc->minhash + band * index->rows;
+    uint64_t hash = (uint64_t)band + 1;
+    for (int i = 0; i < index->rows; i++) {
+        hash = fingerprint_mix(hash ^ slots[i]);
+    }
+    return hash;
+}
+
+static int band_find(const LshBand* table, uint64_t key) {
+    unsigned int mask = (unsigned int)table->size - 1;
+    unsigned int slot = (unsigned int)key & mask;
+    while (table->keys[slot] != 0 && table->keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    return (int)slot;
+}
+
+static void band_grow(LshBand* table) {
+    uint64_t* old_keys = table->keys;
+    int* old_heads = table->heads;
+    int old_size = table->size;
+
+    table->size *= 2;
+    table->keys = (uint64_t*)calloc(table->size, sizeof(uint64_t));
+    table->heads = (int*)malloc(table->size * sizeof(int));
+    for (int i = 0; i < old_size; i++) {
+        if (old_keys[i] == 0) continue;
+        int slot = band_find(table, old_keys[i]);
+        table->keys[slot] = old_keys[i];
+        table->heads[slot] = old_heads[i];
+    }
+    free(old_keys);
+    free(old_heads);
+}
+
+void lsh_add(LshIndex* index, const Document* doc, int doc_id) {
+    // Documents without k-grams would all share one signature
+    if (doc->kgrams->count == 0) return;
+
+    for (int b = 0; b < index->bands; b++) {
+        LshBand* table = &index->band_tables[b];
+        if ((table->count + 1) > table->size * HASH_SET_MAX_LOAD) {
+            band_grow(table);
+        }
+
+        uint64_t key = band_hash(index, doc, b);
+        int slot = band_find(table, key);
+        if (table->keys[slot] == 0) {
+            table->keys[slot] = key;
+            table->heads[slot] = -1;
+            table->count++;
+        }
+
+        if (index->entry_count == index->entry_capacity) {
+            index->entry_capacity = index->entry_capacity ? index->entry_capacity * 2 : 256;
+            index->entries = (LshBucketEntry*)realloc(index->entries,
+                                                      index->entry_capacity * sizeof(LshBucketEntry));
+        }
+        index->entries[index->entry_count].doc = doc_id;
+        index->entries[index->entry_count].next = table->heads[slot];
+        table->heads[slot] = index->entry_count++;
+    }
+    if (doc_id >= index->doc_count) index->doc_count = doc_id + 1;
+}
+
+static int compare_ints(const void* a, const void* b) {
+    return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b);
+}
+
+// Writes the IDs of documents sharing at least one band with `doc` into
+// `candidates` (room for doc_count entries) in ascending order and returns
+// how many there are.
+int lsh_query(LshIndex* index, const Document* doc, int* candidates) {
+    if (doc->kgrams->count == 0 || index->doc_count == 0) return 0;
+
+    unsigned char* seen = (unsigned char*)calloc(index->doc_count, 1);
+    int count = 0;
+    for (int b = 0; b < index->bands; b++) {
+        const LshBand* table = &index->band_tables[b];
+        int slot = band_find(table, band_hash(index, doc, b));
+        if (table->keys[slot] == 0) continue;
+        for (int e = table->heads[slot]; e >= 0; e = index->entries[e].next) {
+            int candidate = index->entries[e].doc;
+            if (!seen[candidate]) {
+                seen[candidate] = 1;
+                candidates[count++] = candidate;
+            }
+        }
+    }
+    free(seen);
+
+    qsort(candidates, count, sizeof(int), compare_ints);
+    return count;
+}
+
+void free_lsh_index(LshIndex* index) {
+    for (int b = 0; b < index->bands; b++) {
+        free(index->band_tables[b].keys);
+        free(index->band_tables[b].heads);
+    }
+    free(index->band_tables);
+    free(index->entries);
+    free(index);
+}
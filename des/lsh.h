@@ -0,0 +1,38 @@
+#ifndef LSH_H
+#define LSH_H
+
+#include "plagiarism.h"
+
+// LSH Band Index
+// Splits each MinHash signature into `bands` bands of `rows` slots. Two
+// documents become candidates when any band matches exactly, which for
+// Jaccard similarity s happens with probability 1 - (1 - s^rows)^bands.
+typedef struct LshBucketEntry {
+    int doc;
+    int next;                  // next entry in the same bucket, -1 ends
+} LshBucketEntry;
+
+typedef struct LshBand {
+    uint64_t* keys;            // band hash per bucket, 0 = empty
+    int* heads;                // first entry of each bucket
+    int size;                  // bucket capacity, power of two
+    int count;
+} LshBand;
+
+typedef struct LshIndex {
+    int bands;
+    int rows;
+    LshBand* band_tables;
+    LshBucketEntry* entries;
+    int entry_count;
+    int entry_capacity;
+    int doc_count;             // one past the highest inserted doc
+} LshIndex;
+
+void lsh_choose_bands(double threshold, int* bands, int* rows);
+LshIndex* create_lsh_index(int bands, int rows);
+void lsh_add(LshIndex* index, const Document* doc, int doc_id);
+int lsh_query(LshIndex* index, const Document* doc, int* candidates);
+void free_lsh_index(LshIndex* index);
+
+#endif
@@ -1,68 +1,282 @@
 #include "plagiarism.h"
+#include "allpairs.h"
+#include "batch.h"
+#include "cache.h"
+#include "index.h"
+#include "lsh.h"
+#include "normalize.h"
+#include "perf.h"
+#include "pipeline.h"
+#include "server.h"
+#include "tfidf.h"
+#include "threadpool.h"
 
-void write_json_results(SimilarityResult* results, int count, Document* target, int k, const char* output_file) {
-    FILE* fp = fopen(output_file, "w");
-    if (fp == NULL) {
-        printf("Error: Cannot create output file\n");
-        return;
-    }
+// Parallel Stages
+typedef struct ScoreJob {
+    Document* target;
+    Document** references;
+    const unsigned char* selected;
+    unsigned char* passed;     // reached --min-score (always, without it)
+    SimilarityResult* results;
+} ScoreJob;
+
+static void score_reference_task(void* arg, int i) {
+    ScoreJob* job = (ScoreJob*)arg;
+    if (job->references[i] == NULL || !job->selected[i]) return;
     
-    fprintf(fp, "{\n");
-    fprintf(fp, "  \"target_stats\": {\n");
-    fprintf(fp, "    \"filename\": \"%s\",\n", target->filename);
-    fprintf(fp, "    \"tokens\": %d,\n", target->token_count);
-    fprintf(fp, "    \"kgrams\": %d,\n", target->kgram_count);
-    fprintf(fp, "    \"k_value\": %d\n", k);
-    fprintf(fp, "  },\n");
-    fprintf(fp, "  \"comparisons\": [\n");
+    SimilarityResult* result = &job->results[i];
+    strcpy(result->filename, job->references[i]->filename);
+    job->passed[i] = (unsigned char)compute_similarity_above(job->target->kgrams,
+                                                             document_kgrams(job->references[i]),
+                                                             result);
+    if (!job->passed[i]) return;
+    result->tfidf_cosine = tfidf_cosine(job->target, job->references[i]);
+    compute_k_scores(job->target, job->references[i], result);
+    find_common_phrases(job->target, job->references[i], result);
+    compute_similarity_heatmap(job->target, job->references[i], result);
+    find_fuzzy_passages(job->target, job->references[i], result);
+}
+
+// Receives the references from the ingestion pipeline and, when nothing
+// needs the whole reference set first (--lsh, --tfidf), scores each one
+// as it arrives
+typedef struct ReferenceSink {
+    Document** references;
+    ScoreJob* score;           // NULL leaves scoring to the analysis step
+} ReferenceSink;
+
+static void reference_sink(void* arg, int i, Document* doc) {
+    ReferenceSink* sink = (ReferenceSink*)arg;
+    sink->references[i] = doc;
+    if (sink->score != NULL) score_reference_task(sink->score, i);
+}
+
+// Sizes the per-reference arrays of a single-target run once the number
+// of references is known: every reference starts out selected and unscored
+static void allocate_reference_slots(int count, Document*** references,
+                                     unsigned char** candidate, unsigned char** passed,
+                                     SimilarityResult** scored, SimilarityResult** results) {
+    size_t n = (size_t)(count > 0 ? count : 1);
+    *references = (Document**)calloc(n, sizeof(Document*));
+    *candidate = (unsigned char*)malloc(n);
+    memset(*candidate, 1, n);
+    *passed = (unsigned char*)calloc(n, 1);
+    *scored = (SimilarityResult*)calloc(n, sizeof(SimilarityResult));
+    *results = (SimilarityResult*)calloc(n, sizeof(SimilarityResult));
+}
+
+// index <index_dir> <k_value> <ref_file_or_dir> ...
+static int run_index_build(int argc, char* argv[], int window) {
+    int k = atoi(argv[3]);
+    if (k < 2 || k > 10) k = 3;
     
-    for (int i = 0; i < count; i++) {
-        fprintf(fp, "    {\n");
-        fprintf(fp, "      \"filename\": \"%s\",\n", results[i].filename);
-        fprintf(fp, "      \"jaccard\": %.4f,\n", results[i].jaccard);
-        fprintf(fp, "      \"cosine\": %.4f,\n", results[i].cosine);
-        fprintf(fp, "      \"containment\": %.4f,\n", results[i].containment);
-        fprintf(fp, "      \"dice\": %.4f,\n", results[i].dice);
-        fprintf(fp, "      \"overall\": %.4f,\n", results[i].overall);
-        fprintf(fp, "      \"matching_kgrams\": %d,\n", results[i].matching_kgrams);
-        fprintf(fp, "      \"common_phrases\": [\n");
-        
-        for (int j = 0; j < results[i].phrase_count; j++) {
-            // Escape quotes in phrases for JSON
-            char escaped_phrase[MAX_TOKEN_LENGTH * 10];
-            strcpy(escaped_phrase, results[i].common_phrases[j]);
-            // Simple escape - replace " with \"
-            for (char* p = escaped_phrase; *p; p++) {
-                if (*p == '"') {
-                    memmove(p + 1, p, strlen(p) + 1);
-                    *p = '\\';
-                    p++;
-                }
-            }
-            
-            fprintf(fp, "        \"%s\"%s\n", escaped_phrase, 
-                   j < results[i].phrase_count - 1 ? "," : "");
-        }
-        fprintf(fp, "      ]\n");
-        fprintf(fp, "    }%s\n", i < count - 1 ? "," : "");
+    int added = index_add_documents(argv[2], k, window, (const char**)(argv + 4), argc - 4);
+    if (added < 0) return 1;
+    printf("Indexed %d documents into %s\n", added, argv[2]);
+    return 0;
+}
+
+// query <index_dir> <target_file> [output_file]
+static int run_index_query(int argc, char* argv[], int top) {
+    Index* index = index_open(argv[2]);
+    if (index == NULL) {
+        printf("Error: Cannot open index %s\n", argv[2]);
+        return 1;
+    }
+    
+    Document* target = load_document(argv[3], index->k, index->window);
+    if (target == NULL) {
+        printf("Error: Cannot open target file %s\n", argv[3]);
+        index_close(index);
+        return 1;
     }
     
-    fprintf(fp, "  ]\n");
-    fprintf(fp, "}\n");
-    fclose(fp);
+    SimilarityResult* results = NULL;
+    int count = index_query(index, target, top, &results);
+    printf("Scored %s against %d indexed documents, %d with shared k-grams\n",
+           argv[3], index->doc_count, count);
+    
+    const char* output_file = argc > 4 ? argv[4] : "results.json";
+    write_json_results(results, count, target, index->k, output_file);
+    printf("Results written to %s\n", output_file);
+    
+    free(results);
+    free_document(target);
+    index_close(index);
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
     Document* target = NULL;
-    Document* references[MAX_DOCUMENTS];
-    SimilarityResult results[MAX_DOCUMENTS];
+    Document** references = NULL;
+    SimilarityResult* results = NULL;
     int ref_count = 0;
     int k = 3;
+    int window = 1;
+    int top = INDEX_DEFAULT_TOP;
+    double lsh_threshold = 0.0;
+    int threads = 1;
+    ThreadPool* pool = NULL;
+    StopwordSet* stopwords = NULL;
+    const char* cache_dir = NULL;
+    int df_cap = ALLPAIRS_DEFAULT_DF_CAP;
+    double cluster_threshold = ALLPAIRS_DEFAULT_CLUSTER;
+    PipelineIo io = PIPELINE_IO_AUTO;
+    int readers = PIPELINE_DEFAULT_READERS;
+    int queue_depth = PIPELINE_DEFAULT_DEPTH;
+    const char* allow_origin = NULL;
+    const char* reference_root = NULL;
     char output_file[256] = "results.json";
     
+    // One slot per reference; with streamed scoring the pipeline fills
+    // these as references arrive
+    unsigned char* candidate = NULL;
+    unsigned char* passed = NULL;
+    SimilarityResult* scored = NULL;
+    int streamed = 0;
+    
+    // Strip options so the positional arguments keep their usual slots
+    int positional = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--exact") == 0) {
+            set_kgram_exact_mode(1);
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            window = atoi(argv[++i]);
+            if (window < 1) window = 1;
+        } else if (strcmp(argv[i], "--lsh") == 0 && i + 1 < argc) {
+            lsh_threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--stopwords") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "none") == 0) {
+                set_stopwords(NULL);
+            } else {
+                stopwords = load_stopword_file(argv[i]);
+                if (stopwords == NULL) {
+                    printf("Error: Cannot open stopword file %s\n", argv[i]);
+                    return 1;
+                }
+                set_stopwords(stopwords);
+            }
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            perf_enable();
+        } else if (strcmp(argv[i], "--stem") == 0) {
+            set_stemming(1);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--min-passage") == 0 && i + 1 < argc) {
+            common_passage_min_tokens = atoi(argv[++i]);
+            if (common_passage_min_tokens < 1) common_passage_min_tokens = 1;
+        } else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+            heatmap_window_tokens = atoi(argv[++i]);
+            if (heatmap_window_tokens < 0) heatmap_window_tokens = 0;
+        } else if (strcmp(argv[i], "--fuzzy") == 0 && i + 1 < argc) {
+            fuzzy_min_similarity = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--tfidf") == 0) {
+            set_kgram_counts(1);
+        } else if (strcmp(argv[i], "--min-score") == 0 && i + 1 < argc) {
+            similarity_min_score = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--k-range") == 0 && i + 1 < argc) {
+            int k_min, k_max;
+            i++;
+            if (sscanf(argv[i], "%d..%d", &k_min, &k_max) == 2 ||
+                sscanf(argv[i], "%d-%d", &k_min, &k_max) == 2) {
+                set_kgram_range(k_min, k_max);
+            } else {
+                printf("Warning: Ignoring k range %s, expected min..max\n", argv[i]);
+            }
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc) {
+            io = strcmp(argv[++i], "threads") == 0 ? PIPELINE_IO_THREADS : PIPELINE_IO_AUTO;
+        } else if (strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            readers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--queue-depth") == 0 && i + 1 < argc) {
+            queue_depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--df-cap") == 0 && i + 1 < argc) {
+            df_cap = atoi(argv[++i]);
+            if (df_cap < 0) df_cap = 0;
+        } else if (strcmp(argv[i], "--allow-origin") == 0 && i + 1 < argc) {
+            allow_origin = argv[++i];
+        } else if (strcmp(argv[i], "--reference-root") == 0 && i + 1 < argc) {
+            reference_root = argv[++i];
+        } else if (strcmp(argv[i], "--cluster") == 0 && i + 1 < argc) {
+            cluster_threshold = atof(argv[++i]);
+        } else {
+            argv[positional++] = argv[i];
+        }
+    }
+    argc = positional;
+    
+    if (argc >= 5 && strcmp(argv[1], "index") == 0) {
+        return run_index_build(argc, argv, window);
+    }
+    if (argc >= 4 && strcmp(argv[1], "query") == 0) {
+        return run_index_query(argc, argv, top);
+    }
+    if (argc >= 5 && strcmp(argv[1], "batch") == 0) {
+        BatchConfig config = { atoi(argv[3]), window, threads, lsh_threshold, cache_dir, io,
+                               readers, queue_depth };
+        if (config.k < 2 || config.k > 10) config.k = 3;
+        int path_count = argc - 4;
+        const char* batch_output = "results.ndjson";
+        if (path_count > 1 && strstr(argv[argc - 1], ".ndjson")) {
+            batch_output = argv[argc - 1];
+            path_count--;
+        }
+        FILE* fp = fopen(batch_output, "w");
+        if (fp == NULL) {
+            printf("Error: Cannot create output file %s\n", batch_output);
+            return 1;
+        }
+        int status = run_batch(&config, argv[2], (const char**)(argv + 4), path_count, fp);
+        fclose(fp);
+        if (status == 0) printf("Results written to %s\n", batch_output);
+        free_stopword_set(stopwords);
+        return status;
+    }
+    if (argc >= 4 && strcmp(argv[1], "matrix") == 0) {
+        AllPairsConfig config = { atoi(argv[2]), window, threads, df_cap, cluster_threshold,
+                                  cache_dir, io, readers, queue_depth };
+        if (config.k < 2 || config.k > 10) config.k = 3;
+        int path_count = argc - 3;
+        const char* matrix_output = "matrix.json";
+        if (path_count > 1 && strstr(argv[argc - 1], ".json")) {
+            matrix_output = argv[argc - 1];
+            path_count--;
+        }
+        FILE* fp = fopen(matrix_output, "w");
+        if (fp == NULL) {
+            printf("Error: Cannot create output file %s\n", matrix_output);
+            return 1;
+        }
+        int status = run_all_pairs(&config, (const char**)(argv + 3), path_count, fp);
+        fclose(fp);
+        if (status == 0) printf("Results written to %s\n", matrix_output);
+        free_stopword_set(stopwords);
+        return status;
+    }
+    if (argc >= 4 && strcmp(argv[1], "serve") == 0) {
+        ServerConfig config = { atoi(argv[2]), atoi(argv[3]), window,
+                                threads > 1 ? threads : SERVER_DEFAULT_WORKERS, lsh_threshold,
+                                allow_origin, reference_root };
+        if (config.k < 2 || config.k > 10) config.k = 3;
+        int status = run_server(&config, (const char**)(argv + 4), argc - 4);
+        free_stopword_set(stopwords);
+        return status;
+    }
+    
     // Parse command line arguments
     if (argc < 4) {
-        printf("Usage: %s <k_value> <target_file> <ref_file1> [ref_file2 ...] [output_file]\n", argv[0]);
+        printf("Usage: %s [--exact] [--window w] [--lsh jaccard] [--threads n] <k_value> <target_file> <ref_file1> [ref_file2 ...] [output_file]\n", argv[0]);
+        printf("Normalization: [--stopwords <file|none>] [--stem]  Passages: [--min-passage tokens] [--heatmap tokens] [--fuzzy similarity]  Instrumentation: [--perf]  Reuse: [--cache dir]  Sensitivity: [--k-range min..max]  Threshold: [--min-score overall]  Weighting: [--tfidf]\n");
+        printf("Ingestion: [--io uring|threads] [--readers n] [--queue-depth n]\n");
+        printf("       %s [--window w] index <index_dir> <k_value> <ref_file_or_dir> ...\n", argv[0]);
+        printf("       %s [--top n] query <index_dir> <target_file> [output_file]\n", argv[0]);
+        printf("       %s [--window w] [--lsh jaccard] [--threads n] [--cache dir] batch <manifest|-> <k_value> <ref_file_or_dir> ... [output.ndjson]\n", argv[0]);
+        printf("       %s [--window w] [--threads n] [--cache dir] [--min-score overall] [--df-cap n] [--cluster overall] matrix <k_value> <file_or_dir> ... [output.json]\n", argv[0]);
+        printf("       %s [--window w] [--lsh jaccard] [--threads n] [--allow-origin origin] [--reference-root dir] serve <port> <k_value> [ref_file_or_dir ...]\n", argv[0]);
         printf("Using interactive mode...\n\n");
     } else {
         // Command line mode
@@ -70,51 +284,41 @@ int main(int argc, char* argv[]) {
         if (k < 2 || k > 10) k = 3;
         
         // Read target file
-        FILE* target_fp = fopen(argv[2], "r");
-        if (target_fp == NULL) {
+        target = load_document(argv[2], k, window);
+        if (target == NULL) {
             printf("Error: Cannot open target file %s\n", argv[2]);
             return 1;
         }
         
-        char target_text[MAX_STRING_LENGTH] = "";
-        char line[1000];
-        while (fgets(line, sizeof(line), target_fp)) {
-            if (strlen(target_text) + strlen(line) < MAX_STRING_LENGTH - 1) {
-                strcat(target_text, line);
-            }
-        }
-        fclose(target_fp);
-        
-        target = create_document(argv[2]);
-        preprocess_document(target, target_text);
-        generate_kgrams(target, k);
-        
         // Read reference files
         ref_count = argc - 3;
         if (argc > 3 && strstr(argv[argc-1], ".json")) {
             strcpy(output_file, argv[argc-1]);
             ref_count--; // Last argument is output file
         }
+        allocate_reference_slots(ref_count, &references, &candidate, &passed, &scored, &results);
         
+        // Read, tokenize, fingerprint and score as a pipeline, so file
+        // reads overlap the CPU work
+        streamed = lsh_threshold <= 0.0 && !get_kgram_counts();
+        ScoreJob stream = { target, references, candidate, passed, scored };
+        ReferenceSink sink = { references, streamed ? &stream : NULL };
+        PipelineConfig ingest = { k, window, threads, readers, queue_depth, io, cache_dir,
+                                  reference_sink, &sink };
+        PipelineStats stats;
+        if (run_pipeline(&ingest, (const char**)(argv + 3), ref_count, &stats) != 0) {
+            printf("Error: Cannot start the ingestion pipeline\n");
+            return 1;
+        }
+        if (cache_dir != NULL) {
+            printf("Fingerprint cache: %d of %d references reused from %s\n",
+                   stats.cache_hits, ref_count, cache_dir);
+        }
+        if (perf_enabled) print_pipeline_stats(&stats);
         for (int i = 0; i < ref_count; i++) {
-            FILE* ref_fp = fopen(argv[3 + i], "r");
-            if (ref_fp == NULL) {
+            if (references[i] == NULL) {
                 printf("Warning: Cannot open reference file %s, skipping\n", argv[3 + i]);
-                references[i] = NULL;
-                continue;
-            }
-            
-            char ref_text[MAX_STRING_LENGTH] = "";
-            while (fgets(line, sizeof(line), ref_fp)) {
-                if (strlen(ref_text) + strlen(line) < MAX_STRING_LENGTH - 1) {
-                    strcat(ref_text, line);
-                }
             }
-            fclose(ref_fp);
-            
-            references[i] = create_document(argv[3 + i]);
-            preprocess_document(references[i], ref_text);
-            generate_kgrams(references[i], k);
         }
         
         goto analyze; // Skip interactive mode
@@ -147,28 +351,25 @@ int main(int argc, char* argv[]) {
     target_filename[strcspn(target_filename, "\n")] = 0;
     
     printf("Enter target text (end with empty line):\n");
-    char target_text[MAX_STRING_LENGTH] = "";
-    char line[1000];
-    
-    while (fgets(line, sizeof(line), stdin)) {
-        if (strcmp(line, "\n") == 0) break;
-        if (strlen(target_text) + strlen(line) < MAX_STRING_LENGTH - 1) {
-            strcat(target_text, line);
-        } else {
-            printf("Warning: Target text too long, truncating.\n");
-            break;
-        }
-    }
+    size_t target_length = 0;
+    char* target_text = read_stream_until_blank_line(stdin, &target_length);
     
-    if (strlen(target_text) == 0) {
+    if (target_length == 0) {
         printf("Error: No target text provided.\n");
+        free(target_text);
         return 1;
     }
     
     // Process target document
     target = create_document(target_filename);
-    preprocess_document(target, target_text);
-    generate_kgrams(target, k);
+    if (preprocess_document_buffer(target, target_text, target_length) != 0) {
+        printf("Error: Target text is over %zu bytes.\n", MAX_DOCUMENT_BYTES);
+        free(target_text);
+        free_document(target);
+        return 1;
+    }
+    free(target_text);
+    generate_winnowed_kgrams(target, k, window);
     
     printf("Target processed: %d tokens, %d k-grams\n", 
            target->token_count, target->kgram_count);
@@ -181,11 +382,8 @@ int main(int argc, char* argv[]) {
         ref_count = 0;
     }
     getchar();
-    
-    if (ref_count > MAX_DOCUMENTS) {
-        printf("Too many references. Limiting to %d.\n", MAX_DOCUMENTS);
-        ref_count = MAX_DOCUMENTS;
-    }
+    if (ref_count < 0) ref_count = 0;
+    allocate_reference_slots(ref_count, &references, &candidate, &passed, &scored, &results);
     
     for (int i = 0; i < ref_count; i++) {
         printf("\nReference %d:\n", i + 1);
@@ -198,27 +396,27 @@ int main(int argc, char* argv[]) {
         ref_filename[strcspn(ref_filename, "\n")] = 0;
         
         printf("Enter content (end with empty line):\n");
-        char ref_text[MAX_STRING_LENGTH] = "";
-        
-        while (fgets(line, sizeof(line), stdin)) {
-            if (strcmp(line, "\n") == 0) break;
-            if (strlen(ref_text) + strlen(line) < MAX_STRING_LENGTH - 1) {
-                strcat(ref_text, line);
-            } else {
-                printf("Warning: Reference text too long, truncating.\n");
-                break;
-            }
-        }
+        size_t ref_length = 0;
+        char* ref_text = read_stream_until_blank_line(stdin, &ref_length);
         
-        if (strlen(ref_text) == 0) {
+        if (ref_length == 0) {
             printf("Warning: No content for reference %s, skipping.\n", ref_filename);
             references[i] = NULL;
+            free(ref_text);
             continue;
         }
         
         references[i] = create_document(ref_filename);
-        preprocess_document(references[i], ref_text);
-        generate_kgrams(references[i], k);
+        if (preprocess_document_buffer(references[i], ref_text, ref_length) != 0) {
+            printf("Warning: Reference %s is over %zu bytes, skipping.\n", ref_filename,
+                   MAX_DOCUMENT_BYTES);
+            free_document(references[i]);
+            references[i] = NULL;
+            free(ref_text);
+            continue;
+        }
+        free(ref_text);
+        generate_winnowed_kgrams(references[i], k, window);
         
         printf("Reference processed: %d tokens, %d k-grams\n", 
                references[i]->token_count, references[i]->kgram_count);
@@ -228,42 +426,78 @@ analyze:
     // Perform comparisons
     printf("\n=== ANALYZING SIMILARITY ===\n");
     int valid_comparisons = 0;
-    for (int i = 0; i < ref_count; i++) {
-        if (references[i] == NULL) continue;
-        
-        strcpy(results[valid_comparisons].filename, references[i]->filename);
-        
-        // Calculate all similarity measures
-        results[valid_comparisons].jaccard = jaccard_similarity(target->kgrams, references[i]->kgrams);
-        results[valid_comparisons].cosine = cosine_similarity(target->kgrams, references[i]->kgrams);
-        results[valid_comparisons].containment = containment_similarity(target->kgrams, references[i]->kgrams);
-        results[valid_comparisons].dice = dice_coefficient(target->kgrams, references[i]->kgrams);
-        
-        // Calculate overall similarity (weighted average)
-        results[valid_comparisons].overall = (results[valid_comparisons].jaccard + 
-                                            results[valid_comparisons].cosine + 
-                                            results[valid_comparisons].containment + 
-                                            results[valid_comparisons].dice) / 4.0;
-        
-        // Count matching k-grams
-        results[valid_comparisons].matching_kgrams = hash_set_intersection_size(target->kgrams, 
-                                                                              references[i]->kgrams);
-        
-        // Find common phrases
-        find_common_phrases(target, references[i], 
-                          results[valid_comparisons].common_phrases, 
-                          &results[valid_comparisons].phrase_count);
+    
+    // With --lsh only references sharing a MinHash band with the target
+    // are scored exactly; the rest are very unlikely to reach the threshold
+    if (lsh_threshold > 0.0 && ref_count > 0) {
+        int bands, rows;
+        lsh_choose_bands(lsh_threshold, &bands, &rows);
+        LshIndex* lsh = create_lsh_index(bands, rows);
+        for (int i = 0; i < ref_count; i++) {
+            if (references[i] != NULL) lsh_add(lsh, references[i], i);
+        }
         
+        int* candidates = (int*)malloc((size_t)ref_count * sizeof(int));
+        int candidate_count = lsh_query(lsh, target, candidates);
+        memset(candidate, 0, (size_t)ref_count);
+        for (int i = 0; i < candidate_count; i++) {
+            candidate[candidates[i]] = 1;
+        }
+        printf("LSH (%d bands x %d rows): %d of %d references are candidates\n",
+               bands, rows, candidate_count, ref_count);
+        free(candidates);
+        free_lsh_index(lsh);
+    }
+    
+    // With --tfidf, document frequencies come from the references alone
+    if (get_kgram_counts()) {
+        IdfTable* idf = build_idf_table(references, ref_count);
+        for (int i = 0; i < ref_count; i++) {
+            if (references[i] != NULL) tfidf_weigh_document(idf, references[i]);
+        }
+        tfidf_weigh_document(idf, target);
+        free_idf_table(idf);
+    }
+    
+    // Unless the pipeline already did, score every selected reference in
+    // parallel; each task fills the result slot of its own reference, so
+    // output order is input order
+    if (!streamed) {
+        pool = create_thread_pool(threads);
+        ScoreJob score = { target, references, candidate, passed, scored };
+        thread_pool_run(pool, ref_count, score_reference_task, &score);
+        free_thread_pool(pool);
+    }
+    
+    int pruned = 0;
+    for (int i = 0; i < ref_count; i++) {
+        if (references[i] == NULL || !candidate[i]) continue;
+        if (!passed[i]) {
+            pruned++;
+            continue;
+        }
+        results[valid_comparisons] = scored[i];
         printf("Compared with %s: %.1f%% similar\n", 
                references[i]->filename, results[valid_comparisons].overall * 100);
         valid_comparisons++;
     }
+    free(scored);
+    free(candidate);
+    free(passed);
+    if (similarity_min_score > 0.0) {
+        printf("Min score %.2f: %d references fell short and were left out\n",
+               similarity_min_score, pruned);
+    }
     
     // Write results to JSON file for frontend
     write_json_results(results, valid_comparisons, target, k, output_file);
     printf("Results written to %s\n", output_file);
     
     // Cleanup
+    for (int i = 0; i < valid_comparisons; i++) {
+        free_similarity_result(&results[i]);
+    }
+    free(results);
     if (target != NULL) {
         free_document(target);
     }
@@ -272,6 +506,8 @@ analyze:
             free_document(references[i]);
         }
     }
+    free(references);
+    free_stopword_set(stopwords);
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,466 @@
+#include "normalize.h"
+#include "tokenize.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STOPWORD_MAX_LENGTH 255
+#define STOPWORD_SEED_ATTEMPTS 4096
+
+static const char* builtin_stopwords[] = {
+    "a", "an", "the", "and", "or", "but", "in", "on", "at", "to", "for",
+    "of", "with", "by", "as", "is", "was", "were", "be", "been", "have",
+    "has", "had", "do", "does", "did", "will", "would", "could", "should",
+    "may", "might", "must", "can", "i", "you", "he", "she", "it", "we",
+    "they", "me", "him", "her", "us", "them", "this", "that", "these",
+    "those", "my", "your", "his", "its", "our", "their", "am", "are"
+};
+
+static const StopwordSet* active_stopwords = NULL;
+static int stopwords_configured = 0;
+static int active_stemming = 0;
+static StopwordSet* builtin_set = NULL;
+static pthread_once_t builtin_once = PTHREAD_ONCE_INIT;
+
+// Perfect-Hash Stopword Set
+static uint32_t stopword_hash(const char* word, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)word[i];
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+    return hash;
+}
+
+// Finds a seed under which every word lands in its own slot, doubling the
+// table whenever a run of seeds fails. The words are distinct, so some
+// table size always works.
+StopwordSet* create_stopword_set(const char** words, int count) {
+    StopwordSet* set = (StopwordSet*)calloc(1, sizeof(StopwordSet));
+    size_t pool_size = 1;
+    for (int i = 0; i < count; i++) {
+        pool_size += strlen(words[i]) + 1;
+    }
+    set->pool = (char*)malloc(pool_size);
+
+    uint32_t size = 16;
+    while (size < (uint32_t)count * 4) size <<= 1;
+
+    for (;;) {
+        set->offsets = (uint32_t*)realloc(set->offsets, size * sizeof(uint32_t));
+        set->lengths = (uint8_t*)realloc(set->lengths, size);
+        set->mask = size - 1;
+
+        for (uint32_t seed = 1; seed <= STOPWORD_SEED_ATTEMPTS; seed++) {
+            memset(set->offsets, 0, size * sizeof(uint32_t));
+            size_t used = 0;
+            int ok = 1;
+            set->count = 0;
+            set->seed = seed;
+
+            for (int i = 0; i < count && ok; i++) {
+                size_t length = strlen(words[i]);
+                if (length == 0 || length > STOPWORD_MAX_LENGTH) continue;
+                uint32_t slot = stopword_hash(words[i], length, seed) & set->mask;
+                if (set->offsets[slot] != 0) {
+                    // A repeated word is not a collision
+                    ok = set->lengths[slot] == length &&
+                         memcmp(set->pool + set->offsets[slot] - 1, words[i], length) == 0;
+                    continue;
+                }
+                memcpy(set->pool + used, words[i], length + 1);
+                set->offsets[slot] = (uint32_t)used + 1;
+                set->lengths[slot] = (uint8_t)length;
+                used += length + 1;
+                set->count++;
+            }
+            if (ok) return set;
+        }
+        size <<= 1;
+    }
+}
+
+// One word per line or whitespace-separated; '#' starts a comment line.
+// Words are folded by the tokenizer's own rules (fold_word) so that they
+// match its output in any script.
+StopwordSet* load_stopword_file(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) return NULL;
+
+    char** words = NULL;
+    int count = 0, capacity = 0;
+    char word[STOPWORD_MAX_LENGTH + 1];
+    int c;
+
+    for (;;) {
+        if (fscanf(fp, "%255s", word) != 1) break;
+        if (word[0] == '#') {
+            while ((c = fgetc(fp)) != EOF && c != '\n') {}
+            continue;
+        }
+        word[fold_word(word, strlen(word))] = '\0';
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 128;
+            words = (char**)realloc(words, capacity * sizeof(char*));
+        }
+        words[count] = (char*)malloc(strlen(word) + 1);
+        strcpy(words[count], word);
+        count++;
+    }
+    fclose(fp);
+
+    StopwordSet* set = create_stopword_set((const char**)words, count);
+    for (int i = 0; i < count; i++) {
+        free(words[i]);
+    }
+    free(words);
+    return set;
+}
+
+int stopword_set_contains(const StopwordSet* set, const char* word, size_t length) {
+    if (set == NULL || set->count == 0 || length > STOPWORD_MAX_LENGTH) return 0;
+    uint32_t slot = stopword_hash(word, length, set->seed) & set->mask;
+    return set->offsets[slot] != 0 && set->lengths[slot] == length &&
+           memcmp(set->pool + set->offsets[slot] - 1, word, length) == 0;
+}
+
+void free_stopword_set(StopwordSet* set) {
+    if (set == NULL) return;
+    free(set->pool);
+    free(set->offsets);
+    free(set->lengths);
+    free(set);
+}
+
+// Active Settings
+static void build_builtin_set(void) {
+    builtin_set = create_stopword_set(builtin_stopwords,
+                                      (int)(sizeof(builtin_stopwords) / sizeof(builtin_stopwords[0])));
+}
+
+const StopwordSet* default_stopwords(void) {
+    pthread_once(&builtin_once, build_builtin_set);
+    return builtin_set;
+}
+
+// NULL disables stopword removal
+void set_stopwords(const StopwordSet* set) {
+    active_stopwords = set;
+    stopwords_configured = 1;
+}
+
+void set_stemming(int enabled) {
+    active_stemming = enabled;
+}
+
+static const StopwordSet* current_stopwords(void) {
+    return stopwords_configured ? active_stopwords : default_stopwords();
+}
+
+int is_active_stopword(const char* word, size_t length) {
+    return stopword_set_contains(current_stopwords(), word, length);
+}
+
+// The Porter rules are English; words in other scripts pass through
+static int is_ascii_word(const char* token, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if ((unsigned char)token[i] >= 0x80) return 0;
+    }
+    return 1;
+}
+
+// Returns 0 if the token is a stopword and should be dropped; otherwise
+// applies stemming in place and updates *length.
+int normalize_token(char* token, size_t* length) {
+    if (stopword_set_contains(current_stopwords(), token, *length)) return 0;
+    if (active_stemming && is_ascii_word(token, *length)) {
+        *length = porter_stem(token, *length);
+        token[*length] = '\0';
+    }
+    return 1;
+}
+
+// Identifies the settings that affect token output, for cache keys
+uint64_t normalization_signature(void) {
+    const StopwordSet* set = current_stopwords();
+    uint64_t signature = 1469598103934665603ULL ^ (uint64_t)active_stemming;
+    if (set != NULL) {
+        for (uint32_t slot = 0; slot <= set->mask; slot++) {
+            if (set->offsets[slot] == 0) continue;
+            signature ^= (uint64_t)stopword_hash(set->pool + set->offsets[slot] - 1,
+                                                 set->lengths[slot], 0x5bd1e995u);
+            signature *= 1099511628211ULL;
+        }
+    }
+    return signature;
+}
+
+// Porter Stemmer
+// M. F. Porter, "An algorithm for suffix stripping", 1980. Works on the
+// lowercase word b[0..k]; j marks the end of the stem while a suffix is
+// being tested.
+typedef struct Stemmer {
+    char* b;
+    int k;
+    int j;
+} Stemmer;
+
+static int is_consonant(const Stemmer* z, int i) {
+    switch (z->b[i]) {
+        case 'a': case 'e': case 'i': case 'o': case 'u':
+            return 0;
+        case 'y':
+            return i == 0 ? 1 : !is_consonant(z, i - 1);
+        default:
+            return 1;
+    }
+}
+
+// Number of vowel-consonant sequences in b[0..j]
+static int measure(const Stemmer* z) {
+    int n = 0, i = 0;
+    for (;;) {
+        if (i > z->j) return n;
+        if (!is_consonant(z, i)) break;
+        i++;
+    }
+    i++;
+    for (;;) {
+        for (;;) {
+            if (i > z->j) return n;
+            if (is_consonant(z, i)) break;
+            i++;
+        }
+        i++;
+        n++;
+        for (;;) {
+            if (i > z->j) return n;
+            if (!is_consonant(z, i)) break;
+            i++;
+        }
+        i++;
+    }
+}
+
+static int vowel_in_stem(const Stemmer* z) {
+    for (int i = 0; i <= z->j; i++) {
+        if (!is_consonant(z, i)) return 1;
+    }
+    return 0;
+}
+
+static int double_consonant(const Stemmer* z, int i) {
+    if (i < 1 || z->b[i] != z->b[i - 1]) return 0;
+    return is_consonant(z, i);
+}
+
+// consonant-vowel-consonant ending, where the last is not w, x or y
+static int cvc(const Stemmer* z, int i) {
+    if (i < 2 || !is_consonant(z, i) || is_consonant(z, i - 1) || !is_consonant(z, i - 2)) return 0;
+    char ch = z->b[i];
+    return ch != 'w' && ch != 'x' && ch != 'y';
+}
+
+static int ends(Stemmer* z, const char* suffix) {
+    int length = (int)strlen(suffix);
+    if (length > z->k + 1 || z->b[z->k] != suffix[length - 1]) return 0;
+    if (memcmp(z->b + z->k - length + 1, suffix, length) != 0) return 0;
+    z->j = z->k - length;
+    return 1;
+}
+
+static void set_to(Stemmer* z, const char* replacement) {
+    int length = (int)strlen(replacement);
+    memcpy(z->b + z->j + 1, replacement, length);
+    z->k = z->j + length;
+}
+
+static void replace_if_measured(Stemmer* z, const char* replacement) {
+    if (measure(z) > 0) set_to(z, replacement);
+}
+
+// Plurals and -ed / -ing
+static void step1ab(Stemmer* z) {
+    if (z->b[z->k] == 's') {
+        if (ends(z, "sses")) z->k -= 2;
+        else if (ends(z, "ies")) set_to(z, "i");
+        else if (z->k >= 1 && z->b[z->k - 1] != 's') z->k--;
+    }
+    if (ends(z, "eed")) {
+        if (measure(z) > 0) z->k--;
+    } else if ((ends(z, "ed") || ends(z, "ing")) && vowel_in_stem(z)) {
+        z->k = z->j;
+        if (ends(z, "at")) set_to(z, "ate");
+        else if (ends(z, "bl")) set_to(z, "ble");
+        else if (ends(z, "iz")) set_to(z, "ize");
+        else if (double_consonant(z, z->k)) {
+            z->k--;
+            char ch = z->b[z->k];
+            if (ch == 'l' || ch == 's' || ch == 'z') z->k++;
+        } else if (measure(z) == 1 && cvc(z, z->k)) {
+            set_to(z, "e");
+        }
+    }
+}
+
+// Terminal y -> i when there is another vowel in the stem
+static void step1c(Stemmer* z) {
+    if (ends(z, "y") && vowel_in_stem(z)) z->b[z->k] = 'i';
+}
+
+// Double suffixes to single ones, keyed on the penultimate letter
+static void step2(Stemmer* z) {
+    if (z->k < 1) return;
+    switch (z->b[z->k - 1]) {
+        case 'a':
+            if (ends(z, "ational")) { replace_if_measured(z, "ate"); break; }
+            if (ends(z, "tional")) { replace_if_measured(z, "tion"); break; }
+            break;
+        case 'c':
+            if (ends(z, "enci")) { replace_if_measured(z, "ence"); break; }
+            if (ends(z, "anci")) { replace_if_measured(z, "ance"); break; }
+            break;
+        case 'e':
+            if (ends(z, "izer")) { replace_if_measured(z, "ize"); break; }
+            break;
+        case 'l':
+            if (ends(z, "bli")) { replace_if_measured(z, "ble"); break; }
+            if (ends(z, "alli")) { replace_if_measured(z, "al"); break; }
+            if (ends(z, "entli")) { replace_if_measured(z, "ent"); break; }
+            if (ends(z, "eli")) { replace_if_measured(z, "e"); break; }
+            if (ends(z, "ousli")) { replace_if_measured(z, "ous"); break; }
+            break;
+        case 'o':
+            if (ends(z, "ization")) { replace_if_measured(z, "ize"); break; }
+            if (ends(z, "ation")) { replace_if_measured(z, "ate"); break; }
+            if (ends(z, "ator")) { replace_if_measured(z, "ate"); break; }
+            break;
+        case 's':
+            if (ends(z, "alism")) { replace_if_measured(z, "al"); break; }
+            if (ends(z, "iveness")) { replace_if_measured(z, "ive"); break; }
+            if (ends(z, "fulness")) { replace_if_measured(z, "ful"); break; }
+            if (ends(z, "ousness")) { replace_if_measured(z, "ous"); break; }
+            break;
+        case 't':
+            if (ends(z, "aliti")) { replace_if_measured(z, "al"); break; }
+            if (ends(z, "iviti")) { replace_if_measured(z, "ive"); break; }
+            if (ends(z, "biliti")) { replace_if_measured(z, "ble"); break; }
+            break;
+        case 'g':
+            if (ends(z, "logi")) { replace_if_measured(z, "log"); break; }
+            break;
+    }
+}
+
+// -ic-, -full, -ness etc.
+static void step3(Stemmer* z) {
+    switch (z->b[z->k]) {
+        case 'e':
+            if (ends(z, "icate")) { replace_if_measured(z, "ic"); break; }
+            if (ends(z, "ative")) { replace_if_measured(z, ""); break; }
+            if (ends(z, "alize")) { replace_if_measured(z, "al"); break; }
+            break;
+        case 'i':
+            if (ends(z, "iciti")) { replace_if_measured(z, "ic"); break; }
+            break;
+        case 'l':
+            if (ends(z, "ical")) { replace_if_measured(z, "ic"); break; }
+            if (ends(z, "ful")) { replace_if_measured(z, ""); break; }
+            break;
+        case 's':
+            if (ends(z, "ness")) { replace_if_measured(z, ""); break; }
+            break;
+    }
+}
+
+// -ant, -ence etc. in context <c>vcvc<v>
+static void step4(Stemmer* z) {
+    if (z->k < 1) return;
+    switch (z->b[z->k - 1]) {
+        case 'a':
+            if (ends(z, "al")) break;
+            return;
+        case 'c':
+            if (ends(z, "ance")) break;
+            if (ends(z, "ence")) break;
+            return;
+        case 'e':
+            if (ends(z, "er")) break;
+            return;
+        case 'i':
+            if (ends(z, "ic")) break;
+            return;
+        case 'l':
+            if (ends(z, "able")) break;
+            if (ends(z, "ible")) break;
+            return;
+        case 'n':
+            if (ends(z, "ant")) break;
+            if (ends(z, "ement")) break;
+            if (ends(z, "ment")) break;
+            if (ends(z, "ent")) break;
+            return;
+        case 'o':
+            if (ends(z, "ion") && z->j >= 0 && (z->b[z->j] == 's' || z->b[z->j] == 't')) break;
+            if (ends(z, "ou")) break;
+            return;
+        case 's':
+            if (ends(z, "ism")) break;
+            return;
+        case 't':
+            if (ends(z, "ate")) break;
+            if (ends(z, "iti")) break;
+            return;
+        case 'u':
+            if (ends(z, "ous")) break;
+            return;
+        case 'v':
+            if (ends(z, "ive")) break;
+            return;
+        case 'z':
+            if (ends(z, "ize")) break;
+            return;
+        default:
+            return;
+    }
+    if (measure(z) > 1) z->k = z->j;
+}
+
+// Final -e and -ll
+static void step5(Stemmer* z) {
+    z->j = z->k;
+    if (z->b[z->k] == 'e') {
+        int a = measure(z);
+        if (a > 1 || (a == 1 && !cvc(z, z->k - 1))) z->k--;
+    }
+    if (z->b[z->k] == 'l' && double_consonant(z, z->k) && measure(z) > 1) z->k--;
+}
+
+// Stems a lowercase word in place and returns its new length. Words of
+// one or two letters and words containing anything but a-z are left alone.
+size_t porter_stem(char* word, size_t length) {
+    if (length <= 2) return length;
+    for (size_t i = 0; i < length; i++) {
+        if (word[i] < 'a' || word[i] > 'z') return length;
+    }
+
+    Stemmer z;
+    z.b = word;
+    z.k = (int)length - 1;
+    z.j = 0;
+
+    step1ab(&z);
+    if (z.k > 0) {
+        step1c(&z);
+        step2(&z);
+        step3(&z);
+        step4(&z);
+        step5(&z);
+    }
+    return (size_t)(z.k + 1);
+}
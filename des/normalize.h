@@ -0,0 +1,36 @@
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Token Normalization
+// Runs on every token after case folding: stopwords are dropped through a
+// perfect-hash lookup (one hash, at most one compare), then the remaining
+// token is optionally reduced by the Porter stemmer. The active settings
+// are process-wide and should be chosen before any document is processed.
+
+typedef struct StopwordSet {
+    char* pool;                // NUL-terminated words
+    uint32_t* offsets;         // per table slot: pool offset + 1, 0 = empty
+    uint8_t* lengths;          // per table slot: word length
+    uint32_t seed;
+    uint32_t mask;             // table size - 1, a power of two minus one
+    int count;
+} StopwordSet;
+
+StopwordSet* create_stopword_set(const char** words, int count);
+StopwordSet* load_stopword_file(const char* path);
+int stopword_set_contains(const StopwordSet* set, const char* word, size_t length);
+void free_stopword_set(StopwordSet* set);
+
+const StopwordSet* default_stopwords(void);
+void set_stopwords(const StopwordSet* set);
+void set_stemming(int enabled);
+int is_active_stopword(const char* word, size_t length);
+int normalize_token(char* token, size_t* length);
+uint64_t normalization_signature(void);
+
+size_t porter_stem(char* word, size_t length);
+
+#endif
@@ -0,0 +1,356 @@
+#include "plagiarism.h"
+#include "perf.h"
+
+// Suffix Automaton over Token IDs
+// Built over the reference tokens in O(n). Transitions live in one hash
+// table keyed by (state, token ID) for O(1) lookups even from the root,
+// whose out-degree is the whole vocabulary; each state also chains its
+// own edges so that a clone can copy them.
+
+typedef struct SamState {
+    int len;                   // longest string in the state
+    int link;                  // suffix link
+    int first_end;             // end position of its first occurrence
+    int edges;                 // head of the edge chain, -1 ends
+} SamState;
+
+typedef struct SamEdge {
+    uint32_t token;
+    int next;
+} SamEdge;
+
+typedef struct SuffixAutomaton {
+    SamState* states;
+    int state_count;
+    SamEdge* edges;
+    int edge_count;
+    int edge_capacity;
+    uint64_t* keys;            // (state << 32 | token) + 1, 0 = empty
+    int* targets;
+    int table_size;
+    int table_count;
+} SuffixAutomaton;
+
+static uint64_t transition_key(int state, uint32_t token) {
+    return (((uint64_t)(uint32_t)state << 32) | token) + 1;
+}
+
+static int transition_slot(const SuffixAutomaton* sam, uint64_t key) {
+    unsigned int mask = (unsigned int)sam->table_size - 1;
+    unsigned int slot = (unsigned int)fingerprint_mix(key) & mask;
+    while (sam->keys[slot] != 0 && sam->keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    return (int)slot;
+}
+
+static int sam_next(const SuffixAutomaton* sam, int state, uint32_t token) {
+    int slot = transition_slot(sam, transition_key(state, token));
+    return sam->keys[slot] != 0 ? sam->targets[slot] : -1;
+}
+
+static void sam_grow_table(SuffixAutomaton* sam) {
+    uint64_t* old_keys = sam->keys;
+    int* old_targets = sam->targets;
+    int old_size = sam->table_size;
+
+    sam->table_size *= 2;
+    sam->keys = (uint64_t*)calloc(sam->table_size, sizeof(uint64_t));
+    sam->targets = (int*)malloc(sam->table_size * sizeof(int));
+    for (int i = 0; i < old_size; i++) {
+        if (old_keys[i] == 0) continue;
+        int slot = transition_slot(sam, old_keys[i]);
+        sam->keys[slot] = old_keys[i];
+        sam->targets[slot] = old_targets[i];
+    }
+    free(old_keys);
+    free(old_targets);
+}
+
+// Adds or redirects the transition state --token--> target
+static void sam_set(SuffixAutomaton* sam, int state, uint32_t token, int target) {
+    if ((sam->table_count + 1) > sam->table_size * HASH_SET_MAX_LOAD) {
+        sam_grow_table(sam);
+    }
+    uint64_t key = transition_key(state, token);
+    int slot = transition_slot(sam, key);
+    if (sam->keys[slot] == 0) {
+        sam->keys[slot] = key;
+        sam->table_count++;
+
+        if (sam->edge_count == sam->edge_capacity) {
+            sam->edge_capacity *= 2;
+            sam->edges = (SamEdge*)realloc(sam->edges, sam->edge_capacity * sizeof(SamEdge));
+        }
+        sam->edges[sam->edge_count].token = token;
+        sam->edges[sam->edge_count].next = sam->states[state].edges;
+        sam->states[state].edges = sam->edge_count++;
+    }
+    sam->targets[slot] = target;
+}
+
+static int sam_new_state(SuffixAutomaton* sam, int len, int link, int first_end) {
+    SamState* state = &sam->states[sam->state_count];
+    state->len = len;
+    state->link = link;
+    state->first_end = first_end;
+    state->edges = -1;
+    return sam->state_count++;
+}
+
+static void build_suffix_automaton(SuffixAutomaton* sam, const uint32_t* tokens, int n) {
+    // At most 2n - 1 states and 3n - 4 transitions
+    sam->states = (SamState*)malloc((2 * n + 2) * sizeof(SamState));
+    sam->state_count = 0;
+    sam->edge_capacity = 3 * n + 16;
+    sam->edges = (SamEdge*)malloc(sam->edge_capacity * sizeof(SamEdge));
+    sam->edge_count = 0;
+    sam->table_size = 64;
+    while (sam->table_size * HASH_SET_MAX_LOAD < 3.0 * n + 16) sam->table_size <<= 1;
+    sam->keys = (uint64_t*)calloc(sam->table_size, sizeof(uint64_t));
+    sam->targets = (int*)malloc(sam->table_size * sizeof(int));
+    sam->table_count = 0;
+
+    int last = sam_new_state(sam, 0, -1, -1);
+    for (int i = 0; i < n; i++) {
+        uint32_t c = tokens[i];
+        int cur = sam_new_state(sam, sam->states[last].len + 1, 0, i);
+        int p = last;
+        while (p != -1 && sam_next(sam, p, c) == -1) {
+            sam_set(sam, p, c, cur);
+            p = sam->states[p].link;
+        }
+        if (p != -1) {
+            int q = sam_next(sam, p, c);
+            if (sam->states[p].len + 1 == sam->states[q].len) {
+                sam->states[cur].link = q;
+            } else {
+                int clone = sam_new_state(sam, sam->states[p].len + 1,
+                                          sam->states[q].link, sam->states[q].first_end);
+                for (int e = sam->states[q].edges; e != -1; e = sam->edges[e].next) {
+                    sam_set(sam, clone, sam->edges[e].token, sam_next(sam, q, sam->edges[e].token));
+                }
+                while (p != -1 && sam_next(sam, p, c) == q) {
+                    sam_set(sam, p, c, clone);
+                    p = sam->states[p].link;
+                }
+                sam->states[q].link = clone;
+                sam->states[cur].link = clone;
+            }
+        }
+        last = cur;
+    }
+}
+
+static void free_suffix_automaton(SuffixAutomaton* sam) {
+    free(sam->states);
+    free(sam->edges);
+    free(sam->keys);
+    free(sam->targets);
+}
+
+// Common Passage Extraction
+static int compare_passages(const void* a, const void* b) {
+    const CommonPassage* pa = (const CommonPassage*)a;
+    const CommonPassage* pb = (const CommonPassage*)b;
+    if (pa->length != pb->length) return pb->length - pa->length;
+    return pa->target_start - pb->target_start;
+}
+
+// Streams the target through an automaton of the reference. After token i
+// the walk holds the longest suffix of target[0..i] that occurs in the
+// reference; it is a maximal passage when the next token does not extend
+// it. Passages of at least min_length tokens are returned longest first,
+// with token and byte ranges in both documents. Runs in
+// O(|target| + |reference|).
+int find_common_passages(Document* target, Document* reference, int min_length,
+                         CommonPassage** passages) {
+    *passages = NULL;
+    if (min_length < 1) min_length = 1;
+    if (target->token_count < min_length || reference->token_count < min_length) return 0;
+
+    SuffixAutomaton sam;
+    build_suffix_automaton(&sam, reference->token_ids, reference->token_count);
+
+    int count = 0, capacity = 0;
+    int state = 0, length = 0;
+    int previous_length = 0, previous_state = 0;
+
+    for (int i = 0; i <= target->token_count; i++) {
+        if (i < target->token_count) {
+            uint32_t c = target->token_ids[i];
+            while (state != 0 && sam_next(&sam, state, c) == -1) {
+                state = sam.states[state].link;
+                length = sam.states[state].len;
+            }
+            int next = sam_next(&sam, state, c);
+            if (next != -1) {
+                state = next;
+                length++;
+            } else {
+                state = 0;
+                length = 0;
+            }
+        } else {
+            length = 0;
+        }
+
+        // The match ending at i - 1 could not be extended by token i
+        if (previous_length >= min_length && length != previous_length + 1) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                *passages = (CommonPassage*)realloc(*passages, capacity * sizeof(CommonPassage));
+            }
+            CommonPassage* passage = &(*passages)[count++];
+            int target_end = i - 1;
+            int ref_end = sam.states[previous_state].first_end;
+            passage->length = previous_length;
+            passage->target_start = target_end - previous_length + 1;
+            passage->ref_start = ref_end - previous_length + 1;
+
+            const Token* first = &target->tokens[passage->target_start];
+            const Token* last = &target->tokens[target_end];
+            passage->target_char_start = first->source_offset;
+            passage->target_char_end = last->source_offset + last->source_length;
+            first = &reference->tokens[passage->ref_start];
+            last = &reference->tokens[ref_end];
+            passage->ref_char_start = first->source_offset;
+            passage->ref_char_end = last->source_offset + last->source_length;
+        }
+        previous_length = length;
+        previous_state = state;
+    }
+
+    free_suffix_automaton(&sam);
+    if (count > 1) qsort(*passages, count, sizeof(CommonPassage), compare_passages);
+    return count;
+}
+
+int common_passage_min_tokens = COMMON_PASSAGE_MIN_TOKENS;
+
+// Fills result->passages with every maximal passage of at least
+// common_passage_min_tokens tokens shared with the reference
+void find_common_phrases(Document* target, Document* reference, SimilarityResult* result) {
+    uint64_t start = perf_enabled ? perf_now_ns() : 0;
+    if (ensure_document_tokens(target) != 0 || ensure_document_tokens(reference) != 0) {
+        result->passages = NULL;
+        result->passage_count = 0;
+        return;
+    }
+    result->passage_count = find_common_passages(target, reference, common_passage_min_tokens,
+                                                 &result->passages);
+    if (perf_enabled) {
+        result->passages_ms = (perf_now_ns() - start) / 1e6;
+        perf_add(PERF_PASSAGES, (uint64_t)result->passage_count);
+        perf_stage(PERF_STAGE_PASSAGES, start);
+    }
+}
+
+// Writes the passage as normalized target tokens joined by single spaces
+char* common_passage_text(const Document* target, const CommonPassage* passage) {
+    size_t total = 1;
+    for (int i = 0; i < passage->length; i++) {
+        total += target->tokens[passage->target_start + i].length + 1;
+    }
+    char* text = (char*)malloc(total);
+    size_t used = 0;
+    for (int i = 0; i < passage->length; i++) {
+        const Token* token = &target->tokens[passage->target_start + i];
+        if (i > 0) text[used++] = ' ';
+        memcpy(text + used, document_token(target, passage->target_start + i), token->length);
+        used += token->length;
+    }
+    text[used] = '\0';
+    return text;
+}
+
+// Segment Heatmap
+// The target is cut into windows of heatmap_window_tokens tokens that
+// overlap by half: segment s covers tokens [s * stride, s * stride +
+// window), the last one clipped to the end. A segment's score is the
+// share of its kept k-grams (by start token) whose fingerprint the
+// reference has, the containment of that stretch alone.
+int heatmap_window_tokens = 0;
+
+int heatmap_stride_tokens(void) {
+    int stride = heatmap_window_tokens / 2;
+    return stride > 0 ? stride : 1;
+}
+
+int heatmap_segment_count(int token_count) {
+    int window = heatmap_window_tokens;
+    if (window <= 0 || token_count <= 0) return 0;
+    if (token_count <= window) return 1;
+    int stride = heatmap_stride_tokens();
+    return 1 + (token_count - window + stride - 1) / stride;
+}
+
+// Byte range of the segment in the original target, end exclusive
+void heatmap_segment_range(const Document* target, int segment, uint32_t* start, uint32_t* end) {
+    int first = segment * heatmap_stride_tokens();
+    int last = first + heatmap_window_tokens;
+    if (last > target->token_count) last = target->token_count;
+    *start = target->tokens[first].source_offset;
+    *end = target->tokens[last - 1].source_offset + target->tokens[last - 1].source_length;
+}
+
+// Slides the window over the target's kept k-grams once: each k-gram is
+// looked up in the reference when it enters a window, and the running
+// kept/shared counts are adjusted as k-grams enter and leave, so a pair
+// costs one pass over the target whatever the window and stride
+void compute_similarity_heatmap(Document* target, Document* reference, SimilarityResult* result) {
+    result->heatmap = NULL;
+    result->heatmap_count = 0;
+    if (heatmap_window_tokens <= 0 || ensure_document_tokens(target) != 0) return;
+    int segments = heatmap_segment_count(target->token_count);
+    if (segments == 0) return;
+
+    int* positions;
+    uint64_t* fingerprints;
+    int kept = document_kept_kgrams(target, &positions, &fingerprints);
+    HashSet* reference_set = document_kgrams(reference);
+    unsigned char* shared = (unsigned char*)malloc(kept > 0 ? kept : 1);
+    float* heatmap = (float*)malloc(segments * sizeof(float));
+
+    int stride = heatmap_stride_tokens();
+    int head = 0, tail = 0;
+    int in_window = 0, shared_in_window = 0;
+    for (int s = 0; s < segments; s++) {
+        int first = s * stride;
+        int end = first + heatmap_window_tokens;
+        while (tail < kept && positions[tail] < end) {
+            shared[tail] = (unsigned char)hash_set_contains_fingerprint(reference_set,
+                                                                       fingerprints[tail]);
+            shared_in_window += shared[tail];
+            in_window++;
+            tail++;
+        }
+        while (head < tail && positions[head] < first) {
+            shared_in_window -= shared[head];
+            in_window--;
+            head++;
+        }
+        heatmap[s] = in_window > 0 ? (float)shared_in_window / in_window : 0.0f;
+    }
+
+    free(shared);
+    free(fingerprints);
+    free(positions);
+    result->heatmap = heatmap;
+    result->heatmap_count = segments;
+}
+
+void free_similarity_result(SimilarityResult* result) {
+    free(result->passages);
+    result->passages = NULL;
+    result->passage_count = 0;
+    free(result->k_scores);
+    result->k_scores = NULL;
+    result->k_score_count = 0;
+    free(result->heatmap);
+    result->heatmap = NULL;
+    result->heatmap_count = 0;
+    free(result->fuzzy_passages);
+    result->fuzzy_passages = NULL;
+    result->fuzzy_passage_count = 0;
+}
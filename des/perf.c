@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+#include "perf.h"
+#include "plagiarism.h"
+
+#include <time.h>
+
+int perf_enabled = 0;
+
+static uint64_t perf_counters[PERF_COUNTER_COUNT];
+static uint64_t perf_stage_ns[PERF_STAGE_COUNT];
+static uint64_t perf_stage_calls[PERF_STAGE_COUNT];
+static uint64_t perf_start_ns;
+
+static const char* perf_stage_names[PERF_STAGE_COUNT] = {
+    "ingest", "preprocess", "kgrams", "similarity", "passages", "alignment"
+};
+
+static const char* perf_counter_names[PERF_COUNTER_COUNT] = {
+    "documents", "input_bytes", "tokens", "stopwords_dropped", "truncated_tokens",
+    "truncated_bytes", "kgrams", "hash_slots", "hash_entries", "hash_grows", "hash_adds",
+    "hash_add_probes", "hash_lookups", "hash_lookup_probes", "hash_max_probe",
+    "arena_allocations", "arena_bytes", "arena_blocks", "arena_blocks_reused",
+    "comparisons", "passages", "cache_hits", "cache_misses",
+    "pairs_size_pruned", "pairs_bound_pruned", "aligned_regions", "fuzzy_passages"
+};
+
+void perf_enable(void) {
+    perf_start_ns = perf_now_ns();
+    perf_enabled = 1;
+}
+
+uint64_t perf_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void perf_add(PerfCounter counter, uint64_t amount) {
+    __atomic_fetch_add(&perf_counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+void perf_max(PerfCounter counter, uint64_t value) {
+    uint64_t current = __atomic_load_n(&perf_counters[counter], __ATOMIC_RELAXED);
+    while (value > current &&
+           !__atomic_compare_exchange_n(&perf_counters[counter], &current, value, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Closes a stage that began at start_ns (from perf_now_ns)
+void perf_stage(PerfStage stage, uint64_t start_ns) {
+    __atomic_fetch_add(&perf_stage_ns[stage], perf_now_ns() - start_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&perf_stage_calls[stage], 1, __ATOMIC_RELAXED);
+}
+
+static double ratio(uint64_t a, uint64_t b) {
+    return b > 0 ? (double)a / b : 0.0;
+}
+
+// Writes the "perf" object at `indent`, leaving it open after the
+// counters so the caller can append its own members and close it
+void write_json_perf(JsonBuffer* out, const char* indent) {
+    uint64_t counters[PERF_COUNTER_COUNT];
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        counters[i] = __atomic_load_n(&perf_counters[i], __ATOMIC_RELAXED);
+    }
+
+    json_buffer_printf(out, "{\n");
+    json_buffer_printf(out, "%s  \"elapsed_ms\": %.3f,\n", indent,
+                       (perf_now_ns() - perf_start_ns) / 1e6);
+    json_buffer_printf(out, "%s  \"stages\": {\n", indent);
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        json_buffer_printf(out, "%s    \"%s\": {\"ms\": %.3f, \"calls\": %llu}%s\n", indent,
+                           perf_stage_names[i],
+                           __atomic_load_n(&perf_stage_ns[i], __ATOMIC_RELAXED) / 1e6,
+                           (unsigned long long)__atomic_load_n(&perf_stage_calls[i],
+                                                               __ATOMIC_RELAXED),
+                           i < PERF_STAGE_COUNT - 1 ? "," : "");
+    }
+    json_buffer_printf(out, "%s  },\n", indent);
+    json_buffer_printf(out, "%s  \"counters\": {\n", indent);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        json_buffer_printf(out, "%s    \"%s\": %llu,\n", indent, perf_counter_names[i],
+                           (unsigned long long)counters[i]);
+    }
+    json_buffer_printf(out, "%s    \"hash_load_factor\": %.4f,\n", indent,
+                       ratio(counters[PERF_HASH_ENTRIES], counters[PERF_HASH_SLOTS]));
+    json_buffer_printf(out, "%s    \"hash_mean_add_probe\": %.4f,\n", indent,
+                       ratio(counters[PERF_HASH_ADD_PROBES], counters[PERF_HASH_ADDS]));
+    json_buffer_printf(out, "%s    \"hash_mean_lookup_probe\": %.4f\n", indent,
+                       ratio(counters[PERF_HASH_LOOKUP_PROBES], counters[PERF_HASH_LOOKUPS]));
+    json_buffer_printf(out, "%s  }", indent);
+}
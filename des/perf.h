@@ -0,0 +1,68 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Hot-Path Instrumentation
+// Off by default (--perf turns it on). Every probe is guarded by one
+// predictable branch on perf_enabled; when on, counters are process-wide
+// relaxed atomics, updated once per document or call rather than per
+// element where the code allows it. Stage times are summed over all
+// threads, so with --threads they can exceed the elapsed wall time.
+
+typedef enum PerfStage {
+    PERF_STAGE_INGEST,
+    PERF_STAGE_PREPROCESS,
+    PERF_STAGE_KGRAMS,
+    PERF_STAGE_SIMILARITY,
+    PERF_STAGE_PASSAGES,
+    PERF_STAGE_ALIGNMENT,
+    PERF_STAGE_COUNT
+} PerfStage;
+
+typedef enum PerfCounter {
+    PERF_DOCUMENTS,
+    PERF_INPUT_BYTES,
+    PERF_TOKENS,
+    PERF_STOPWORDS_DROPPED,
+    PERF_TRUNCATED_TOKENS,
+    PERF_TRUNCATED_BYTES,
+    PERF_KGRAMS,
+    PERF_HASH_SLOTS,
+    PERF_HASH_ENTRIES,
+    PERF_HASH_GROWS,
+    PERF_HASH_ADDS,
+    PERF_HASH_ADD_PROBES,
+    PERF_HASH_LOOKUPS,
+    PERF_HASH_LOOKUP_PROBES,
+    PERF_HASH_MAX_PROBE,
+    PERF_ARENA_ALLOCATIONS,
+    PERF_ARENA_BYTES,
+    PERF_ARENA_BLOCKS,
+    PERF_ARENA_BLOCKS_REUSED,
+    PERF_COMPARISONS,
+    PERF_PASSAGES,
+    PERF_CACHE_HITS,
+    PERF_CACHE_MISSES,
+    PERF_PAIRS_SIZE_PRUNED,
+    PERF_PAIRS_BOUND_PRUNED,
+    PERF_ALIGNED_REGIONS,
+    PERF_FUZZY_PASSAGES,
+    PERF_COUNTER_COUNT
+} PerfCounter;
+
+extern int perf_enabled;
+
+void perf_enable(void);
+uint64_t perf_now_ns(void);
+void perf_add(PerfCounter counter, uint64_t amount);
+void perf_max(PerfCounter counter, uint64_t value);
+void perf_stage(PerfStage stage, uint64_t start_ns);
+struct JsonBuffer;
+void write_json_perf(struct JsonBuffer* out, const char* indent);
+
+#define PERF_COUNT(counter, amount) \
+    do { if (perf_enabled) perf_add((counter), (uint64_t)(amount)); } while (0)
+
+#endif
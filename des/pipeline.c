@@ -0,0 +1,669 @@
+#define _DEFAULT_SOURCE
+#include "pipeline.h"
+#include "cache.h"
+#include "perf.h"
+#include "threadpool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#define PIPELINE_URING 1
+#endif
+
+typedef struct PipelineItem {
+    int index;
+    int failed;                // the file could not be read
+    int fingerprinted;         // finished by the cache in the tokenize stage
+    MappedFile file;           // contents, until tokenized
+    Document* doc;
+} PipelineItem;
+
+// Bounded FIFO of items. A pop waits while the queue is empty and any
+// producer is still running; NULL means the stream has ended.
+typedef struct ItemQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    PipelineItem** items;
+    int capacity;
+    int head;
+    int count;
+    int producers;
+    PipelineQueueStats* stats;
+} ItemQueue;
+
+typedef struct Pipeline {
+    const PipelineConfig* config;
+    const char** paths;
+    int path_count;
+    int next_path;             // claimed by reader threads
+    void* ring;                // the io_uring instance, when reads use one
+    ItemQueue queues[PIPELINE_STAGE_COUNT];  // queues[s] feeds stage s
+    PipelineStats* stats;
+} Pipeline;
+
+// Queues
+static void queue_init(ItemQueue* queue, int capacity, int producers, PipelineQueueStats* stats) {
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    queue->items = (PipelineItem**)malloc(capacity * sizeof(PipelineItem*));
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->producers = producers;
+    queue->stats = stats;
+    stats->capacity = capacity;
+}
+
+static void queue_destroy(ItemQueue* queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    free(queue->items);
+}
+
+// Adds the time spent waiting for room to *blocked_ns
+static void queue_push(ItemQueue* queue, PipelineItem* item, uint64_t* blocked_ns) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->capacity) {
+        uint64_t start = perf_now_ns();
+        while (queue->count == queue->capacity) {
+            pthread_cond_wait(&queue->not_full, &queue->lock);
+        }
+        *blocked_ns += perf_now_ns() - start;
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    PipelineQueueStats* stats = queue->stats;
+    if (queue->count > stats->max_depth) stats->max_depth = queue->count;
+    stats->depth_sum += queue->count;
+    stats->pushes++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Adds the time spent waiting for an item to *starved_ns
+static PipelineItem* queue_pop(ItemQueue* queue, uint64_t* starved_ns) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == 0 && queue->producers > 0) {
+        uint64_t start = perf_now_ns();
+        while (queue->count == 0 && queue->producers > 0) {
+            pthread_cond_wait(&queue->not_empty, &queue->lock);
+        }
+        *starved_ns += perf_now_ns() - start;
+    }
+    PipelineItem* item = NULL;
+    if (queue->count > 0) {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
+
+static void queue_producer_done(ItemQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    if (--queue->producers == 0) pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Folds one thread's totals into the stage's
+static void add_stage_stats(PipelineStageStats* total, const PipelineStageStats* local) {
+    __atomic_fetch_add(&total->items, local->items, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->busy_ns, local->busy_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->starved_ns, local->starved_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->blocked_ns, local->blocked_ns, __ATOMIC_RELAXED);
+}
+
+// Read Stage
+static void finish_read(Pipeline* pipeline, PipelineItem* item) {
+    __atomic_fetch_add(&pipeline->stats->bytes, (long)item->file.size, __ATOMIC_RELAXED);
+    if (perf_enabled) perf_add(PERF_INPUT_BYTES, item->file.size);
+}
+
+// Reads all of `fd` into file->heap with blocking reads. Returns 0 on success.
+static int read_whole_fd(int fd, size_t size_hint, MappedFile* file) {
+    size_t capacity = size_hint > 0 ? size_hint : 65536, length = 0;
+    char* data = (char*)malloc(capacity);
+    for (;;) {
+        if (length == capacity) {
+            capacity *= 2;
+            data = (char*)realloc(data, capacity);
+        }
+        ssize_t got = read(fd, data + length, capacity - length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            free(data);
+            return -1;
+        }
+        if (got == 0) break;
+        length += (size_t)got;
+    }
+    file->data = data;
+    file->size = length;
+    file->map = NULL;
+    file->heap = data;
+    return 0;
+}
+
+static PipelineItem* create_item(int index) {
+    PipelineItem* item = (PipelineItem*)calloc(1, sizeof(PipelineItem));
+    item->index = index;
+    item->file.data = "";
+    return item;
+}
+
+static void* reader_thread(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    PipelineStageStats local;
+    memset(&local, 0, sizeof(local));
+    for (;;) {
+        int i = __atomic_fetch_add(&pipeline->next_path, 1, __ATOMIC_RELAXED);
+        if (i >= pipeline->path_count) break;
+        PipelineItem* item = create_item(i);
+        uint64_t start = perf_now_ns();
+        int fd = open(pipeline->paths[i], O_RDONLY);
+        struct stat st;
+        size_t size_hint = fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ?
+                           (size_t)st.st_size + 1 : 0;
+        item->failed = fd < 0 || read_whole_fd(fd, size_hint, &item->file) != 0;
+        if (fd >= 0) close(fd);
+        local.busy_ns += perf_now_ns() - start;
+        if (perf_enabled) perf_stage(PERF_STAGE_INGEST, start);
+        finish_read(pipeline, item);
+        local.items++;
+        queue_push(&pipeline->queues[PIPELINE_TOKENIZE], item, &local.blocked_ns);
+    }
+    add_stage_stats(&pipeline->stats->stages[PIPELINE_READ], &local);
+    queue_producer_done(&pipeline->queues[PIPELINE_TOKENIZE]);
+    return NULL;
+}
+
+#ifdef PIPELINE_URING
+// io_uring, through the raw system calls: one submission and one
+// completion ring shared with the kernel, each read tagged with the slot
+// of the file it belongs to. Large files are read a chunk at a time.
+typedef struct Uring {
+    int fd;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned pending;          // prepared but not yet submitted
+} Uring;
+
+typedef struct UringRead {
+    PipelineItem* item;
+    int fd;
+    char* buffer;
+    size_t size;
+    size_t done;
+    uint64_t start;
+    int queued;                // has an SQE whose completion is not reaped yet
+} UringRead;
+
+static int uring_open(Uring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return -1;
+    // IORING_OP_READ arrived with the same kernel as this feature bit
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->cq_map = single ? ring->sq_map :
+                   mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd,
+                        IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = ring->cq_map == MAP_FAILED ? MAP_FAILED :
+                 (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_map != MAP_FAILED && !single) munmap(ring->cq_map, ring->cq_map_size);
+        munmap(ring->sq_map, ring->sq_map_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    char* sq = (char*)ring->sq_map;
+    char* cq = (char*)ring->cq_map;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void uring_close(Uring* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+}
+
+// Queues the next chunk of `read`; the caller keeps in-flight reads under
+// the ring size, so a slot is always free
+static void uring_prepare_read(Uring* ring, UringRead* read, unsigned slot) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    size_t length = read->size - read->done;
+    if (length > PIPELINE_READ_CHUNK) length = PIPELINE_READ_CHUNK;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = read->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(read->buffer + read->done);
+    sqe->len = (uint32_t)length;
+    sqe->off = read->done;
+    sqe->user_data = slot;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    read->queued = 1;
+}
+
+// Submits the prepared reads and waits for at least one completion
+static int uring_submit_and_wait(Uring* ring) {
+    for (;;) {
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 1,
+                                 IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted >= 0) {
+            ring->pending -= (unsigned)submitted;
+            return 0;
+        }
+        // Out of resources for now: reap what has completed and retry
+        if (errno == EAGAIN || errno == EBUSY) return 0;
+        if (errno != EINTR) return -1;
+    }
+}
+
+// Waits until every read the kernel has taken completes, crediting the
+// bytes each got; reads still waiting to be submitted never will be.
+// Returns -1 if the ring cannot even wait, when the kernel may yet write
+// into the buffers of queued reads.
+static int uring_drain(Uring* ring, UringRead* reads, int depth) {
+    for (;;) {
+        unsigned queued = 0;
+        for (int s = 0; s < depth; s++) queued += reads[s].item != NULL && reads[s].queued;
+        if (queued <= ring->pending) return 0;
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return -1;
+        }
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            UringRead* read = &reads[cqe->user_data];
+            read->queued = 0;
+            if (cqe->res > 0) read->done += (size_t)cqe->res;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+static void uring_finish(Pipeline* pipeline, UringRead* read, int failed,
+                         PipelineStageStats* local) {
+    PipelineItem* item = read->item;
+    close(read->fd);
+    item->failed = failed;
+    if (failed) {
+        free(read->buffer);
+    } else {
+        item->file.data = read->buffer;
+        item->file.size = read->done;
+        item->file.heap = read->buffer;
+    }
+    if (perf_enabled) perf_stage(PERF_STAGE_INGEST, read->start);
+    finish_read(pipeline, item);
+    local->items++;
+    queue_push(&pipeline->queues[PIPELINE_TOKENIZE], item, &local->blocked_ns);
+}
+
+// Keeps up to `depth` files in flight. Files that are not regular, and
+// every file after a ring failure, are read with blocking calls in place.
+static void* uring_reader_thread(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    Uring* ring = (Uring*)pipeline->ring;
+    PipelineStageStats local;
+    memset(&local, 0, sizeof(local));
+    int depth = pipeline->config->depth;
+    UringRead* reads = (UringRead*)calloc(depth, sizeof(UringRead));
+    unsigned* free_slots = (unsigned*)malloc(depth * sizeof(unsigned));
+    int free_count = depth;
+    for (int s = 0; s < depth; s++) free_slots[s] = (unsigned)(depth - 1 - s);
+
+    int in_flight = 0;
+    int broken = 0;            // the ring failed; read the rest in place
+    while (pipeline->next_path < pipeline->path_count || in_flight > 0) {
+        // Open files until the ring is full
+        uint64_t start = perf_now_ns();
+        while (in_flight < depth && pipeline->next_path < pipeline->path_count) {
+            PipelineItem* item = create_item(pipeline->next_path++);
+            uint64_t opened = perf_now_ns();
+            int fd = open(pipeline->paths[item->index], O_RDONLY);
+            struct stat st;
+            if (broken || fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+                st.st_size == 0) {
+                item->failed = fd < 0 || read_whole_fd(fd, 0, &item->file) != 0;
+                if (fd >= 0) close(fd);
+                if (perf_enabled) perf_stage(PERF_STAGE_INGEST, opened);
+                finish_read(pipeline, item);
+                local.items++;
+                local.busy_ns += perf_now_ns() - start;
+                queue_push(&pipeline->queues[PIPELINE_TOKENIZE], item, &local.blocked_ns);
+                start = perf_now_ns();
+                continue;
+            }
+            unsigned slot = free_slots[--free_count];
+            UringRead* read = &reads[slot];
+            read->item = item;
+            read->fd = fd;
+            read->size = (size_t)st.st_size;
+            read->done = 0;
+            read->buffer = (char*)malloc(read->size);
+            read->start = opened;
+            uring_prepare_read(ring, read, slot);
+            in_flight++;
+        }
+        if (in_flight == 0) {
+            local.busy_ns += perf_now_ns() - start;
+            continue;
+        }
+
+        if (uring_submit_and_wait(ring) != 0) {
+            // The ring is unusable; finish what is in flight the slow way.
+            // The kernel may still be reading into buffers it took, so wait
+            // for those first, and if that fails too, leave them to it and
+            // read into fresh ones.
+            int abandoned = uring_drain(ring, reads, depth) != 0;
+            for (int s = 0; s < depth && in_flight > 0; s++) {
+                UringRead* read = &reads[s];
+                if (read->item == NULL) continue;
+                if (abandoned && read->queued) {
+                    read->buffer = (char*)malloc(read->size);
+                    read->done = 0;
+                }
+                while (read->done < read->size) {
+                    ssize_t got = pread(read->fd, read->buffer + read->done,
+                                        read->size - read->done, (off_t)read->done);
+                    if (got < 0 && errno == EINTR) continue;
+                    if (got <= 0) break;
+                    read->done += (size_t)got;
+                }
+                uring_finish(pipeline, read, read->done < read->size, &local);
+                read->item = NULL;
+                free_slots[free_count++] = (unsigned)s;
+                in_flight--;
+            }
+            broken = 1;
+            continue;
+        }
+
+        // Reap completions; short reads continue from where they stopped
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            unsigned slot = (unsigned)cqe->user_data;
+            UringRead* read = &reads[slot];
+            read->queued = 0;
+            int result = cqe->res;
+            if (result == -EINTR || result == -EAGAIN) {
+                uring_prepare_read(ring, read, slot);
+                continue;
+            }
+            if (result > 0) read->done += (size_t)result;
+            if (result > 0 && read->done < read->size) {
+                uring_prepare_read(ring, read, slot);
+                continue;
+            }
+            // Complete, or cut short by an error or a file that shrank;
+            // hand the entry back first, as the push may block
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            local.busy_ns += perf_now_ns() - start;
+            uring_finish(pipeline, read, result < 0, &local);
+            start = perf_now_ns();
+            read->item = NULL;
+            free_slots[free_count++] = slot;
+            in_flight--;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        local.busy_ns += perf_now_ns() - start;
+    }
+    free(reads);
+    free(free_slots);
+    add_stage_stats(&pipeline->stats->stages[PIPELINE_READ], &local);
+    queue_producer_done(&pipeline->queues[PIPELINE_TOKENIZE]);
+    return NULL;
+}
+#endif
+
+// CPU Stages
+static void* tokenize_thread(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    const PipelineConfig* config = pipeline->config;
+    PipelineStageStats local;
+    memset(&local, 0, sizeof(local));
+    PipelineItem* item;
+    while ((item = queue_pop(&pipeline->queues[PIPELINE_TOKENIZE], &local.starved_ns)) != NULL) {
+        uint64_t start = perf_now_ns();
+        const char* path = pipeline->paths[item->index];
+        if (item->failed || item->file.size > MAX_DOCUMENT_BYTES) {
+            // Arrives at the sink as NULL
+        } else if (config->cache_dir != NULL) {
+            int hit;
+            item->doc = load_cached_buffer(config->cache_dir, path, item->file.data,
+                                           item->file.size, config->k, config->window, &hit);
+            item->fingerprinted = 1;
+            if (hit) __atomic_fetch_add(&pipeline->stats->cache_hits, 1, __ATOMIC_RELAXED);
+        } else {
+            item->doc = create_document(path);
+            preprocess_document_buffer(item->doc, item->file.data, item->file.size);
+        }
+        unmap_text_file(&item->file);
+        local.busy_ns += perf_now_ns() - start;
+        local.items++;
+        queue_push(&pipeline->queues[PIPELINE_FINGERPRINT], item, &local.blocked_ns);
+    }
+    add_stage_stats(&pipeline->stats->stages[PIPELINE_TOKENIZE], &local);
+    queue_producer_done(&pipeline->queues[PIPELINE_FINGERPRINT]);
+    return NULL;
+}
+
+static void* fingerprint_thread(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    PipelineStageStats local;
+    memset(&local, 0, sizeof(local));
+    PipelineItem* item;
+    while ((item = queue_pop(&pipeline->queues[PIPELINE_FINGERPRINT], &local.starved_ns)) != NULL) {
+        uint64_t start = perf_now_ns();
+        if (item->doc != NULL && !item->fingerprinted) {
+            generate_winnowed_kgrams(item->doc, pipeline->config->k, pipeline->config->window);
+        }
+        local.busy_ns += perf_now_ns() - start;
+        local.items++;
+        queue_push(&pipeline->queues[PIPELINE_SCORE], item, &local.blocked_ns);
+    }
+    add_stage_stats(&pipeline->stats->stages[PIPELINE_FINGERPRINT], &local);
+    queue_producer_done(&pipeline->queues[PIPELINE_SCORE]);
+    return NULL;
+}
+
+static void* score_thread(void* arg) {
+    Pipeline* pipeline = (Pipeline*)arg;
+    const PipelineConfig* config = pipeline->config;
+    PipelineStageStats local;
+    memset(&local, 0, sizeof(local));
+    PipelineItem* item;
+    while ((item = queue_pop(&pipeline->queues[PIPELINE_SCORE], &local.starved_ns)) != NULL) {
+        uint64_t start = perf_now_ns();
+        config->sink(config->sink_arg, item->index, item->doc);
+        free(item);
+        local.busy_ns += perf_now_ns() - start;
+        local.items++;
+    }
+    add_stage_stats(&pipeline->stats->stages[PIPELINE_SCORE], &local);
+    return NULL;
+}
+
+// Runs the pipeline over `paths` and returns once the sink has seen every
+// one of them. Fills *stats. Returns 0, or -1 if no thread could start.
+int run_pipeline(const PipelineConfig* config, const char** paths, int path_count,
+                 PipelineStats* stats) {
+    uint64_t start = perf_now_ns();
+    memset(stats, 0, sizeof(*stats));
+    Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.config = config;
+    pipeline.paths = paths;
+    pipeline.path_count = path_count;
+    pipeline.stats = stats;
+
+    int depth = config->depth > 0 ? config->depth : PIPELINE_DEFAULT_DEPTH;
+    int workers = config->workers > 0 ? config->workers : 1;
+    int readers = config->readers > 0 ? config->readers : PIPELINE_DEFAULT_READERS;
+    if (workers > THREAD_POOL_MAX_THREADS) workers = THREAD_POOL_MAX_THREADS;
+    if (readers > THREAD_POOL_MAX_THREADS) readers = THREAD_POOL_MAX_THREADS;
+    PipelineConfig resolved = *config;
+    resolved.depth = depth;
+    pipeline.config = &resolved;
+
+#ifdef PIPELINE_URING
+    Uring ring;
+    if (config->io == PIPELINE_IO_AUTO && uring_open(&ring, (unsigned)depth) == 0) {
+        pipeline.ring = &ring;
+        stats->uring = 1;
+        readers = 1;
+    }
+#endif
+    stats->threads[PIPELINE_READ] = readers;
+    stats->threads[PIPELINE_TOKENIZE] = workers;
+    stats->threads[PIPELINE_FINGERPRINT] = workers;
+    stats->threads[PIPELINE_SCORE] = workers;
+    for (int s = PIPELINE_TOKENIZE; s < PIPELINE_STAGE_COUNT; s++) {
+        queue_init(&pipeline.queues[s], depth, stats->threads[s - 1], &stats->queues[s]);
+    }
+
+    // Start from the end of the line so no stage waits on a missing consumer
+    int total = readers + 3 * workers;
+    pthread_t* threads = (pthread_t*)malloc(total * sizeof(pthread_t));
+    int started = 0;
+    void* (*stage_main[PIPELINE_STAGE_COUNT])(void*) = {
+        reader_thread, tokenize_thread, fingerprint_thread, score_thread
+    };
+#ifdef PIPELINE_URING
+    if (pipeline.ring != NULL) stage_main[PIPELINE_READ] = uring_reader_thread;
+#endif
+    int status = 0;
+    for (int s = PIPELINE_STAGE_COUNT - 1; s >= 0; s--) {
+        int stage_started = 0;
+        for (int t = 0; t < stats->threads[s]; t++) {
+            if (pthread_create(&threads[started], NULL, stage_main[s], &pipeline) == 0) {
+                started++;
+                stage_started++;
+            }
+        }
+        if (stage_started == 0) {
+            status = -1;
+            break;
+        }
+        if (s < PIPELINE_SCORE && stage_started < stats->threads[s]) {
+            // Producers that never started must not hold the next queue open
+            for (int t = stage_started; t < stats->threads[s]; t++) {
+                queue_producer_done(&pipeline.queues[s + 1]);
+            }
+        }
+        stats->threads[s] = stage_started;
+    }
+    if (status != 0) {
+        // Without a full line, drain what started by ending every stream
+        pipeline.next_path = path_count;
+        for (int s = PIPELINE_TOKENIZE; s < PIPELINE_STAGE_COUNT; s++) {
+            pthread_mutex_lock(&pipeline.queues[s].lock);
+            pipeline.queues[s].producers = 0;
+            pthread_cond_broadcast(&pipeline.queues[s].not_empty);
+            pthread_mutex_unlock(&pipeline.queues[s].lock);
+        }
+    }
+    for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+    free(threads);
+
+#ifdef PIPELINE_URING
+    if (pipeline.ring != NULL) uring_close(&ring);
+#endif
+    for (int s = PIPELINE_TOKENIZE; s < PIPELINE_STAGE_COUNT; s++) {
+        queue_destroy(&pipeline.queues[s]);
+    }
+    stats->seconds = (perf_now_ns() - start) / 1e9;
+    return status;
+}
+
+static void store_document(void* arg, int index, Document* doc) {
+    ((Document**)arg)[index] = doc;
+}
+
+// Runs the pipeline with a sink that stores document i in docs[i]; the
+// config's own sink is ignored
+int pipeline_load_documents(const PipelineConfig* config, const char** paths, int path_count,
+                            Document** docs, PipelineStats* stats) {
+    PipelineConfig load = *config;
+    load.sink = store_document;
+    load.sink_arg = docs;
+    return run_pipeline(&load, paths, path_count, stats);
+}
+
+void print_pipeline_stats(const PipelineStats* stats) {
+    static const char* names[PIPELINE_STAGE_COUNT] = { "read", "tokenize", "fingerprint", "score" };
+    printf("Pipeline: %ld documents, %.1f MB in %.2fs, reads via %s\n",
+           stats->stages[PIPELINE_READ].items, stats->bytes / 1e6, stats->seconds,
+           stats->uring ? "io_uring" : "reader threads");
+    printf("  %-12s %7s %8s %9s %10s %10s   %s\n", "stage", "threads", "items", "busy_s",
+           "starved_s", "blocked_s", "input queue max/mean/cap");
+    for (int s = 0; s < PIPELINE_STAGE_COUNT; s++) {
+        const PipelineStageStats* stage = &stats->stages[s];
+        printf("  %-12s %7d %8ld %9.3f %10.3f %10.3f", names[s], stats->threads[s], stage->items,
+               stage->busy_ns / 1e9, stage->starved_ns / 1e9, stage->blocked_ns / 1e9);
+        const PipelineQueueStats* queue = &stats->queues[s];
+        if (s > PIPELINE_READ) {
+            printf("   %d/%.1f/%d", queue->max_depth,
+                   queue->pushes > 0 ? (double)queue->depth_sum / queue->pushes : 0.0,
+                   queue->capacity);
+        }
+        printf("\n");
+    }
+}
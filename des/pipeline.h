@@ -0,0 +1,89 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "plagiarism.h"
+
+#include <pthread.h>
+
+#define PIPELINE_DEFAULT_DEPTH 64
+#define PIPELINE_DEFAULT_READERS 4
+#define PIPELINE_READ_CHUNK (1024 * 1024)
+
+// Ingestion Pipeline
+// Documents flow through four stages joined by bounded queues:
+//
+//   read -> tokenize -> fingerprint -> score
+//
+// The read stage fetches whole files into memory, with io_uring keeping up
+// to `depth` reads in flight from one thread where the kernel allows it,
+// or with a pool of blocking reader threads otherwise. The CPU stages each
+// run `workers` threads. A full queue blocks its producer and an empty one
+// its consumer, so at most a few queues' worth of documents are in memory
+// and a slow disk and a busy CPU overlap instead of taking turns.
+// Documents arrive at the sink in completion order, tagged with their
+// index in `paths`; an unreadable one arrives as NULL. With a cache, the
+// tokenize stage answers hits and fingerprints misses itself, and the
+// fingerprint stage passes them through.
+
+typedef enum PipelineStage {
+    PIPELINE_READ,
+    PIPELINE_TOKENIZE,
+    PIPELINE_FINGERPRINT,
+    PIPELINE_SCORE,
+    PIPELINE_STAGE_COUNT
+} PipelineStage;
+
+typedef enum PipelineIo {
+    PIPELINE_IO_AUTO,          // io_uring when available, else reader threads
+    PIPELINE_IO_THREADS
+} PipelineIo;
+
+// Called by the score stage once per path; owns `doc`
+typedef void (*PipelineSink)(void* arg, int index, Document* doc);
+
+typedef struct PipelineConfig {
+    int k;
+    int window;
+    int workers;               // threads per CPU stage
+    int readers;               // reader threads without io_uring
+    int depth;                 // queue capacity and reads in flight
+    PipelineIo io;
+    const char* cache_dir;     // NULL fingerprints every document
+    PipelineSink sink;
+    void* sink_arg;
+} PipelineConfig;
+
+// Starved is time spent waiting on an empty input queue, blocked time
+// waiting on a full output queue; both are summed over a stage's threads
+typedef struct PipelineStageStats {
+    long items;
+    uint64_t busy_ns;
+    uint64_t starved_ns;
+    uint64_t blocked_ns;
+} PipelineStageStats;
+
+// The queue feeding each stage after the first
+typedef struct PipelineQueueStats {
+    int capacity;
+    int max_depth;
+    uint64_t depth_sum;        // depth seen by each push, for the mean
+    long pushes;
+} PipelineQueueStats;
+
+typedef struct PipelineStats {
+    int uring;                 // reads went through io_uring
+    int threads[PIPELINE_STAGE_COUNT];
+    int cache_hits;
+    long bytes;
+    double seconds;
+    PipelineStageStats stages[PIPELINE_STAGE_COUNT];
+    PipelineQueueStats queues[PIPELINE_STAGE_COUNT];
+} PipelineStats;
+
+int run_pipeline(const PipelineConfig* config, const char** paths, int path_count,
+                 PipelineStats* stats);
+int pipeline_load_documents(const PipelineConfig* config, const char** paths, int path_count,
+                            Document** docs, PipelineStats* stats);
+void print_pipeline_stats(const PipelineStats* stats);
+
+#endif
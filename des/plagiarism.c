@@ -1,102 +1,510 @@
+#define _POSIX_C_SOURCE 200809L
 #include "plagiarism.h"
+#include "normalize.h"
+#include "perf.h"
+#include "tokenize.h"
 
-// Linked List Implementation
-LinkedList* create_linked_list() {
-    LinkedList* list = (LinkedList*)malloc(sizeof(LinkedList));
-    list->head = list->tail = NULL;
-    list->size = 0;
-    return list;
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Hash Set Implementation for K-grams
+static int kgram_exact_mode = 0;
+
+void set_kgram_exact_mode(int enabled) {
+    kgram_exact_mode = enabled;
 }
 
-void list_add(LinkedList* list, const char* token) {
-    TokenNode* newNode = (TokenNode*)malloc(sizeof(TokenNode));
-    strncpy(newNode->token, token, MAX_TOKEN_LENGTH - 1);
-    newNode->token[MAX_TOKEN_LENGTH - 1] = '\0';
-    newNode->next = NULL;
-    
-    if (list->tail == NULL) {
-        list->head = list->tail = newNode;
-    } else {
-        list->tail->next = newNode;
-        list->tail = newNode;
-    }
-    list->size++;
+int get_kgram_exact_mode(void) {
+    return kgram_exact_mode;
+}
+
+static int round_up_pow2(int n) {
+    int size = 16;
+    while (size < n) size <<= 1;
+    return size;
+}
+
+// Table storage comes from the set's arena when it has one
+static void* set_alloc(HashSet* set, size_t bytes) {
+    return set->arena != NULL ? arena_alloc(set->arena, bytes) : malloc(bytes);
 }
 
-void free_list(LinkedList* list) {
-    TokenNode* current = list->head;
-    while (current != NULL) {
-        TokenNode* next = current->next;
-        free(current);
-        current = next;
+static void* set_calloc(HashSet* set, size_t count, size_t size) {
+    return set->arena != NULL ? arena_calloc(set->arena, count, size) : calloc(count, size);
+}
+
+static void set_free(HashSet* set, void* ptr) {
+    if (set->arena != NULL) {
+        arena_free(set->arena, ptr);
+    } else {
+        free(ptr);
     }
-    free(list);
 }
 
-// Hash Set Implementation for K-grams
-HashSet* create_hash_set(int size) {
-    HashSet* set = (HashSet*)malloc(sizeof(HashSet));
-    set->size = size;
+HashSet* create_arena_hash_set(Arena* arena, int size, int exact) {
+    HashSet* set = arena != NULL ? (HashSet*)arena_alloc(arena, sizeof(HashSet))
+                                 : (HashSet*)malloc(sizeof(HashSet));
+    set->arena = arena;
+    set->size = round_up_pow2(size);
     set->count = 0;
-    set->table = (KGram**)calloc(size, sizeof(KGram*));
+    set->exact = exact;
+    set->key_width = 0;
+    set->slots = (uint64_t*)set_calloc(set, set->size, sizeof(uint64_t));
+    set->keys = NULL;
+    set->sorted = NULL;
+    set->sorted_valid = 0;
+    set->add_probes = 0;
+    set->adds = 0;
+    set->max_probe = 0;
     return set;
 }
 
-unsigned int hash_function(const char* str) {
-    unsigned int hash = 5381;
+HashSet* create_hash_set(int size) {
+    return create_arena_hash_set(NULL, size, 0);
+}
+
+// The key width (k) is fixed by the first k-gram added
+HashSet* create_exact_hash_set(int size) {
+    return create_arena_hash_set(NULL, size, 1);
+}
+
+// Token Dictionary
+// Map from token text to a dense 32-bit ID, shared by every document that
+// interns into it so that IDs compare across those documents. Documents
+// use the process-wide dictionary unless they name their own (the library
+// gives each corpus one). Interning takes the lock once per document
+// rather than once per token.
+typedef struct DictionaryEntry {
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t length;
+} DictionaryEntry;
+
+struct TokenDictionary {
+    pthread_mutex_t lock;
+    uint32_t* slots;            // entry ID + 1, 0 = empty
+    int size;
+    DictionaryEntry* entries;
+    int count;
+    int capacity;
+    char* pool;
+    size_t pool_used;
+    size_t pool_capacity;
+};
+
+static TokenDictionary process_dictionary = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, NULL, 0, 0,
+                                              NULL, 0, 0 };
+
+TokenDictionary* create_token_dictionary(void) {
+    TokenDictionary* dictionary = (TokenDictionary*)calloc(1, sizeof(TokenDictionary));
+    if (dictionary != NULL) pthread_mutex_init(&dictionary->lock, NULL);
+    return dictionary;
+}
+
+void free_token_dictionary(TokenDictionary* dictionary) {
+    if (dictionary == NULL || dictionary == &process_dictionary) return;
+    pthread_mutex_destroy(&dictionary->lock);
+    free(dictionary->slots);
+    free(dictionary->entries);
+    free(dictionary->pool);
+    free(dictionary);
+}
+
+static int dictionary_find_slot(const TokenDictionary* dictionary, const char* token,
+                                size_t length, uint64_t hash) {
+    unsigned int mask = (unsigned int)dictionary->size - 1;
+    unsigned int index = (unsigned int)fingerprint_mix(hash) & mask;
+    while (dictionary->slots[index] != 0) {
+        const DictionaryEntry* entry = &dictionary->entries[dictionary->slots[index] - 1];
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(dictionary->pool + entry->offset, token, length) == 0) {
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+    return (int)index;
+}
+
+static void dictionary_grow(TokenDictionary* dictionary) {
+    uint32_t* old_slots = dictionary->slots;
+    int old_size = dictionary->size;
+
+    dictionary->size = old_size ? old_size * 2 : 4096;
+    dictionary->slots = (uint32_t*)calloc(dictionary->size, sizeof(uint32_t));
+    unsigned int mask = (unsigned int)dictionary->size - 1;
+    for (int i = 0; i < old_size; i++) {
+        if (old_slots[i] == 0) continue;
+        unsigned int index = (unsigned int)fingerprint_mix(dictionary->entries[old_slots[i] - 1].hash) & mask;
+        while (dictionary->slots[index] != 0) {
+            index = (index + 1) & mask;
+        }
+        dictionary->slots[index] = old_slots[i];
+    }
+    free(old_slots);
+}
+
+// Caller holds dictionary->lock
+static uint32_t dictionary_intern_locked(TokenDictionary* dictionary, const char* token,
+                                         size_t length) {
+    if ((dictionary->count + 1) > dictionary->size * HASH_SET_MAX_LOAD) {
+        dictionary_grow(dictionary);
+    }
+
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint64_t)(unsigned char)token[i];
+        hash *= 1099511628211ULL;
+    }
+
+    int index = dictionary_find_slot(dictionary, token, length, hash);
+    if (dictionary->slots[index] != 0) {
+        return dictionary->slots[index] - 1;
+    }
+
+    if (dictionary->count == dictionary->capacity) {
+        dictionary->capacity = dictionary->capacity ? dictionary->capacity * 2 : 4096;
+        dictionary->entries = (DictionaryEntry*)realloc(dictionary->entries,
+                                                        dictionary->capacity * sizeof(DictionaryEntry));
+    }
+    while (dictionary->pool_used + length + 1 > dictionary->pool_capacity) {
+        dictionary->pool_capacity = dictionary->pool_capacity ? dictionary->pool_capacity * 2 : 65536;
+        dictionary->pool = (char*)realloc(dictionary->pool, dictionary->pool_capacity);
+    }
+    memcpy(dictionary->pool + dictionary->pool_used, token, length);
+    dictionary->pool[dictionary->pool_used + length] = '\0';
+
+    DictionaryEntry* entry = &dictionary->entries[dictionary->count];
+    entry->hash = hash;
+    entry->offset = (uint32_t)dictionary->pool_used;
+    entry->length = (uint32_t)length;
+    dictionary->pool_used += length + 1;
+    dictionary->slots[index] = (uint32_t)dictionary->count + 1;
+    return (uint32_t)dictionary->count++;
+}
+
+uint32_t dictionary_intern(const char* token) {
+    pthread_mutex_lock(&process_dictionary.lock);
+    uint32_t id = dictionary_intern_locked(&process_dictionary, token, strlen(token));
+    pthread_mutex_unlock(&process_dictionary.lock);
+    return id;
+}
+
+int dictionary_size(void) {
+    pthread_mutex_lock(&process_dictionary.lock);
+    int count = process_dictionary.count;
+    pthread_mutex_unlock(&process_dictionary.lock);
+    return count;
+}
+
+static void intern_document_tokens(Document* doc) {
+    TokenDictionary* dictionary = doc->dictionary != NULL ? doc->dictionary : &process_dictionary;
+    doc->token_ids = (uint32_t*)arena_alloc(&doc->arena, doc->token_count * sizeof(uint32_t));
+    pthread_mutex_lock(&dictionary->lock);
+    for (int i = 0; i < doc->token_count; i++) {
+        doc->token_ids[i] = dictionary_intern_locked(dictionary, document_token(doc, i),
+                                                     doc->tokens[i].length);
+    }
+    pthread_mutex_unlock(&dictionary->lock);
+}
+
+// Splits a space-separated k-gram into token IDs. Returns the number of
+// tokens, or -1 if there are more than KGRAM_MAX_LENGTH.
+static int kgram_to_ids(const char* kgram, uint32_t* ids) {
+    int width = 0;
+    while (*kgram) {
+        while (*kgram == ' ') kgram++;
+        if (*kgram == '\0') break;
+        const char* end = kgram;
+        while (*end && *end != ' ') end++;
+        if (width == KGRAM_MAX_LENGTH) return -1;
+        pthread_mutex_lock(&process_dictionary.lock);
+        ids[width++] = dictionary_intern_locked(&process_dictionary, kgram, (size_t)(end - kgram));
+        pthread_mutex_unlock(&process_dictionary.lock);
+        kgram = end;
+    }
+    return width;
+}
+
+// FNV-1a hash of a single token
+uint64_t token_hash(const char* token) {
+    uint64_t hash = 1469598103934665603ULL;
     int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c;
+    while ((c = (unsigned char)*token++)) {
+        hash ^= (uint64_t)c;
+        hash *= 1099511628211ULL;
     }
-    return hash % HASH_TABLE_SIZE;
+    return hash;
 }
 
-void hash_set_add(HashSet* set, const char* kgram) {
-    unsigned int index = hash_function(kgram);
-    
-    // Check if already exists
-    KGram* current = set->table[index];
-    while (current != NULL) {
-        if (strcmp(current->gram, kgram) == 0) {
-            return; // Already exists
+// 64-bit finalizer so the low bits are usable as a table index regardless
+// of the table size. It is a bijection, so it never merges fingerprints.
+uint64_t fingerprint_mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash ? hash : 1;
+}
+
+// Fingerprint of a space-separated k-gram. It is the same polynomial over
+// token hashes that generate_kgrams rolls along the token stream, so both
+// paths agree on every k-gram.
+uint64_t hash_function(const char* str) {
+    uint64_t hash = 0;
+    uint64_t token = 1469598103934665603ULL;
+    int length = 0;
+
+    for (;; str++) {
+        if (*str == ' ' || *str == '\0') {
+            if (length > 0) {
+                hash = hash * KGRAM_HASH_BASE + token;
+                token = 1469598103934665603ULL;
+                length = 0;
+            }
+            if (*str == '\0') break;
+        } else {
+            token ^= (uint64_t)(unsigned char)*str;
+            token *= 1099511628211ULL;
+            length++;
         }
-        current = current->next;
     }
-    
-    // Add new k-gram
-    KGram* newKGram = (KGram*)malloc(sizeof(KGram));
-    strncpy(newKGram->gram, kgram, MAX_TOKEN_LENGTH * 10 - 1);
-    newKGram->gram[MAX_TOKEN_LENGTH * 10 - 1] = '\0';
-    newKGram->hash = index;
-    newKGram->next = set->table[index];
-    set->table[index] = newKGram;
+    return fingerprint_mix(hash);
+}
+
+// Packed key comparison, unrolled per k so the common widths compile to a
+// few fixed-size compares instead of a generic loop
+static inline int keys_equal(const uint32_t* a, const uint32_t* b, int width) {
+    switch (width) {
+        case 2: return memcmp(a, b, 2 * sizeof(uint32_t)) == 0;
+        case 3: return memcmp(a, b, 3 * sizeof(uint32_t)) == 0;
+        case 4: return memcmp(a, b, 4 * sizeof(uint32_t)) == 0;
+        case 5: return memcmp(a, b, 5 * sizeof(uint32_t)) == 0;
+        case 6: return memcmp(a, b, 6 * sizeof(uint32_t)) == 0;
+        case 7: return memcmp(a, b, 7 * sizeof(uint32_t)) == 0;
+        case 8: return memcmp(a, b, 8 * sizeof(uint32_t)) == 0;
+        case 9: return memcmp(a, b, 9 * sizeof(uint32_t)) == 0;
+        case 10: return memcmp(a, b, 10 * sizeof(uint32_t)) == 0;
+        default: return memcmp(a, b, width * sizeof(uint32_t)) == 0;
+    }
+}
+
+// Slots visited to reach `index` from the fingerprint's home slot
+static inline int probe_length(const HashSet* set, int index, uint64_t fingerprint) {
+    return (int)(((unsigned int)index - (unsigned int)fingerprint) & (unsigned int)(set->size - 1)) + 1;
+}
+
+static inline void note_add_probe(HashSet* set, int index, uint64_t fingerprint) {
+    if (!perf_enabled) return;
+    int probe = probe_length(set, index, fingerprint);
+    set->add_probes += probe;
+    set->adds++;
+    if (probe > set->max_probe) set->max_probe = probe;
+}
+
+// Returns the slot holding the entry, or the empty slot where it belongs.
+// With a key, a fingerprint match also needs identical token IDs.
+static int hash_set_find_slot(HashSet* set, uint64_t fingerprint, const uint32_t* key) {
+    unsigned int mask = (unsigned int)set->size - 1;
+    unsigned int index = (unsigned int)fingerprint & mask;
+
+    while (set->slots[index] != 0) {
+        if (set->slots[index] == fingerprint &&
+            (key == NULL || keys_equal(set->keys + (size_t)index * set->key_width, key, set->key_width))) {
+            return (int)index;
+        }
+        index = (index + 1) & mask;
+    }
+    return (int)index;
+}
+
+static void hash_set_resize(HashSet* set, int size) {
+    uint64_t* old_slots = set->slots;
+    uint32_t* old_keys = set->keys;
+    int old_size = set->size;
+    int width = set->key_width;
+    PERF_COUNT(PERF_HASH_GROWS, 1);
+
+    set->size = size;
+    set->slots = (uint64_t*)set_calloc(set, set->size, sizeof(uint64_t));
+    if (old_keys != NULL) {
+        set->keys = (uint32_t*)set_alloc(set, (size_t)set->size * width * sizeof(uint32_t));
+    }
+
+    unsigned int mask = (unsigned int)set->size - 1;
+    for (int i = 0; i < old_size; i++) {
+        if (old_slots[i] == 0) continue;
+        unsigned int index = (unsigned int)old_slots[i] & mask;
+        while (set->slots[index] != 0) {
+            index = (index + 1) & mask;
+        }
+        set->slots[index] = old_slots[i];
+        if (old_keys != NULL) {
+            memcpy(set->keys + (size_t)index * width, old_keys + (size_t)i * width,
+                   width * sizeof(uint32_t));
+        }
+    }
+    set_free(set, old_slots);
+    set_free(set, old_keys);
+}
+
+static void hash_set_grow(HashSet* set) {
+    hash_set_resize(set, set->size * 2);
+}
+
+// Adds a k-gram by fingerprint and, for exact sets, its packed token IDs
+void hash_set_add_key(HashSet* set, uint64_t fingerprint, const uint32_t* key, int width) {
+    if (!set->exact) {
+        hash_set_add_fingerprint(set, fingerprint);
+        return;
+    }
+    if (set->keys == NULL) {
+        set->key_width = width;
+        set->keys = (uint32_t*)set_alloc(set, (size_t)set->size * width * sizeof(uint32_t));
+    }
+    if (width != set->key_width) return;
+    if ((set->count + 1) > set->size * HASH_SET_MAX_LOAD) {
+        hash_set_grow(set);
+    }
+
+    int index = hash_set_find_slot(set, fingerprint, key);
+    note_add_probe(set, index, fingerprint);
+    if (set->slots[index] != 0) {
+        return; // Already exists
+    }
+    memcpy(set->keys + (size_t)index * width, key, width * sizeof(uint32_t));
+    set->slots[index] = fingerprint;
     set->count++;
+    set->sorted_valid = 0;
+}
+
+void hash_set_add(HashSet* set, const char* kgram) {
+    uint32_t ids[KGRAM_MAX_LENGTH];
+    int width = set->exact ? kgram_to_ids(kgram, ids) : 0;
+    if (width < 0) return;
+    hash_set_add_key(set, hash_function(kgram), ids, width);
+}
+
+void hash_set_add_fingerprint(HashSet* set, uint64_t fingerprint) {
+    if ((set->count + 1) > set->size * HASH_SET_MAX_LOAD) {
+        hash_set_grow(set);
+    }
+
+    int index = hash_set_find_slot(set, fingerprint, NULL);
+    note_add_probe(set, index, fingerprint);
+    if (set->slots[index] == 0) {
+        set->slots[index] = fingerprint;
+        set->count++;
+        set->sorted_valid = 0;
+    }
 }
 
 int hash_set_contains(HashSet* set, const char* kgram) {
-    unsigned int index = hash_function(kgram);
-    KGram* current = set->table[index];
-    
-    while (current != NULL) {
-        if (strcmp(current->gram, kgram) == 0) {
-            return 1;
+    uint32_t ids[KGRAM_MAX_LENGTH];
+    const uint32_t* key = NULL;
+    if (set->exact) {
+        if (kgram_to_ids(kgram, ids) != set->key_width) return 0;
+        key = ids;
+    }
+    uint64_t fingerprint = hash_function(kgram);
+    int index = hash_set_find_slot(set, fingerprint, key);
+    if (perf_enabled) {
+        perf_add(PERF_HASH_LOOKUPS, 1);
+        perf_add(PERF_HASH_LOOKUP_PROBES, (uint64_t)probe_length(set, index, fingerprint));
+    }
+    return set->slots[index] != 0;
+}
+
+int hash_set_contains_fingerprint(HashSet* set, uint64_t fingerprint) {
+    if (fingerprint == 0) fingerprint = 1;
+    int index = hash_set_find_slot(set, fingerprint, NULL);
+    if (perf_enabled) {
+        perf_add(PERF_HASH_LOOKUPS, 1);
+        perf_add(PERF_HASH_LOOKUP_PROBES, (uint64_t)probe_length(set, index, fingerprint));
+    }
+    return set->slots[index] != 0;
+}
+
+// LSD radix sort, one byte per pass; passes where every key shares the
+// same byte are skipped.
+void radix_sort_u64(uint64_t* keys, uint64_t* scratch, int n) {
+    uint64_t* src = keys;
+    uint64_t* dst = scratch;
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        int counts[256] = {0};
+        for (int i = 0; i < n; i++) {
+            counts[(src[i] >> shift) & 0xff]++;
         }
-        current = current->next;
+        if (counts[(src[0] >> shift) & 0xff] == n) continue;
+
+        int offset = 0;
+        for (int b = 0; b < 256; b++) {
+            int c = counts[b];
+            counts[b] = offset;
+            offset += c;
+        }
+        for (int i = 0; i < n; i++) {
+            dst[counts[(src[i] >> shift) & 0xff]++] = src[i];
+        }
+        uint64_t* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != keys) {
+        memcpy(keys, src, n * sizeof(uint64_t));
     }
-    return 0;
+}
+
+const uint64_t* hash_set_sorted_fingerprints(HashSet* set) {
+    if (set->sorted_valid) return set->sorted;
+
+    set_free(set, set->sorted);
+    set->sorted = (uint64_t*)set_alloc(set, (set->count > 0 ? set->count : 1) * sizeof(uint64_t));
+    int n = 0;
+    for (int i = 0; i < set->size; i++) {
+        if (set->slots[i] != 0) {
+            set->sorted[n++] = set->slots[i];
+        }
+    }
+    if (n > 1) {
+        uint64_t* scratch = (uint64_t*)malloc(n * sizeof(uint64_t));
+        radix_sort_u64(set->sorted, scratch, n);
+        free(scratch);
+    }
+    set->sorted_valid = 1;
+    return set->sorted;
 }
 
 int hash_set_intersection_size(HashSet* set1, HashSet* set2) {
     int intersection = 0;
-    
+    int verify = set1->exact && set2->exact && set1->keys != NULL && set2->keys != NULL;
+    if (verify && set1->key_width != set2->key_width) return 0;
+
+    // Probe the larger set with the members of the smaller one
+    if (set1->count > set2->count) {
+        HashSet* tmp = set1;
+        set1 = set2;
+        set2 = tmp;
+    }
+
+    uint64_t probes = 0;
     for (int i = 0; i < set1->size; i++) {
-        KGram* current = set1->table[i];
-        while (current != NULL) {
-            if (hash_set_contains(set2, current->gram)) {
-                intersection++;
-            }
-            current = current->next;
+        if (set1->slots[i] == 0) continue;
+        int index = hash_set_find_slot(set2, set1->slots[i],
+                                       verify ? set1->keys + (size_t)i * set1->key_width : NULL);
+        if (set2->slots[index] != 0) {
+            intersection++;
         }
+        if (perf_enabled) probes += probe_length(set2, index, set1->slots[i]);
+    }
+    if (perf_enabled) {
+        perf_add(PERF_HASH_LOOKUPS, (uint64_t)set1->count);
+        perf_add(PERF_HASH_LOOKUP_PROBES, probes);
     }
     return intersection;
 }
@@ -106,114 +514,583 @@ int hash_set_union_size(HashSet* set1, HashSet* set2) {
 }
 
 void free_hash_set(HashSet* set) {
-    for (int i = 0; i < set->size; i++) {
-        KGram* current = set->table[i];
-        while (current != NULL) {
-            KGram* next = current->next;
-            free(current);
-            current = next;
-        }
-    }
-    free(set->table);
+    if (set->arena != NULL) return;
+    free(set->slots);
+    free(set->keys);
+    free(set->sorted);
     free(set);
 }
 
 // Document Management
 Document* create_document(const char* filename) {
-    Document* doc = (Document*)malloc(sizeof(Document));
+    return create_document_with(filename, NULL);
+}
+
+// Like create_document, with every block of the document's arena taken
+// from `allocator`, which must outlive the document
+Document* create_document_with(const char* filename, const ArenaAllocator* allocator) {
+    Arena arena;
+    arena_init_with(&arena, allocator);
+    Document* doc = (Document*)arena_alloc(&arena, sizeof(Document));
+    doc->arena = arena;
     strncpy(doc->filename, filename, MAX_FILENAME_LENGTH - 1);
     doc->filename[MAX_FILENAME_LENGTH - 1] = '\0';
-    doc->tokens = create_linked_list();
-    doc->kgrams = create_hash_set(HASH_TABLE_SIZE);
+    doc->tokens = NULL;
+    doc->token_text = NULL;
+    doc->token_ids = NULL;
+    doc->kgrams = create_arena_hash_set(&doc->arena, HASH_TABLE_SIZE, kgram_exact_mode);
     doc->token_count = 0;
     doc->kgram_count = 0;
+    doc->k = 0;
+    doc->window = 1;
+    doc->tokens_pending = 0;
+    doc->source_hash[0] = 0;
+    doc->source_hash[1] = 0;
+    pthread_mutex_init(&doc->tokens_lock, NULL);
+    doc->kgram_counts = NULL;
+    doc->tfidf_weights = NULL;
+    doc->tfidf_norm = 0.0;
+    doc->dictionary = NULL;
+    for (int i = 0; i <= KGRAM_MAX_LENGTH; i++) {
+        doc->kgrams_by_k[i] = NULL;
+    }
+    for (int i = 0; i < MINHASH_SIZE; i++) {
+        doc->minhash[i] = UINT64_MAX;
+    }
     return doc;
 }
 
-void preprocess_document(Document* doc, const char* text) {
-    char buffer[MAX_TOKEN_LENGTH];
-    int buffer_index = 0;
-    char processed_text[MAX_STRING_LENGTH];
+// Maps, tokenizes and fingerprints a file. Returns NULL if it cannot be read.
+Document* load_document(const char* path, int k, int window) {
+    uint64_t start = perf_enabled ? perf_now_ns() : 0;
+    MappedFile file;
+    if (map_text_file(path, &file) != 0) return NULL;
+    if (perf_enabled) {
+        perf_stage(PERF_STAGE_INGEST, start);
+        perf_add(PERF_INPUT_BYTES, file.size);
+    }
     
-    // Preprocess the entire text
-    strncpy(processed_text, text, MAX_STRING_LENGTH - 1);
-    processed_text[MAX_STRING_LENGTH - 1] = '\0';
-    to_lowercase(processed_text);
-    remove_punctuation(processed_text);
+    Document* doc = create_document(path);
+    preprocess_document_buffer(doc, file.data, file.size);
     
-    // Tokenize
-    for (int i = 0; processed_text[i] && doc->token_count < MAX_TOKENS; i++) {
-        if (isspace(processed_text[i])) {
-            if (buffer_index > 0) {
-                buffer[buffer_index] = '\0';
-                if (!is_stopword(buffer)) {
-                    list_add(doc->tokens, buffer);
-                    doc->token_count++;
-                }
-                buffer_index = 0;
-            }
+    start = perf_enabled ? perf_now_ns() : 0;
+    unmap_text_file(&file);
+    if (perf_enabled) perf_stage(PERF_STAGE_INGEST, start);
+    
+    generate_winnowed_kgrams(doc, k, window);
+    return doc;
+}
+
+void preprocess_document(Document* doc, const char* text) {
+    preprocess_document_buffer(doc, text, strlen(text));
+}
+
+// Tokenizer state while one buffer is split into doc's tokens
+typedef struct Tokenizer {
+    Document* doc;
+    int capacity;
+    size_t used;
+    size_t token_start;
+    int token_length;
+    size_t source_start;
+    size_t source_end;
+    int dropped;
+    int truncated_tokens;
+    size_t truncated_bytes;
+    size_t token_truncated_bytes;
+} Tokenizer;
+
+static void begin_token_at(Tokenizer* t, size_t source) {
+    if (t->token_length == 0) {
+        t->token_start = t->used;
+        t->source_start = source;
+    }
+}
+
+// Appends `n` folded ASCII letters that start at byte `source` of the input
+static void append_token_run(Tokenizer* t, const unsigned char* bytes, int n, size_t source) {
+    begin_token_at(t, source);
+    int room = MAX_TOKEN_LENGTH - 1 - t->token_length;
+    int copied = n < room ? n : room;
+    memcpy(t->doc->token_text + t->used + t->token_length, bytes, copied);
+    t->token_length += copied;
+    t->token_truncated_bytes += (size_t)(n - copied);
+    t->source_end = source + n;
+}
+
+// Appends one folded character whole, or counts it as cut off
+static void append_token_char(Tokenizer* t, const char* bytes, int n, size_t source, int consumed) {
+    begin_token_at(t, source);
+    if (t->token_length + n <= MAX_TOKEN_LENGTH - 1) {
+        memcpy(t->doc->token_text + t->used + t->token_length, bytes, n);
+        t->token_length += n;
+    } else {
+        t->token_truncated_bytes += (size_t)n;
+    }
+    t->source_end = source + consumed;
+}
+
+static void finish_token(Tokenizer* t) {
+    if (t->token_length == 0) return;
+    Document* doc = t->doc;
+    doc->token_text[t->used + t->token_length] = '\0';
+    size_t normalized_length = (size_t)t->token_length;
+    if (normalize_token(doc->token_text + t->token_start, &normalized_length)) {
+        if (doc->token_count == t->capacity) {
+            doc->tokens = (Token*)arena_realloc(&doc->arena, doc->tokens,
+                                                t->capacity * sizeof(Token),
+                                                t->capacity * 2 * sizeof(Token));
+            t->capacity *= 2;
+        }
+        Token* token = &doc->tokens[doc->token_count++];
+        token->offset = (uint32_t)t->token_start;
+        token->length = (uint32_t)normalized_length;
+        token->source_offset = (uint32_t)t->source_start;
+        token->source_length = (uint32_t)(t->source_end - t->source_start);
+        t->used += normalized_length + 1;
+    } else {
+        t->dropped++;
+    }
+    t->truncated_tokens += t->token_truncated_bytes > 0;
+    t->truncated_bytes += t->token_truncated_bytes;
+    t->token_truncated_bytes = 0;
+    t->token_length = 0;
+}
+
+// Walks a classified ASCII block run by run: a run of spaces ends the
+// current token, a run of letters is copied in one go
+static void tokenize_block(Tokenizer* t, const TokenBlock* block, size_t offset) {
+    uint64_t pending = block->letters | block->spaces;
+    while (pending != 0) {
+        int pos = __builtin_ctzll(pending);
+        int n;
+        if ((block->spaces >> pos) & 1) {
+            finish_token(t);
+            n = __builtin_ctzll(~(block->spaces >> pos));
         } else {
-            if (buffer_index < MAX_TOKEN_LENGTH - 1) {
-                buffer[buffer_index++] = processed_text[i];
-            }
+            n = __builtin_ctzll(~(block->letters >> pos));
+            append_token_run(t, block->folded + pos, n, offset + pos);
         }
+        pending &= ~((1ULL << (pos + n)) - 1);
     }
+}
+
+// Lowercases, strips punctuation and splits on whitespace in one pass over
+// `text`, which need not be NUL-terminated (it may be a mapped file), then
+// passes each token through the normalization stage (stopwords, stemming).
+// Pure ASCII stretches are classified and case-folded TOKENIZE_BLOCK bytes
+// at a time with SIMD; anything else goes character by character through
+// the UTF-8 rules of tokenize.h. Token characters are copied into
+// doc->token_text; each token keeps the byte range it spans in `text`.
+// Words longer than MAX_TOKEN_LENGTH - 1 bytes are cut short at a
+// character boundary, but nothing else is ever dropped. Returns -1 and
+// leaves doc without tokens if length exceeds MAX_DOCUMENT_BYTES.
+int preprocess_document_buffer(Document* doc, const char* text, size_t length) {
+    if (length > MAX_DOCUMENT_BYTES) return -1;
+    uint64_t start = perf_enabled ? perf_now_ns() : 0;
+    Tokenizer t;
+    memset(&t, 0, sizeof(t));
+    t.doc = doc;
     
-    // Add last token
-    if (buffer_index > 0 && doc->token_count < MAX_TOKENS) {
-        buffer[buffer_index] = '\0';
-        if (!is_stopword(buffer)) {
-            list_add(doc->tokens, buffer);
-            doc->token_count++;
+    // Folding keeps a character's byte length, and a character ends at
+    // most one token, whose terminator takes one more byte: c bytes in add
+    // at most c + 1 <= 2c. "x中x中..." already needs 1.5 bytes per byte.
+    size_t text_capacity = 2 * length + 1;
+    doc->token_text = (char*)arena_alloc(&doc->arena, text_capacity);
+    t.capacity = (int)(length / 6) + 16;
+    doc->tokens = (Token*)arena_alloc(&doc->arena, t.capacity * sizeof(Token));
+    
+    size_t i = 0;
+    while (i < length) {
+        TokenBlock block;
+        if (length - i >= TOKENIZE_BLOCK && classify_ascii_block(text + i, &block)) {
+            tokenize_block(&t, &block, i);
+            i += TOKENIZE_BLOCK;
+            continue;
+        }
+        
+        // One block's worth of characters before trying the vector path again
+        size_t end = i + TOKENIZE_BLOCK;
+        while (i < end && i < length) {
+            char folded[4];
+            int folded_length = 0, consumed = 1;
+            CharClass class = classify_char(text + i, length - i, folded, &folded_length, &consumed);
+            if (class == CHAR_SPACE) {
+                finish_token(&t);
+            } else if (class == CHAR_LETTER) {
+                append_token_char(&t, folded, folded_length, i, consumed);
+            } else if (class == CHAR_UNSPACED) {
+                finish_token(&t);
+                append_token_char(&t, folded, folded_length, i, consumed);
+                finish_token(&t);
+            }
+            i += consumed;
         }
     }
+    finish_token(&t);
+    
+    // Hand the unused tails back to the arena
+    doc->tokens = (Token*)arena_realloc(&doc->arena, doc->tokens, t.capacity * sizeof(Token),
+                                        doc->token_count * sizeof(Token));
+    doc->token_text = (char*)arena_realloc(&doc->arena, doc->token_text, text_capacity, t.used);
+    intern_document_tokens(doc);
+    
+    if (perf_enabled) {
+        perf_add(PERF_TOKENS, (uint64_t)doc->token_count);
+        perf_add(PERF_STOPWORDS_DROPPED, (uint64_t)t.dropped);
+        perf_add(PERF_TRUNCATED_TOKENS, (uint64_t)t.truncated_tokens);
+        perf_add(PERF_TRUNCATED_BYTES, t.truncated_bytes);
+        perf_stage(PERF_STAGE_PREPROCESS, start);
+    }
+    return 0;
 }
 
 void generate_kgrams(Document* doc, int k) {
-    if (doc->token_count < k) return;
+    generate_winnowed_kgrams(doc, k, 1);
+}
+
+// Occurrence counts: with counting on, every kept fingerprint also records
+// how often its k-gram occurs in the document (see Document.kgram_counts)
+static int kgram_count_mode = 0;
+
+void set_kgram_counts(int enabled) {
+    kgram_count_mode = enabled;
+}
+
+int get_kgram_counts(void) {
+    return kgram_count_mode;
+}
+
+// Counts each sorted fingerprint of doc->kgrams among all n k-gram
+// fingerprints of the document, sorting a copy of them once
+static void count_kgram_occurrences(Document* doc, const uint64_t* fingerprints, int n) {
+    HashSet* set = doc->kgrams;
+    const uint64_t* sorted = hash_set_sorted_fingerprints(set);
+    doc->kgram_counts = (uint32_t*)arena_alloc(&doc->arena,
+                                               (set->count > 0 ? set->count : 1) * sizeof(uint32_t));
+    uint64_t* all = (uint64_t*)malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+    uint64_t* scratch = (uint64_t*)malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+    if (n > 0) {
+        memcpy(all, fingerprints, n * sizeof(uint64_t));
+        radix_sort_u64(all, scratch, n);
+    }
+    free(scratch);
+
+    // Exact sets can hold one fingerprint twice, so runs are not consumed
+    int j = 0;
+    for (int i = 0; i < set->count; i++) {
+        while (j < n && all[j] < sorted[i]) j++;
+        int end = j;
+        while (end < n && all[end] == sorted[i]) end++;
+        doc->kgram_counts[i] = (uint32_t)(end - j);
+    }
+    free(all);
+}
+
+// Multi-k: every k in [kgram_range_min, kgram_range_max] is fingerprinted
+// alongside the document's own k, from the same prefix hashes
+static int kgram_range_min = 0;
+static int kgram_range_max = 0;
+
+void set_kgram_range(int k_min, int k_max) {
+    if (k_min < 2) k_min = 2;
+    if (k_max > KGRAM_MAX_LENGTH) k_max = KGRAM_MAX_LENGTH;
+    kgram_range_min = k_min <= k_max ? k_min : 0;
+    kgram_range_max = k_min <= k_max ? k_max : 0;
+}
+
+// Returns 1 and the range when multi-k fingerprinting is on
+int get_kgram_range(int* k_min, int* k_max) {
+    *k_min = kgram_range_min;
+    *k_max = kgram_range_max;
+    return kgram_range_min > 0;
+}
+
+// prefix[i] is the polynomial hash of tokens [0, i), so the k-gram at s
+// hashes to prefix[s + k] - prefix[s] * B^k, the same value the rolling
+// hash reaches, for any k
+static uint64_t* document_prefix_hashes(const Document* doc) {
+    uint64_t* prefix = (uint64_t*)malloc((doc->token_count + 1) * sizeof(uint64_t));
+    prefix[0] = 0;
+    for (int position = 0; position < doc->token_count; position++) {
+        prefix[position + 1] = prefix[position] * KGRAM_HASH_BASE +
+                               token_hash(document_token(doc, position));
+    }
+    return prefix;
+}
+
+// Fills fingerprints[0..n) with the fingerprint of the k-gram starting at
+// each token, n = token_count - k + 1. Returns n, or 0 when there are
+// fewer than k tokens.
+static int kgram_fingerprints(const Document* doc, const uint64_t* prefix, int k,
+                              uint64_t* fingerprints) {
+    int n = doc->token_count - k + 1;
+    if (n <= 0) return 0;
+
+    uint64_t power = 1;
+    for (int i = 0; i < k; i++) {
+        power *= KGRAM_HASH_BASE;
+    }
+    for (int i = 0; i < n; i++) {
+        fingerprints[i] = fingerprint_mix(prefix[i + k] - prefix[i] * power);
+    }
+    return n;
+}
+
+// Winnowing: keeps the minimum of every window of `window` consecutive
+// k-gram fingerprints (rightmost on ties), recorded once per position.
+// Any run of at least window + k - 1 shared tokens yields a shared
+// fingerprint. A window of 1 keeps every k-gram. Writes the kept positions
+// to `positions` in ascending order and returns how many; `deque` is
+// scratch of n entries.
+static int winnow_positions(const uint64_t* fingerprints, int n, int window, int* deque,
+                            int* positions) {
+    if (window == 1) {
+        for (int i = 0; i < n; i++) {
+            positions[i] = i;
+        }
+        return n;
+    }
+
+    // Monotonic deque of k-gram positions with increasing fingerprints
+    int kept = 0;
+    int head = 0, tail = 0;
+    int last_selected = -1;
+    int w = window < n ? window : n;
+
+    for (int i = 0; i < n; i++) {
+        while (tail > head && fingerprints[deque[tail - 1]] >= fingerprints[i]) {
+            tail--;
+        }
+        deque[tail++] = i;
+        if (deque[head] <= i - w) {
+            head++;
+        }
+        if (i >= w - 1 && deque[head] != last_selected) {
+            last_selected = deque[head];
+            positions[kept++] = last_selected;
+        }
+    }
+    return kept;
+}
+
+// Adds the k-grams winnowing keeps to `set`. `fingerprints`, `deque` and
+// `positions` are scratch of token_count entries. Returns the k-grams kept.
+static int winnow_kgrams(const Document* doc, HashSet* set, const uint64_t* prefix, int k,
+                         int window, uint64_t* fingerprints, int* deque, int* positions) {
+    int n = kgram_fingerprints(doc, prefix, k, fingerprints);
+    if (n == 0) return 0;
+
+    int kept = winnow_positions(fingerprints, n, window, deque, positions);
+    for (int i = 0; i < kept; i++) {
+        int position = positions[i];
+        hash_set_add_key(set, fingerprints[position], doc->token_ids + position, k);
+    }
+
+    // Build the sorted view now so comparisons only ever read the set
+    hash_set_sorted_fingerprints(set);
+    return kept;
+}
+
+// Fingerprints the document at k into doc->kgrams, and, with a k range
+// set, at every k of the range into doc->kgrams_by_k, all from one pass
+// over the tokens.
+void generate_winnowed_kgrams(Document* doc, int k, int window) {
+    doc->k = k;
+    doc->window = window < 1 ? 1 : window;
+    int multi = kgram_range_min > 0;
+    if (doc->token_count < k && !multi) return;
+    uint64_t start = perf_enabled ? perf_now_ns() : 0;
+
+    uint64_t* prefix = document_prefix_hashes(doc);
+    int scratch = doc->token_count > 0 ? doc->token_count : 1;
+    uint64_t* fingerprints = (uint64_t*)malloc(scratch * sizeof(uint64_t));
+    int* deque = (int*)malloc(scratch * sizeof(int));
+    int* positions = (int*)malloc(scratch * sizeof(int));
+
+    doc->kgram_count += winnow_kgrams(doc, doc->kgrams, prefix, k, doc->window,
+                                      fingerprints, deque, positions);
+    // With a k range the document may be shorter than k and have no k-grams
+    if (kgram_count_mode) {
+        int n = doc->token_count - k + 1;
+        count_kgram_occurrences(doc, fingerprints, n > 0 ? n : 0);
+    }
+    if (multi) {
+        for (int other = kgram_range_min; other <= kgram_range_max; other++) {
+            if (other == k) {
+                doc->kgrams_by_k[other] = doc->kgrams;
+                continue;
+            }
+            HashSet* set = create_arena_hash_set(&doc->arena, HASH_TABLE_SIZE, doc->kgrams->exact);
+            winnow_kgrams(doc, set, prefix, other, doc->window, fingerprints, deque, positions);
+            doc->kgrams_by_k[other] = set;
+        }
+    }
+
+    free(positions);
+    free(deque);
+    free(fingerprints);
+    free(prefix);
+    compute_minhash(doc);
+
+    if (perf_enabled) {
+        HashSet* set = doc->kgrams;
+        perf_add(PERF_DOCUMENTS, 1);
+        perf_add(PERF_KGRAMS, (uint64_t)doc->kgram_count);
+        perf_add(PERF_HASH_SLOTS, (uint64_t)set->size);
+        perf_add(PERF_HASH_ENTRIES, (uint64_t)set->count);
+        perf_add(PERF_HASH_ADDS, (uint64_t)set->adds);
+        perf_add(PERF_HASH_ADD_PROBES, set->add_probes);
+        perf_max(PERF_HASH_MAX_PROBE, (uint64_t)set->max_probe);
+        perf_stage(PERF_STAGE_KGRAMS, start);
+    }
+}
+
+// The k-grams winnowing kept in doc->kgrams, recomputed from the tokens
+// (see ensure_document_tokens): positions[i] is the token where the i-th
+// one starts, ascending, and fingerprints[i] its fingerprint. Both arrays
+// are malloc'd. Returns the count.
+int document_kept_kgrams(const Document* doc, int** positions, uint64_t** fingerprints) {
+    *positions = NULL;
+    *fingerprints = NULL;
+    if (doc->k < 1 || doc->token_count < doc->k) return 0;
+
+    int n = doc->token_count - doc->k + 1;
+    uint64_t* prefix = document_prefix_hashes(doc);
+    uint64_t* kept_fingerprints = (uint64_t*)malloc(n * sizeof(uint64_t));
+    int* kept_positions = (int*)malloc(n * sizeof(int));
+    int* deque = (int*)malloc(n * sizeof(int));
+
+    kgram_fingerprints(doc, prefix, doc->k, kept_fingerprints);
+    int kept = winnow_positions(kept_fingerprints, n, doc->window, deque, kept_positions);
+    // Compacts in place: the i-th kept position is never below i
+    for (int i = 0; i < kept; i++) {
+        kept_fingerprints[i] = kept_fingerprints[kept_positions[i]];
+    }
+
+    free(deque);
+    free(prefix);
+    *positions = kept_positions;
+    *fingerprints = kept_fingerprints;
+    return kept;
+}
+
+// MinHash Signatures
+// Slot i keeps the minimum of an independent 64-bit permutation of the
+// fingerprints: xor with a per-slot seed, then an odd multiply and
+// xorshift, both of which are bijections.
+static uint64_t minhash_seeds[MINHASH_SIZE];
+static uint64_t minhash_multipliers[MINHASH_SIZE];
+static pthread_once_t minhash_once = PTHREAD_ONCE_INIT;
+
+static void seed_minhash(void) {
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < MINHASH_SIZE; i++) {
+        // splitmix64
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        minhash_seeds[i] = z ^ (z >> 31);
+        minhash_multipliers[i] = (minhash_seeds[i] * 0xff51afd7ed558ccdULL) | 1;
+    }
+}
+
+static void set_minhash(const HashSet* set, uint64_t* signature) {
+    pthread_once(&minhash_once, seed_minhash);
     
-    // Create an array to store current window of tokens
-    TokenNode* current = doc->tokens->head;
+    for (int i = 0; i < MINHASH_SIZE; i++) {
+        signature[i] = UINT64_MAX;
+    }
     
-    // Use a simple approach without fixed array size
-    while (current != NULL) {
-        // Check if we have enough tokens ahead for a k-gram
-        TokenNode* temp = current;
-        int can_form_kgram = 1;
-        
-        // Verify we have k tokens ahead
-        for (int i = 0; i < k; i++) {
-            if (temp == NULL) {
-                can_form_kgram = 0;
-                break;
-            }
-            temp = temp->next;
+    for (int s = 0; s < set->size; s++) {
+        uint64_t fingerprint = set->slots[s];
+        if (fingerprint == 0) continue;
+        for (int i = 0; i < MINHASH_SIZE; i++) {
+            uint64_t h = (fingerprint ^ minhash_seeds[i]) * minhash_multipliers[i];
+            h ^= h >> 29;
+            if (h < signature[i]) signature[i] = h;
         }
-        
-        if (!can_form_kgram) break;
-        
-        // Build the k-gram
-        char kgram[MAX_TOKEN_LENGTH * 10] = "";
-        temp = current;
-        for (int i = 0; i < k; i++) {
-            if (i > 0) {
-                strcat(kgram, " ");
+    }
+}
+
+void compute_minhash(Document* doc) {
+    set_minhash(doc->kgrams, doc->minhash);
+}
+
+// Fraction of agreeing signature slots, an unbiased Jaccard estimate
+double minhash_similarity(const Document* doc1, const Document* doc2) {
+    int equal = 0;
+    for (int i = 0; i < MINHASH_SIZE; i++) {
+        equal += doc1->minhash[i] == doc2->minhash[i];
+    }
+    return (double)equal / MINHASH_SIZE;
+}
+
+// Rebuilds doc->kgrams, kgram_count and the signature from the tokens
+// now held. The new set, sorted view included, and the count and
+// signature that go with it are all written before the set replaces the
+// old one, which stays in the arena: a thread scoring the document
+// through document_kgrams sees one or the other whole.
+static void refingerprint_document(Document* doc) {
+    HashSet* set = create_arena_hash_set(&doc->arena, HASH_TABLE_SIZE, doc->kgrams->exact);
+    int kgram_count = 0;
+    if (doc->token_count >= doc->k) {
+        uint64_t* prefix = document_prefix_hashes(doc);
+        uint64_t* fingerprints = (uint64_t*)malloc(doc->token_count * sizeof(uint64_t));
+        int* deque = (int*)malloc(doc->token_count * sizeof(int));
+        int* positions = (int*)malloc(doc->token_count * sizeof(int));
+        kgram_count = winnow_kgrams(doc, set, prefix, doc->k, doc->window,
+                                    fingerprints, deque, positions);
+        free(positions);
+        free(deque);
+        free(fingerprints);
+        free(prefix);
+    }
+    hash_set_sorted_fingerprints(set);
+    doc->kgram_count = kgram_count;
+    set_minhash(set, doc->minhash);
+    __atomic_store_n(&doc->kgrams, set, __ATOMIC_RELEASE);
+}
+
+// Tokenizes a cache-loaded document from its file on first use. A shared
+// reference may be asked for by several scoring threads at once, so the
+// first one in does the work under the document's lock, and threads
+// after other documents are not held up. The file may have changed since
+// the cache answered for it; then the cached fingerprints no longer
+// describe its tokens and are rebuilt. Returns 0 on success.
+int ensure_document_tokens(Document* doc) {
+    if (!__atomic_load_n(&doc->tokens_pending, __ATOMIC_ACQUIRE)) return 0;
+    int status = 0;
+    pthread_mutex_lock(&doc->tokens_lock);
+    if (doc->tokens_pending) {
+        MappedFile file;
+        if (map_text_file(doc->filename, &file) == 0) {
+            uint64_t hash[2];
+            content_hash(file.data, file.size, hash);
+            int kgram_count = doc->kgram_count;
+            doc->token_count = 0;
+            preprocess_document_buffer(doc, file.data, file.size);
+            unmap_text_file(&file);
+            doc->kgram_count = kgram_count;
+            if (hash[0] != doc->source_hash[0] || hash[1] != doc->source_hash[1]) {
+                refingerprint_document(doc);
+                doc->source_hash[0] = hash[0];
+                doc->source_hash[1] = hash[1];
             }
-            strcat(kgram, temp->token);
-            temp = temp->next;
+            __atomic_store_n(&doc->tokens_pending, 0, __ATOMIC_RELEASE);
+        } else {
+            status = -1;
         }
-        
-        hash_set_add(doc->kgrams, kgram);
-        doc->kgram_count++;
-        
-        current = current->next;
     }
+    pthread_mutex_unlock(&doc->tokens_lock);
+    return status;
 }
 
+// The document lives in its own arena, so this drops everything at once
 void free_document(Document* doc) {
-    free_list(doc->tokens);
-    free_hash_set(doc->kgrams);
-    free(doc);
+    pthread_mutex_destroy(&doc->tokens_lock);
+    Arena arena = doc->arena;
+    arena_release(&arena);
 }
 
 // Similarity Algorithms
@@ -221,7 +1098,7 @@ double jaccard_similarity(HashSet* set1, HashSet* set2) {
     if (set1->count == 0 || set2->count == 0) return 0.0;
     
     int intersection = hash_set_intersection_size(set1, set2);
-    int union_size = hash_set_union_size(set1, set2);
+    int union_size = set1->count + set2->count - intersection;
     
     return union_size > 0 ? (double)intersection / union_size : 0.0;
 }
@@ -249,120 +1126,168 @@ double dice_coefficient(HashSet* set1, HashSet* set2) {
     return (2.0 * intersection) / (set1->count + set2->count);
 }
 
-// Utility Functions
-void to_lowercase(char* str) {
-    for (int i = 0; str[i]; i++) {
-        str[i] = tolower(str[i]);
+// Content Hash
+// Two independent multiply-rotate lanes over 8-byte words; not
+// cryptographic, but 128 bits make an accidental match between different
+// files vanishingly unlikely, and it runs at memory speed.
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+void content_hash(const char* data, size_t size, uint64_t hash[2]) {
+    uint64_t a = 0x9e3779b97f4a7c15ULL ^ size;
+    uint64_t b = 0xc2b2ae3d27d4eb4fULL + size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        a = rotl64(a ^ (word * 0x87c37b91114253d5ULL), 31) * 0x4cf5ad432745937fULL;
+        b = rotl64(b + word, 27) * 0x52dce729ULL + 0x38495ab5ULL;
     }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    a ^= tail * 0x87c37b91114253d5ULL;
+    b += tail;
+    hash[0] = fingerprint_mix(a + b);
+    hash[1] = fingerprint_mix(b ^ rotl64(a, 17));
 }
 
-void remove_punctuation(char* str) {
-    int j = 0;
-    for (int i = 0; str[i]; i++) {
-        if (isalpha(str[i]) || str[i] == '\'' || isspace(str[i])) {
-            str[j++] = str[i];
+// Utility Functions
+// Maps a file read-only so it can be tokenized in place. Empty files and
+// inputs that cannot be mapped (pipes, some network filesystems) fall back
+// to a heap copy. Files over MAX_DOCUMENT_BYTES fail with EFBIG. Returns 0
+// on success.
+int map_text_file(const char* path, MappedFile* file) {
+    file->data = "";
+    file->size = 0;
+    file->map = NULL;
+    file->heap = NULL;
+    
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    
+    struct stat st;
+    int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (regular && (uint64_t)st.st_size > MAX_DOCUMENT_BYTES) {
+        close(fd);
+        errno = EFBIG;
+        return -1;
+    }
+    if (regular && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            file->data = (const char*)map;
+            file->size = (size_t)st.st_size;
+            file->map = map;
+            return 0;
         }
     }
-    str[j] = '\0';
     
-    // Collapse multiple spaces
-    j = 0;
-    int space_flag = 0;
-    for (int i = 0; str[i]; i++) {
-        if (isspace(str[i])) {
-            if (!space_flag) {
-                str[j++] = ' ';
-                space_flag = 1;
-            }
-        } else {
-            str[j++] = str[i];
-            space_flag = 0;
+    FILE* fp = fdopen(fd, "rb");
+    if (fp == NULL) {
+        close(fd);
+        return -1;
+    }
+    size_t capacity = 65536, length = 0, got;
+    char* data = (char*)malloc(capacity);
+    while ((got = fread(data + length, 1, capacity - length, fp)) > 0) {
+        length += got;
+        if (length > MAX_DOCUMENT_BYTES) {
+            fclose(fp);
+            free(data);
+            errno = EFBIG;
+            return -1;
+        }
+        if (length == capacity) {
+            capacity *= 2;
+            data = (char*)realloc(data, capacity);
         }
     }
-    str[j] = '\0';
+    fclose(fp);
+    file->data = data;
+    file->size = length;
+    file->heap = data;
+    return 0;
 }
 
-int is_stopword(const char* word) {
-    // Common English stopwords
-    const char* stopwords[] = {
-        "a", "an", "the", "and", "or", "but", "in", "on", "at", "to", "for", 
-        "of", "with", "by", "as", "is", "was", "were", "be", "been", "have",
-        "has", "had", "do", "does", "did", "will", "would", "could", "should",
-        "may", "might", "must", "can", "i", "you", "he", "she", "it", "we",
-        "they", "me", "him", "her", "us", "them", "this", "that", "these",
-        "those", "my", "your", "his", "its", "our", "their", "am", "are"
-    };
-    
-    int num_stopwords = sizeof(stopwords) / sizeof(stopwords[0]);
-    for (int i = 0; i < num_stopwords; i++) {
-        if (strcmp(word, stopwords[i]) == 0) {
-            return 1;
-        }
+void unmap_text_file(MappedFile* file) {
+    if (file->map != NULL) {
+        munmap(file->map, file->size);
     }
-    return 0;
+    free(file->heap);
+    file->data = "";
+    file->size = 0;
+    file->map = NULL;
+    file->heap = NULL;
 }
 
-// Find common phrases using simple sliding window
-void find_common_phrases(Document* target, Document* reference, 
-                         char phrases[5][MAX_TOKEN_LENGTH * 10], int* phrase_count) {
-    *phrase_count = 0;
-    
-    // Convert documents to text for phrase matching
-    char target_text[MAX_STRING_LENGTH] = "";
-    char ref_text[MAX_STRING_LENGTH] = "";
+// Reads lines until an empty line or EOF into a growing heap buffer, in
+// time linear in the input. Returns the NUL-terminated text.
+char* read_stream_until_blank_line(FILE* fp, size_t* length) {
+    size_t capacity = 4096, used = 0;
+    char* text = (char*)malloc(capacity);
+    char line[1000];
+    int at_line_start = 1;
     
-    TokenNode* current = target->tokens->head;
-    while (current != NULL && strlen(target_text) < MAX_STRING_LENGTH - 100) {
-        if (strlen(target_text) > 0) strcat(target_text, " ");
-        strcat(target_text, current->token);
-        current = current->next;
+    while (fgets(line, sizeof(line), fp)) {
+        if (at_line_start && strcmp(line, "\n") == 0) break;
+        size_t n = strlen(line);
+        if (used + n + 1 > capacity) {
+            while (used + n + 1 > capacity) capacity *= 2;
+            text = (char*)realloc(text, capacity);
+        }
+        memcpy(text + used, line, n);
+        used += n;
+        at_line_start = n > 0 && line[n - 1] == '\n';
     }
-    
-    current = reference->tokens->head;
-    while (current != NULL && strlen(ref_text) < MAX_STRING_LENGTH - 100) {
-        if (strlen(ref_text) > 0) strcat(ref_text, " ");
-        strcat(ref_text, current->token);
-        current = current->next;
+    text[used] = '\0';
+    if (length != NULL) *length = used;
+    return text;
+}
+
+// Case-folds letters in place under the tokenizer's UTF-8 rules
+void to_lowercase(char* str) {
+    size_t length = strlen(str);
+    size_t j = 0;
+    for (size_t i = 0; i < length; ) {
+        char folded[4];
+        int folded_length = 0, consumed = 1;
+        CharClass class = classify_char(str + i, length - i, folded, &folded_length, &consumed);
+        if ((class == CHAR_LETTER || class == CHAR_UNSPACED) && folded_length == consumed) {
+            memcpy(str + j, folded, folded_length);
+        } else {
+            memmove(str + j, str + i, consumed);
+        }
+        i += consumed;
+        j += consumed;
     }
-    
-    // Simple phrase matching - look for sequences of 3-7 words
-    for (int len = 7; len >= 3 && *phrase_count < 5; len--) {
-        TokenNode* node = target->tokens->head;
-        
-        while (node != NULL && *phrase_count < 5) {
-            // Build phrase from current position
-            char phrase[MAX_TOKEN_LENGTH * 10] = "";
-            TokenNode* temp = node;
-            int valid_phrase = 1;
-            
-            for (int i = 0; i < len; i++) {
-                if (temp == NULL) {
-                    valid_phrase = 0;
-                    break;
-                }
-                if (i > 0) strcat(phrase, " ");
-                strcat(phrase, temp->token);
-                temp = temp->next;
-            }
-            
-            // Check if this phrase exists in reference
-            if (valid_phrase && strstr(ref_text, phrase) != NULL) {
-                // Avoid duplicates and substrings
-                int is_duplicate = 0;
-                for (int i = 0; i < *phrase_count; i++) {
-                    if (strstr(phrases[i], phrase) != NULL || strstr(phrase, phrases[i]) != NULL) {
-                        is_duplicate = 1;
-                        break;
-                    }
-                }
-                
-                if (!is_duplicate) {
-                    strcpy(phrases[*phrase_count], phrase);
-                    (*phrase_count)++;
-                }
-            }
-            
-            node = node->next;
+    str[j] = '\0';
+}
+
+// Keeps letters and apostrophes, and turns each run of spaces into a
+// single ' ', in one pass
+void remove_punctuation(char* str) {
+    size_t length = strlen(str);
+    size_t j = 0;
+    int space_flag = 0;
+    for (size_t i = 0; i < length; ) {
+        char folded[4];
+        int folded_length = 0, consumed = 1;
+        CharClass class = classify_char(str + i, length - i, folded, &folded_length, &consumed);
+        if (class == CHAR_SPACE) {
+            if (!space_flag) str[j++] = ' ';
+            space_flag = 1;
+        } else if (class == CHAR_LETTER || class == CHAR_UNSPACED) {
+            memmove(str + j, str + i, consumed);
+            j += consumed;
+            space_flag = 0;
         }
+        i += consumed;
     }
-}
\ No newline at end of file
+    str[j] = '\0';
+}
+
+int is_stopword(const char* word) {
+    return is_active_stopword(word, strlen(word));
+}
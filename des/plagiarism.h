@@ -6,47 +6,144 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "arena.h"
 
-#define MAX_DOCUMENTS 20
-#define MAX_TOKENS 10000
 #define MAX_TOKEN_LENGTH 100
 #define MAX_FILENAME_LENGTH 256
-#define MAX_STRING_LENGTH 100000
-#define HASH_TABLE_SIZE 10007
+// Largest input a document takes: its token text, at most twice as long,
+// must stay addressable by Token's 32-bit offsets and its counts by int
+#define MAX_DOCUMENT_BYTES ((size_t)INT32_MAX)
+#define HASH_TABLE_SIZE 1024
+#define HASH_SET_MAX_LOAD 0.7
 #define KGRAM_MAX_LENGTH 10
+#define KGRAM_HASH_BASE 0x100000001b3ULL
+#define MINHASH_SIZE 128
+#define COMMON_PASSAGE_MIN_TOKENS 3
+#define FUZZY_PASSAGE_MIN_TOKENS 8
+#define INTERSECT_MIN_CHUNK 64
+#define INTERSECT_MAX_CHUNK 4096
 
 // Data Structures
-typedef struct TokenNode {
-    char token[MAX_TOKEN_LENGTH];
-    struct TokenNode* next;
-} TokenNode;
-
-typedef struct LinkedList {
-    TokenNode* head;
-    TokenNode* tail;
-    int size;
-} LinkedList;
-
-typedef struct KGram {
-    char gram[MAX_TOKEN_LENGTH * 10];
-    int hash;
-    struct KGram* next;
-} KGram;
+// A token is a span of the document's normalized token text, where every
+// token is stored NUL-terminated, plus the byte range it came from in the
+// original input.
+typedef struct Token {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t source_offset;
+    uint32_t source_length;
+} Token;
+
+// Read-only view of a file's bytes, memory-mapped when possible
+typedef struct MappedFile {
+    const char* data;
+    size_t size;
+    void* map;                // mmap'd region, or NULL
+    char* heap;               // fallback copy, or NULL
+} MappedFile;
 
+// Open-addressed set of 64-bit k-gram fingerprints. A slot holding 0 is
+// empty (fingerprints of 0 are remapped to 1). In exact mode every slot
+// also keeps the k-gram as packed token IDs from the document's
+// dictionary, so fingerprint collisions are told apart without any string
+// compares.
+// A set created inside an arena draws all of its tables from it and is
+// freed with the arena.
 typedef struct HashSet {
-    KGram** table;
-    int size;
+    uint64_t* slots;
+    uint32_t* keys;           // exact mode only: key_width IDs per slot
+    uint64_t* sorted;         // ascending fingerprints, rebuilt after adds
+    int sorted_valid;
+    int size;                 // slot capacity, always a power of two
     int count;
+    int exact;
+    int key_width;
+    Arena* arena;             // NULL when tables come from malloc
+    uint64_t add_probes;      // perf only: slots visited by adds
+    int adds;
+    int max_probe;
 } HashSet;
 
+// Interns token text as dense IDs (see plagiarism.c); IDs compare only
+// between documents sharing a dictionary
+typedef struct TokenDictionary TokenDictionary;
+
+// A document and everything it owns (tokens, IDs, k-gram tables) live in
+// its own arena, so freeing one is a single release.
 typedef struct Document {
+    Arena arena;
     char filename[MAX_FILENAME_LENGTH];
-    LinkedList* tokens;
+    Token* tokens;
+    char* token_text;
+    uint32_t* token_ids;      // dictionary ID of each token
+    TokenDictionary* dictionary;  // where token_ids come from; NULL is the process-wide one
     HashSet* kgrams;
+    HashSet* kgrams_by_k[KGRAM_MAX_LENGTH + 1];  // with a k range only, NULL outside it
+    uint32_t* kgram_counts;   // with counting on: occurrences of each kgrams->sorted entry
+    double* tfidf_weights;    // tf * idf per kgrams->sorted entry, once weighed
+    double tfidf_norm;
     int token_count;
     int kgram_count;
+    int k;               // k-gram length of kgrams
+    int window;          // winnowing window, 1 keeps every k-gram
+    int tokens_pending;  // loaded from the fingerprint cache, tokens not read yet
+    uint64_t source_hash[2];  // with tokens_pending: content_hash of the cached text
+    pthread_mutex_t tokens_lock;  // taken by ensure_document_tokens
+    uint64_t minhash[MINHASH_SIZE];
 } Document;
 
+// A cache-loaded document (tokens_pending) gets its tokens from
+// ensure_document_tokens, which also rebuilds kgrams, kgram_count and
+// minhash if the file changed since the cache answered. While other
+// threads may be scoring it, call that before reading tokens or counts;
+// only the set may be read without it, through document_kgrams, which
+// sees the count and signature published with it.
+static inline HashSet* document_kgrams(const Document* doc) {
+    return __atomic_load_n(&doc->kgrams, __ATOMIC_ACQUIRE);
+}
+
+// A maximal run of tokens shared by target and reference. Token positions
+// index the documents' token arrays; char ranges are byte offsets into the
+// original inputs, end exclusive.
+typedef struct CommonPassage {
+    int target_start;
+    int ref_start;
+    int length;               // in tokens
+    uint32_t target_char_start;
+    uint32_t target_char_end;
+    uint32_t ref_char_start;
+    uint32_t ref_char_end;
+} CommonPassage;
+
+// A target span that matches a reference run up to a few edits. Ranges
+// are as in CommonPassage; the two sides may differ in length.
+typedef struct FuzzyPassage {
+    int target_start;
+    int ref_start;
+    int length;               // in target tokens
+    int ref_length;           // in reference tokens
+    int edits;                // token insertions, deletions and substitutions
+    double similarity;        // 1 - edits / the longer side
+    uint32_t target_char_start;
+    uint32_t target_char_end;
+    uint32_t ref_char_start;
+    uint32_t ref_char_end;
+} FuzzyPassage;
+
+// The set-based scores at one k of a multi-k run
+typedef struct KgramScores {
+    int k;
+    double jaccard;
+    double cosine;
+    double containment;
+    double dice;
+    double overall;
+    int matching_kgrams;
+} KgramScores;
+
 typedef struct SimilarityResult {
     char filename[MAX_FILENAME_LENGTH];
     double jaccard;
@@ -55,26 +152,63 @@ typedef struct SimilarityResult {
     double dice;
     double overall;
     int matching_kgrams;
-    char common_phrases[5][MAX_TOKEN_LENGTH * 10];
-    int phrase_count;
+    double tfidf_cosine;      // with --tfidf only: weighted cosine of k-gram counts
+    double similarity_ms;     // perf only: time in compute_similarity
+    double passages_ms;       // perf only: time in find_common_phrases
+    CommonPassage* passages;  // longest first, owned by the result
+    int passage_count;
+    KgramScores* k_scores;    // one per k of the range, owned by the result
+    int k_score_count;
+    float* heatmap;           // containment per target segment, owned by the result
+    int heatmap_count;
+    FuzzyPassage* fuzzy_passages;  // longest first, owned by the result
+    int fuzzy_passage_count;
 } SimilarityResult;
 
-// Function declarations
-LinkedList* create_linked_list();
-void list_add(LinkedList* list, const char* token);
-void free_list(LinkedList* list);
+static inline const char* document_token(const Document* doc, int index) {
+    return doc->token_text + doc->tokens[index].offset;
+}
 
+// Function declarations
 HashSet* create_hash_set(int size);
-unsigned int hash_function(const char* str);
+HashSet* create_exact_hash_set(int size);
+HashSet* create_arena_hash_set(Arena* arena, int size, int exact);
+uint64_t token_hash(const char* token);
+uint64_t fingerprint_mix(uint64_t hash);
+uint64_t hash_function(const char* str);
 void hash_set_add(HashSet* set, const char* kgram);
+void hash_set_add_fingerprint(HashSet* set, uint64_t fingerprint);
+void hash_set_add_key(HashSet* set, uint64_t fingerprint, const uint32_t* key, int width);
 int hash_set_contains(HashSet* set, const char* kgram);
+int hash_set_contains_fingerprint(HashSet* set, uint64_t fingerprint);
+void set_kgram_exact_mode(int enabled);
+int get_kgram_exact_mode(void);
+void set_kgram_range(int k_min, int k_max);
+int get_kgram_range(int* k_min, int* k_max);
+void set_kgram_counts(int enabled);
+int get_kgram_counts(void);
+void radix_sort_u64(uint64_t* keys, uint64_t* scratch, int n);
+
+uint32_t dictionary_intern(const char* token);
+int dictionary_size(void);
+TokenDictionary* create_token_dictionary(void);
+void free_token_dictionary(TokenDictionary* dictionary);
 int hash_set_intersection_size(HashSet* set1, HashSet* set2);
 int hash_set_union_size(HashSet* set1, HashSet* set2);
+const uint64_t* hash_set_sorted_fingerprints(HashSet* set);
 void free_hash_set(HashSet* set);
 
 Document* create_document(const char* filename);
+Document* create_document_with(const char* filename, const ArenaAllocator* allocator);
+Document* load_document(const char* path, int k, int window);
 void preprocess_document(Document* doc, const char* text);
+int preprocess_document_buffer(Document* doc, const char* text, size_t length);
 void generate_kgrams(Document* doc, int k);
+void generate_winnowed_kgrams(Document* doc, int k, int window);
+int document_kept_kgrams(const Document* doc, int** positions, uint64_t** fingerprints);
+void compute_minhash(Document* doc);
+double minhash_similarity(const Document* doc1, const Document* doc2);
+int ensure_document_tokens(Document* doc);
 void free_document(Document* doc);
 
 // Similarity Algorithms
@@ -83,11 +217,71 @@ double cosine_similarity(HashSet* set1, HashSet* set2);
 double containment_similarity(HashSet* set1, HashSet* set2);
 double dice_coefficient(HashSet* set1, HashSet* set2);
 
+// Similarity kernel: one intersection yields every set-based metric
+int sorted_intersection_size(const uint64_t* a, int a_count, const uint64_t* b, int b_count);
+double sorted_weighted_dot(const uint64_t* a, const double* a_weights, int a_count,
+                           const uint64_t* b, const double* b_weights, int b_count);
+void compute_similarity(HashSet* set1, HashSet* set2, SimilarityResult* result);
+void fill_similarity_scores(SimilarityResult* result, int intersection, int count1, int count2);
+void compute_k_scores(Document* target, Document* reference, SimilarityResult* result);
+
+// Threshold join: pairs below similarity_min_score (overall) are pruned
+extern double similarity_min_score;
+int required_intersection(double min_score, int count1, int count2);
+int bounded_intersection_size(const uint64_t* a, int a_count, const uint64_t* b, int b_count,
+                              int required);
+int compute_similarity_min(HashSet* set1, HashSet* set2, double min_score,
+                           SimilarityResult* result);
+int compute_similarity_above(HashSet* set1, HashSet* set2, SimilarityResult* result);
+
 // String matching algorithms
-void find_common_phrases(Document* target, Document* reference, 
-                         char phrases[5][MAX_TOKEN_LENGTH * 10], int* phrase_count);
+extern int common_passage_min_tokens;
+int find_common_passages(Document* target, Document* reference, int min_length,
+                         CommonPassage** passages);
+void find_common_phrases(Document* target, Document* reference, SimilarityResult* result);
+char* common_passage_text(const Document* target, const CommonPassage* passage);
+
+// Segment heatmap: per-window containment of the target in a reference,
+// off while heatmap_window_tokens is 0
+extern int heatmap_window_tokens;
+int heatmap_stride_tokens(void);
+int heatmap_segment_count(int token_count);
+void heatmap_segment_range(const Document* target, int segment, uint32_t* start, uint32_t* end);
+void compute_similarity_heatmap(Document* target, Document* reference, SimilarityResult* result);
+
+// Fuzzy alignment: seeded, bit-parallel token edit distance, off while
+// fuzzy_min_similarity is 0
+extern double fuzzy_min_similarity;
+void find_fuzzy_passages(Document* target, Document* reference, SimilarityResult* result);
+int token_edit_search(const uint32_t* pattern, int m, const uint32_t* text, int n, int* end);
+void free_similarity_result(SimilarityResult* result);
+
+// Buffered JSON writer. With a sink it writes through whenever the buffer
+// fills; without one it grows, so a record can be built off to the side.
+typedef struct JsonBuffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+    FILE* sink;
+    int failed;               // a write to the sink came up short
+} JsonBuffer;
+
+// JSON report, the format read by the frontend
+void write_json_report(FILE* fp, SimilarityResult* results, int count, Document* target, int k);
+void write_json_results(SimilarityResult* results, int count, Document* target, int k, const char* output_file);
+void json_buffer_init(JsonBuffer* buffer, FILE* sink, size_t capacity);
+void json_buffer_write(JsonBuffer* buffer, const char* data, size_t length);
+void json_buffer_printf(JsonBuffer* buffer, const char* format, ...);
+void json_buffer_string(JsonBuffer* buffer, const char* str);
+int json_buffer_flush(JsonBuffer* buffer);
+void json_buffer_free(JsonBuffer* buffer);
+void write_ndjson_record(JsonBuffer* out, SimilarityResult* results, int count, Document* target, int k);
 
 // Utility functions
+void content_hash(const char* data, size_t size, uint64_t hash[2]);
+int map_text_file(const char* path, MappedFile* file);
+void unmap_text_file(MappedFile* file);
+char* read_stream_until_blank_line(FILE* fp, size_t* length);
 void to_lowercase(char* str);
 void remove_punctuation(char* str);
 int is_stopword(const char* word);
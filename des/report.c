@@ -0,0 +1,366 @@
+#include "plagiarism.h"
+#include "perf.h"
+
+#include <stdarg.h>
+
+#define REPORT_PHRASES 5
+#define REPORT_BUFFER (64 * 1024)
+
+// JSON Report
+// Picks the REPORT_PHRASES longest distinct passages of `result`
+static int select_common_phrases(const Document* target, const SimilarityResult* result,
+                                 const CommonPassage** shown) {
+    int phrase_count = 0;
+    for (int j = 0; j < result->passage_count && phrase_count < REPORT_PHRASES; j++) {
+        const CommonPassage* passage = &result->passages[j];
+        int repeated = 0;
+        for (int s = 0; s < phrase_count && !repeated; s++) {
+            repeated = shown[s]->length == passage->length &&
+                       memcmp(target->token_ids + shown[s]->target_start,
+                              target->token_ids + passage->target_start,
+                              passage->length * sizeof(uint32_t)) == 0;
+        }
+        if (!repeated) shown[phrase_count++] = passage;
+    }
+    return phrase_count;
+}
+
+// Segments the target's heatmap has, 0 with the heatmap off
+static int heatmap_target_segments(Document* target) {
+    if (heatmap_window_tokens <= 0 || ensure_document_tokens(target) != 0) return 0;
+    return heatmap_segment_count(target->token_count);
+}
+
+// Buffered Writer
+void json_buffer_init(JsonBuffer* buffer, FILE* sink, size_t capacity) {
+    buffer->capacity = capacity > 0 ? capacity : 1;
+    buffer->data = (char*)malloc(buffer->capacity);
+    buffer->length = 0;
+    buffer->sink = sink;
+    buffer->failed = 0;
+}
+
+// Returns -1 once any write to the sink has failed
+int json_buffer_flush(JsonBuffer* buffer) {
+    if (buffer->sink != NULL && buffer->length > 0) {
+        if (fwrite(buffer->data, 1, buffer->length, buffer->sink) != buffer->length) {
+            buffer->failed = 1;
+        }
+        buffer->length = 0;
+    }
+    return buffer->failed ? -1 : 0;
+}
+
+// Makes room for `length` more bytes: a sink buffer flushes, a detached
+// one grows. A sink buffer may still be short of room for a write larger
+// than its capacity, which json_buffer_write passes straight through.
+static void json_buffer_reserve(JsonBuffer* buffer, size_t length) {
+    if (buffer->length + length <= buffer->capacity) return;
+    if (buffer->sink != NULL) {
+        json_buffer_flush(buffer);
+        return;
+    }
+    size_t capacity = buffer->capacity * 2;
+    while (capacity < buffer->length + length) capacity *= 2;
+    buffer->data = (char*)realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+}
+
+void json_buffer_write(JsonBuffer* buffer, const char* data, size_t length) {
+    json_buffer_reserve(buffer, length);
+    if (buffer->length + length > buffer->capacity) {
+        if (fwrite(data, 1, length, buffer->sink) != length) buffer->failed = 1;
+        return;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+void json_buffer_printf(JsonBuffer* buffer, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length,
+                           format, args);
+    va_end(args);
+    if (length < 0) return;
+    if (buffer->length + (size_t)length < buffer->capacity) {
+        buffer->length += (size_t)length;
+        return;
+    }
+
+    // Did not fit: make room and format again, or go through a scratch copy
+    json_buffer_reserve(buffer, (size_t)length + 1);
+    char* target = buffer->data + buffer->length;
+    char* scratch = NULL;
+    if (buffer->length + (size_t)length + 1 > buffer->capacity) {
+        scratch = (char*)malloc((size_t)length + 1);
+        target = scratch;
+    }
+    va_start(args, format);
+    vsnprintf(target, (size_t)length + 1, format, args);
+    va_end(args);
+    if (scratch != NULL) {
+        json_buffer_write(buffer, scratch, (size_t)length);
+        free(scratch);
+    } else {
+        buffer->length += (size_t)length;
+    }
+}
+
+// Writes `str` as a JSON string literal; runs of plain bytes are copied
+// whole
+void json_buffer_string(JsonBuffer* buffer, const char* str) {
+    json_buffer_write(buffer, "\"", 1);
+    const char* run = str;
+    for (const char* p = str; ; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c != 0 && c != '"' && c != '\\' && c >= 0x20) continue;
+        json_buffer_write(buffer, run, (size_t)(p - run));
+        if (c == 0) break;
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', (char)c };
+            json_buffer_write(buffer, escaped, 2);
+        } else {
+            json_buffer_printf(buffer, "\\u%04x", c);
+        }
+        run = p + 1;
+    }
+    json_buffer_write(buffer, "\"", 1);
+}
+
+void json_buffer_free(JsonBuffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+// Report Serializer
+// The one writer of the report. REPORT_PRETTY breaks it over indented
+// lines for results.json and the server; without it the report is a
+// single NDJSON line. REPORT_PERF appends the instrumentation.
+#define REPORT_PRETTY 1
+#define REPORT_PERF 2
+
+// A line break at `depth` in a pretty report, nothing on one line
+static void report_break(JsonBuffer* out, int flags, int depth) {
+    if (flags & REPORT_PRETTY) json_buffer_printf(out, "\n%*s", depth * 2, "");
+}
+
+// Separates two members or elements at `depth`
+static void report_comma(JsonBuffer* out, int flags, int depth) {
+    if (flags & REPORT_PRETTY) {
+        json_buffer_printf(out, ",\n%*s", depth * 2, "");
+    } else {
+        json_buffer_write(out, ", ", 2);
+    }
+}
+
+// Opens element `j` of an array whose elements sit at `depth`
+static void report_element(JsonBuffer* out, int flags, int depth, int j) {
+    if (j > 0) report_comma(out, flags, depth);
+    else report_break(out, flags, depth);
+}
+
+static void write_target_stats(JsonBuffer* out, Document* target, int k, int flags) {
+    ensure_document_tokens(target);  // settles the counts of a cache-loaded target
+    json_buffer_printf(out, "\"target_stats\": {");
+    report_break(out, flags, 2);
+    json_buffer_printf(out, "\"filename\": ");
+    json_buffer_string(out, target->filename);
+    report_comma(out, flags, 2);
+    json_buffer_printf(out, "\"tokens\": %d", target->token_count);
+    report_comma(out, flags, 2);
+    json_buffer_printf(out, "\"kgrams\": %d", target->kgram_count);
+    report_comma(out, flags, 2);
+    json_buffer_printf(out, "\"k_value\": %d", k);
+    report_comma(out, flags, 2);
+    json_buffer_printf(out, "\"window\": %d", target->window);
+    int k_min, k_max;
+    if (get_kgram_range(&k_min, &k_max)) {
+        report_comma(out, flags, 2);
+        json_buffer_printf(out, "\"k_range\": [%d, %d]", k_min, k_max);
+    }
+    int segments = heatmap_target_segments(target);
+    if (segments > 0) {
+        // Byte range of every segment, for placing the comparisons' scores
+        report_comma(out, flags, 2);
+        json_buffer_printf(out, "\"heatmap\": {\"window_tokens\": %d, \"stride_tokens\": %d, "
+                                "\"segments\": [", heatmap_window_tokens, heatmap_stride_tokens());
+        for (int s = 0; s < segments; s++) {
+            uint32_t start, end;
+            heatmap_segment_range(target, s, &start, &end);
+            json_buffer_printf(out, "%s[%u, %u]", s > 0 ? ", " : "", start, end);
+        }
+        json_buffer_printf(out, "]}");
+    }
+    report_break(out, flags, 1);
+    json_buffer_printf(out, "}");
+}
+
+static void write_comparison(JsonBuffer* out, const SimilarityResult* result, Document* target,
+                             int flags) {
+    json_buffer_printf(out, "{");
+    report_break(out, flags, 3);
+    json_buffer_printf(out, "\"filename\": ");
+    json_buffer_string(out, result->filename);
+    report_comma(out, flags, 3);
+    json_buffer_printf(out, "\"jaccard\": %.4f", result->jaccard);
+    report_comma(out, flags, 3);
+    json_buffer_printf(out, "\"cosine\": %.4f", result->cosine);
+    if (target->tfidf_weights != NULL) {
+        report_comma(out, flags, 3);
+        json_buffer_printf(out, "\"tfidf_cosine\": %.4f", result->tfidf_cosine);
+    }
+    report_comma(out, flags, 3);
+    json_buffer_printf(out, "\"containment\": %.4f", result->containment);
+    report_comma(out, flags, 3);
+    json_buffer_printf(out, "\"dice\": %.4f", result->dice);
+    report_comma(out, flags, 3);
+    json_buffer_printf(out, "\"overall\": %.4f", result->overall);
+    report_comma(out, flags, 3);
+    json_buffer_printf(out, "\"matching_kgrams\": %d", result->matching_kgrams);
+    if (result->k_score_count > 0) {
+        report_comma(out, flags, 3);
+        json_buffer_printf(out, "\"by_k\": [");
+        for (int j = 0; j < result->k_score_count; j++) {
+            const KgramScores* scores = &result->k_scores[j];
+            report_element(out, flags, 4, j);
+            json_buffer_printf(out, "{\"k\": %d, \"jaccard\": %.4f, \"cosine\": %.4f, "
+                                    "\"containment\": %.4f, \"dice\": %.4f, \"overall\": %.4f, "
+                                    "\"matching_kgrams\": %d}",
+                               scores->k, scores->jaccard, scores->cosine, scores->containment,
+                               scores->dice, scores->overall, scores->matching_kgrams);
+        }
+        report_break(out, flags, 3);
+        json_buffer_printf(out, "]");
+    }
+
+    report_comma(out, flags, 3);
+    json_buffer_printf(out, "\"common_phrases\": [");
+    const CommonPassage* shown[REPORT_PHRASES];
+    int phrase_count = select_common_phrases(target, result, shown);
+    for (int j = 0; j < phrase_count; j++) {
+        char* phrase = common_passage_text(target, shown[j]);
+        report_element(out, flags, 4, j);
+        json_buffer_string(out, phrase);
+        free(phrase);
+    }
+    if (phrase_count > 0) report_break(out, flags, 3);
+    json_buffer_printf(out, "]");
+
+    // Every passage with its token and byte ranges in both documents
+    report_comma(out, flags, 3);
+    json_buffer_printf(out, "\"passages\": [");
+    for (int j = 0; j < result->passage_count; j++) {
+        const CommonPassage* passage = &result->passages[j];
+        report_element(out, flags, 4, j);
+        json_buffer_printf(out, "{\"tokens\": %d, \"target_token\": %d, \"reference_token\": %d, "
+                                "\"target_start\": %u, \"target_end\": %u, "
+                                "\"reference_start\": %u, \"reference_end\": %u}",
+                           passage->length, passage->target_start, passage->ref_start,
+                           passage->target_char_start, passage->target_char_end,
+                           passage->ref_char_start, passage->ref_char_end);
+    }
+    if (result->passage_count > 0) report_break(out, flags, 3);
+    json_buffer_printf(out, "]");
+
+    if (result->heatmap_count > 0) {
+        report_comma(out, flags, 3);
+        json_buffer_printf(out, "\"heatmap\": [");
+        for (int s = 0; s < result->heatmap_count; s++) {
+            json_buffer_printf(out, "%s%.4f", s > 0 ? ", " : "", result->heatmap[s]);
+        }
+        json_buffer_printf(out, "]");
+    }
+    if (fuzzy_min_similarity > 0.0) {
+        // Passages matched up to a few edits, with their edit similarity
+        report_comma(out, flags, 3);
+        json_buffer_printf(out, "\"fuzzy_passages\": [");
+        for (int j = 0; j < result->fuzzy_passage_count; j++) {
+            const FuzzyPassage* passage = &result->fuzzy_passages[j];
+            report_element(out, flags, 4, j);
+            json_buffer_printf(out, "{\"tokens\": %d, \"reference_tokens\": %d, \"edits\": %d, "
+                                    "\"similarity\": %.4f, \"target_token\": %d, "
+                                    "\"reference_token\": %d, \"target_start\": %u, "
+                                    "\"target_end\": %u, \"reference_start\": %u, "
+                                    "\"reference_end\": %u}",
+                               passage->length, passage->ref_length, passage->edits,
+                               passage->similarity, passage->target_start, passage->ref_start,
+                               passage->target_char_start, passage->target_char_end,
+                               passage->ref_char_start, passage->ref_char_end);
+        }
+        if (result->fuzzy_passage_count > 0) report_break(out, flags, 3);
+        json_buffer_printf(out, "]");
+    }
+    report_break(out, flags, 2);
+    json_buffer_printf(out, "}");
+}
+
+// Instrumentation, with the target's own table and each comparison
+static void write_report_perf(JsonBuffer* out, SimilarityResult* results, int count,
+                              Document* target) {
+    json_buffer_printf(out, "\"perf\": ");
+    write_json_perf(out, "  ");
+    json_buffer_printf(out, ",\n    \"target_load_factor\": %.4f,\n",
+                       target->kgrams->size > 0
+                           ? (double)target->kgrams->count / target->kgrams->size
+                           : 0.0);
+    json_buffer_printf(out, "    \"comparisons\": [\n");
+    for (int i = 0; i < count; i++) {
+        json_buffer_printf(out, "      {\"filename\": ");
+        json_buffer_string(out, results[i].filename);
+        json_buffer_printf(out, ", \"similarity_ms\": %.3f, \"passages_ms\": %.3f}%s\n",
+                           results[i].similarity_ms, results[i].passages_ms,
+                           i < count - 1 ? "," : "");
+    }
+    json_buffer_printf(out, "    ]\n  }");
+}
+
+// The report for one target: its stats, then one entry per scored
+// reference in `results` order
+static void write_report(JsonBuffer* out, SimilarityResult* results, int count, Document* target,
+                         int k, int flags) {
+    json_buffer_printf(out, "{");
+    report_break(out, flags, 1);
+    write_target_stats(out, target, k, flags);
+    report_comma(out, flags, 1);
+    json_buffer_printf(out, "\"comparisons\": [");
+    for (int i = 0; i < count; i++) {
+        report_element(out, flags, 2, i);
+        write_comparison(out, &results[i], target, flags);
+    }
+    if (count > 0) report_break(out, flags, 1);
+    json_buffer_printf(out, "]");
+    if (flags & REPORT_PERF) {
+        report_comma(out, flags, 1);
+        write_report_perf(out, results, count, target);
+    }
+    report_break(out, flags, 0);
+    json_buffer_printf(out, "}\n");
+}
+
+// The report as results.json has it, written through to `fp`
+void write_json_report(FILE* fp, SimilarityResult* results, int count, Document* target, int k) {
+    JsonBuffer out;
+    json_buffer_init(&out, fp, REPORT_BUFFER);
+    write_report(&out, results, count, target, k,
+                 REPORT_PRETTY | (perf_enabled ? REPORT_PERF : 0));
+    json_buffer_flush(&out);
+    json_buffer_free(&out);
+}
+
+void write_json_results(SimilarityResult* results, int count, Document* target, int k, const char* output_file) {
+    FILE* fp = fopen(output_file, "w");
+    if (fp == NULL) {
+        printf("Error: Cannot create output file\n");
+        return;
+    }
+    write_json_report(fp, results, count, target, k);
+    fclose(fp);
+}
+
+// The same report, minus instrumentation, as a single NDJSON line
+void write_ndjson_record(JsonBuffer* out, SimilarityResult* results, int count, Document* target, int k) {
+    write_report(out, results, count, target, k, 0);
+}
@@ -0,0 +1,593 @@
+#define _XOPEN_SOURCE 700
+#include "server.h"
+#include "index.h"
+#include "lsh.h"
+#include "threadpool.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// Reference Corpus
+// Checks take the read lock for the whole scoring pass; adding a reference
+// fingerprints it first and takes the write lock only to publish it.
+typedef struct Corpus {
+    pthread_rwlock_t lock;
+    Document** docs;
+    int count;
+    int capacity;
+    LshIndex* lsh;             // NULL scores every reference
+} Corpus;
+
+// Latency Log
+// Keeps the most recent SERVER_LATENCY_SAMPLES check latencies.
+typedef struct LatencyLog {
+    pthread_mutex_t lock;
+    double samples[SERVER_LATENCY_SAMPLES];
+    long total;
+} LatencyLog;
+
+typedef struct Server {
+    ServerConfig config;
+    char reference_root[PATH_MAX];  // resolved --reference-root, "" when unset
+    int listen_fd;
+    Corpus corpus;
+    LatencyLog checks;
+} Server;
+
+static volatile sig_atomic_t server_stopping = 0;
+
+// Named in the CORS headers of every response; set before workers start
+static const char* allowed_origin = NULL;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Caller holds the write lock. A document named like an existing
+// reference replaces it; its old LSH bands stay behind and at worst add a
+// spurious candidate. Returns 1 if the corpus grew.
+static int corpus_add(Corpus* corpus, Document* doc) {
+    for (int i = 0; i < corpus->count; i++) {
+        if (strcmp(corpus->docs[i]->filename, doc->filename) == 0) {
+            free_document(corpus->docs[i]);
+            corpus->docs[i] = doc;
+            if (corpus->lsh != NULL) lsh_add(corpus->lsh, doc, i);
+            return 0;
+        }
+    }
+    if (corpus->count == corpus->capacity) {
+        corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 64;
+        corpus->docs = (Document**)realloc(corpus->docs, corpus->capacity * sizeof(Document*));
+    }
+    corpus->docs[corpus->count] = doc;
+    if (corpus->lsh != NULL) lsh_add(corpus->lsh, doc, corpus->count);
+    corpus->count++;
+    return 1;
+}
+
+static void latency_record(LatencyLog* log, double ms) {
+    pthread_mutex_lock(&log->lock);
+    log->samples[log->total % SERVER_LATENCY_SAMPLES] = ms;
+    log->total++;
+    pthread_mutex_unlock(&log->lock);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static long latency_percentiles(LatencyLog* log, double* p50, double* p99) {
+    double samples[SERVER_LATENCY_SAMPLES];
+    pthread_mutex_lock(&log->lock);
+    long total = log->total;
+    int n = total < SERVER_LATENCY_SAMPLES ? (int)total : SERVER_LATENCY_SAMPLES;
+    memcpy(samples, log->samples, n * sizeof(double));
+    pthread_mutex_unlock(&log->lock);
+
+    *p50 = *p99 = 0.0;
+    if (n > 0) {
+        qsort(samples, n, sizeof(double), compare_doubles);
+        *p50 = samples[(n - 1) * 50 / 100];
+        *p99 = samples[(n - 1) * 99 / 100];
+    }
+    return total;
+}
+
+// HTTP
+static const char* status_reason(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        default: return "Internal Server Error";
+    }
+}
+
+static int send_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = write(fd, data, length);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+// With --allow-origin, responses let that one origin read them
+static void send_response(int fd, int status, const char* body, size_t length) {
+    char cors[384] = "";
+    if (allowed_origin != NULL) {
+        snprintf(cors, sizeof(cors),
+                 "Access-Control-Allow-Origin: %s\r\n"
+                 "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n"
+                 "Access-Control-Allow-Headers: Content-Type\r\n",
+                 allowed_origin);
+    }
+    char header[768];
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %zu\r\n"
+        "%s"
+        "Connection: close\r\n\r\n",
+        status, status_reason(status), length, cors);
+    if (send_all(fd, header, (size_t)header_length) == 0 && length > 0) {
+        send_all(fd, body, length);
+    }
+}
+
+static void send_error(int fd, int status, const char* message) {
+    char body[256];
+    int length = snprintf(body, sizeof(body), "{\"error\": \"%s\"}\n", message);
+    send_response(fd, status, body, (size_t)length);
+}
+
+// Reads one request. Returns 0, an HTTP status to answer with, or -1 if
+// the connection is unusable; request->body is malloc'd only on 0.
+int http_read_request(int fd, HttpRequest* request) {
+    request->body = NULL;
+    request->body_length = 0;
+    request->has_origin = 0;
+    request->origin[0] = '\0';
+    size_t capacity = 8192, used = 0;
+    char* buffer = (char*)malloc(capacity + 1);
+    char* header_end = NULL;
+
+    while (header_end == NULL) {
+        if (used == capacity) {
+            if (capacity >= 64 * 1024) {
+                free(buffer);
+                return 400;
+            }
+            capacity *= 2;
+            buffer = (char*)realloc(buffer, capacity + 1);
+        }
+        ssize_t got = read(fd, buffer + used, capacity - used);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            free(buffer);
+            return -1;
+        }
+        used += (size_t)got;
+        buffer[used] = '\0';
+        header_end = strstr(buffer, "\r\n\r\n");
+    }
+
+    char target[sizeof(request->path) + sizeof(request->query)];
+    if (sscanf(buffer, "%7s %1279s", request->method, target) != 2) {
+        free(buffer);
+        return 400;
+    }
+    char* question = strchr(target, '?');
+    if (question != NULL) *question = '\0';
+    snprintf(request->path, sizeof(request->path), "%.*s", (int)sizeof(request->path) - 1, target);
+    snprintf(request->query, sizeof(request->query), "%s", question != NULL ? question + 1 : "");
+
+    size_t content_length = 0;
+    for (char* line = strstr(buffer, "\r\n"); line != NULL && line < header_end;
+         line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            content_length = (size_t)strtoull(line + 17, NULL, 10);
+        } else if (strncasecmp(line + 2, "Origin:", 7) == 0) {
+            const char* value = line + 9;
+            while (*value == ' ' || *value == '\t') value++;
+            size_t value_length = strcspn(value, "\r");
+            if (value_length >= sizeof(request->origin)) value_length = sizeof(request->origin) - 1;
+            memcpy(request->origin, value, value_length);
+            request->origin[value_length] = '\0';
+            request->has_origin = 1;
+        }
+    }
+    if (content_length > SERVER_MAX_BODY) {
+        free(buffer);
+        return 413;
+    }
+
+    // Part of the body may have arrived with the headers
+    size_t header_length = (size_t)(header_end - buffer) + 4;
+    size_t have = used - header_length;
+    if (have > content_length) have = content_length;
+    request->body = (char*)malloc(content_length + 1);
+    memcpy(request->body, buffer + header_length, have);
+    free(buffer);
+
+    while (have < content_length) {
+        ssize_t got = read(fd, request->body + have, content_length - have);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            free(request->body);
+            request->body = NULL;
+            return -1;
+        }
+        have += (size_t)got;
+    }
+    request->body[content_length] = '\0';
+    request->body_length = content_length;
+    return 0;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Copies the URL-decoded value of `key` from a query string. Returns 1 if
+// the key is present.
+int http_query_param(const char* query, const char* key, char* out, size_t size) {
+    size_t key_length = strlen(key);
+    const char* p = query;
+    while (*p) {
+        const char* end = strchr(p, '&');
+        if (end == NULL) end = p + strlen(p);
+        if ((size_t)(end - p) > key_length && strncmp(p, key, key_length) == 0 && p[key_length] == '=') {
+            size_t used = 0;
+            for (const char* c = p + key_length + 1; c < end && used + 1 < size; c++) {
+                if (*c == '%' && c + 2 < end && hex_value(c[1]) >= 0 && hex_value(c[2]) >= 0) {
+                    out[used++] = (char)(hex_value(c[1]) * 16 + hex_value(c[2]));
+                    c += 2;
+                } else {
+                    out[used++] = *c == '+' ? ' ' : *c;
+                }
+            }
+            out[used] = '\0';
+            return 1;
+        }
+        p = *end ? end + 1 : end;
+    }
+    return 0;
+}
+
+// Handlers
+static void handle_check(Server* server, int fd, HttpRequest* request) {
+    char name[MAX_FILENAME_LENGTH];
+    if (!http_query_param(request->query, "name", name, sizeof(name)) || name[0] == '\0') {
+        strcpy(name, "target");
+    }
+    if (request->body_length == 0) {
+        send_error(fd, 400, "empty target text");
+        return;
+    }
+
+    Document* target = create_document(name);
+    preprocess_document_buffer(target, request->body, request->body_length);
+    generate_winnowed_kgrams(target, server->config.k, server->config.window);
+
+    Corpus* corpus = &server->corpus;
+    pthread_rwlock_rdlock(&corpus->lock);
+    int* selected = (int*)malloc((corpus->count > 0 ? corpus->count : 1) * sizeof(int));
+    int count;
+    if (corpus->lsh != NULL) {
+        count = lsh_query(corpus->lsh, target, selected);
+    } else {
+        count = corpus->count;
+        for (int i = 0; i < count; i++) selected[i] = i;
+    }
+
+    SimilarityResult* results = (SimilarityResult*)calloc(count > 0 ? count : 1, sizeof(SimilarityResult));
+    int scored = 0;
+    for (int i = 0; i < count; i++) {
+        Document* reference = corpus->docs[selected[i]];
+        SimilarityResult* result = &results[scored];
+        if (!compute_similarity_above(target->kgrams, reference->kgrams, result)) continue;
+        scored++;
+        strcpy(result->filename, reference->filename);
+        compute_k_scores(target, reference, result);
+        find_common_phrases(target, reference, result);
+        compute_similarity_heatmap(target, reference, result);
+        find_fuzzy_passages(target, reference, result);
+    }
+    pthread_rwlock_unlock(&corpus->lock);
+    count = scored;
+
+    char* json = NULL;
+    size_t json_length = 0;
+    FILE* stream = open_memstream(&json, &json_length);
+    write_json_report(stream, results, count, target, server->config.k);
+    fclose(stream);
+    send_response(fd, 200, json, json_length);
+
+    free(json);
+    for (int i = 0; i < count; i++) {
+        free_similarity_result(&results[i]);
+    }
+    free(results);
+    free(selected);
+    free_document(target);
+}
+
+// Resolves `path` (taken relative to the reference root) and returns 1
+// when it exists and lies under the root, symlinks followed
+static int resolve_under_root(const Server* server, const char* path, char* resolved) {
+    char joined[PATH_MAX + MAX_FILENAME_LENGTH + 2];
+    if (path[0] == '/' && strncmp(path, server->reference_root, strlen(server->reference_root)) == 0) {
+        snprintf(joined, sizeof(joined), "%s", path);
+    } else {
+        snprintf(joined, sizeof(joined), "%s/%s", server->reference_root, path);
+    }
+    if (realpath(joined, resolved) == NULL) return 0;
+    size_t root_length = strlen(server->reference_root);
+    return strncmp(resolved, server->reference_root, root_length) == 0 &&
+           (resolved[root_length] == '/' || resolved[root_length] == '\0');
+}
+
+static void handle_add_references(Server* server, int fd, HttpRequest* request) {
+    char name[MAX_FILENAME_LENGTH];
+    int added = 0, replaced = 0;
+
+    if (http_query_param(request->query, "path", name, sizeof(name))) {
+        char resolved[PATH_MAX];
+        if (server->reference_root[0] == '\0') {
+            send_error(fd, 403, "?path= needs the server started with --reference-root");
+            return;
+        }
+        if (!resolve_under_root(server, name, resolved)) {
+            send_error(fd, 403, "path is not under the reference root");
+            return;
+        }
+        const char* paths[1] = { resolved };
+        int file_count = 0;
+        char** files = collect_input_files(paths, 1, &file_count);
+        for (int i = 0; i < file_count; i++) {
+            // A directory entry may be a symlink out of the root
+            char file[PATH_MAX];
+            if (!resolve_under_root(server, files[i], file)) {
+                free(files[i]);
+                continue;
+            }
+            Document* doc = load_document(files[i], server->config.k, server->config.window);
+            if (doc != NULL) {
+                pthread_rwlock_wrlock(&server->corpus.lock);
+                if (corpus_add(&server->corpus, doc)) added++; else replaced++;
+                pthread_rwlock_unlock(&server->corpus.lock);
+            }
+            free(files[i]);
+        }
+        free(files);
+    } else if (http_query_param(request->query, "name", name, sizeof(name)) && name[0] != '\0') {
+        Document* doc = create_document(name);
+        preprocess_document_buffer(doc, request->body, request->body_length);
+        generate_winnowed_kgrams(doc, server->config.k, server->config.window);
+        pthread_rwlock_wrlock(&server->corpus.lock);
+        if (corpus_add(&server->corpus, doc)) added++; else replaced++;
+        pthread_rwlock_unlock(&server->corpus.lock);
+    } else {
+        send_error(fd, 400, "expected ?name=<reference> or ?path=<file|dir>");
+        return;
+    }
+
+    pthread_rwlock_rdlock(&server->corpus.lock);
+    int total = server->corpus.count;
+    pthread_rwlock_unlock(&server->corpus.lock);
+
+    char body[128];
+    int length = snprintf(body, sizeof(body), "{\"added\": %d, \"replaced\": %d, \"references\": %d}\n",
+                          added, replaced, total);
+    send_response(fd, 200, body, (size_t)length);
+}
+
+static void handle_stats(Server* server, int fd) {
+    double p50, p99;
+    long checks = latency_percentiles(&server->checks, &p50, &p99);
+
+    pthread_rwlock_rdlock(&server->corpus.lock);
+    int references = server->corpus.count;
+    pthread_rwlock_unlock(&server->corpus.lock);
+
+    char body[256];
+    int length = snprintf(body, sizeof(body),
+        "{\"references\": %d, \"k_value\": %d, \"window\": %d, \"checks\": %ld, "
+        "\"p50_ms\": %.3f, \"p99_ms\": %.3f}\n",
+        references, server->config.k, server->config.window, checks, p50, p99);
+    send_response(fd, 200, body, (size_t)length);
+}
+
+static void handle_connection(Server* server, int fd) {
+    struct timeval timeout = { SERVER_RECEIVE_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    HttpRequest request;
+    int status = http_read_request(fd, &request);
+    if (status != 0) {
+        if (status > 0) send_error(fd, status, status_reason(status));
+        close(fd);
+        return;
+    }
+
+    // Browsers always say where a cross-site request comes from
+    if (request.has_origin && (allowed_origin == NULL || strcmp(request.origin, allowed_origin) != 0)) {
+        send_error(fd, 403, "origin not allowed");
+        free(request.body);
+        close(fd);
+        return;
+    }
+
+    int is_post = strcmp(request.method, "POST") == 0;
+    if (strcmp(request.method, "OPTIONS") == 0) {
+        send_response(fd, 204, NULL, 0);
+    } else if (strcmp(request.path, "/check") == 0) {
+        if (is_post) {
+            double start = now_ms();
+            handle_check(server, fd, &request);
+            latency_record(&server->checks, now_ms() - start);
+        } else {
+            send_error(fd, 405, "use POST");
+        }
+    } else if (strcmp(request.path, "/references") == 0) {
+        if (is_post) {
+            handle_add_references(server, fd, &request);
+        } else {
+            send_error(fd, 405, "use POST");
+        }
+    } else if (strcmp(request.path, "/stats") == 0) {
+        handle_stats(server, fd);
+    } else {
+        send_error(fd, 404, "unknown endpoint");
+    }
+
+    free(request.body);
+    close(fd);
+}
+
+static void* server_worker(void* arg) {
+    Server* server = (Server*)arg;
+    while (!server_stopping) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        handle_connection(server, fd);
+    }
+    return NULL;
+}
+
+static void stop_server(int signal_number) {
+    (void)signal_number;
+    server_stopping = 1;
+}
+
+// Startup
+typedef struct ServerLoadJob {
+    char** files;
+    Document** docs;
+    int k;
+    int window;
+} ServerLoadJob;
+
+static void server_load_task(void* arg, int i) {
+    ServerLoadJob* job = (ServerLoadJob*)arg;
+    job->docs[i] = load_document(job->files[i], job->k, job->window);
+}
+
+static int open_listener(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 128) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int run_server(const ServerConfig* config, const char** paths, int path_count) {
+    Server* server = (Server*)calloc(1, sizeof(Server));
+    server->config = *config;
+    if (server->config.workers < 1) server->config.workers = SERVER_DEFAULT_WORKERS;
+    if (config->reference_root != NULL && realpath(config->reference_root, server->reference_root) == NULL) {
+        printf("Error: Cannot resolve reference root %s\n", config->reference_root);
+        free(server);
+        return 1;
+    }
+    allowed_origin = config->allow_origin;
+    pthread_rwlock_init(&server->corpus.lock, NULL);
+    pthread_mutex_init(&server->checks.lock, NULL);
+    if (config->lsh_threshold > 0.0) {
+        int bands, rows;
+        lsh_choose_bands(config->lsh_threshold, &bands, &rows);
+        server->corpus.lsh = create_lsh_index(bands, rows);
+    }
+
+    // Fingerprint the initial corpus once, in parallel
+    int file_count = 0;
+    char** files = collect_input_files(paths, path_count, &file_count);
+    Document** docs = (Document**)calloc(file_count > 0 ? file_count : 1, sizeof(Document*));
+    ThreadPool* pool = create_thread_pool(server->config.workers);
+    ServerLoadJob load = { files, docs, config->k, config->window };
+    thread_pool_run(pool, file_count, server_load_task, &load);
+    free_thread_pool(pool);
+    for (int i = 0; i < file_count; i++) {
+        if (docs[i] != NULL) {
+            corpus_add(&server->corpus, docs[i]);
+        } else {
+            printf("Warning: Cannot open reference file %s, skipping\n", files[i]);
+        }
+        free(files[i]);
+    }
+    free(files);
+    free(docs);
+
+    server->listen_fd = open_listener(config->port);
+    if (server->listen_fd < 0) {
+        printf("Error: Cannot listen on 127.0.0.1:%d\n", config->port);
+        return 1;
+    }
+
+    // Workers never see SIGINT/SIGTERM; the main thread does, without
+    // SA_RESTART, so its accept() returns and it can report and exit
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t stop_signals, previous;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &previous);
+    for (int i = 1; i < server->config.workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, server_worker, server) == 0) {
+            pthread_detach(thread);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    printf("Serving %d references on http://127.0.0.1:%d (k=%d, window=%d, %d workers)\n",
+           server->corpus.count, config->port, config->k, config->window, server->config.workers);
+    fflush(stdout);
+    server_worker(server);
+
+    double p50, p99;
+    long checks = latency_percentiles(&server->checks, &p50, &p99);
+    printf("\nServed %ld checks, p50 %.3f ms, p99 %.3f ms\n", checks, p50, p99);
+    close(server->listen_fd);
+    return 0;
+}
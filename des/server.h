@@ -0,0 +1,58 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "plagiarism.h"
+
+#define SERVER_DEFAULT_WORKERS 4
+#define SERVER_MAX_BODY (256 * 1024 * 1024)
+#define SERVER_LATENCY_SAMPLES 4096
+#define SERVER_RECEIVE_TIMEOUT 10
+
+// Checker Daemon
+// Loads and fingerprints the reference corpus once, then answers checks
+// over HTTP on 127.0.0.1:<port>. Every worker thread blocks in accept() on
+// the shared socket, so requests are served concurrently; the corpus sits
+// behind a read-write lock so checks run in parallel while a hot-add only
+// holds the lock to publish the already fingerprinted document.
+//
+//   POST /check?name=<target>         body: target text
+//        -> the same JSON report that write_json_results writes
+//   POST /references?name=<name>      body: reference text (replaces a
+//                                     reference of the same name)
+//   POST /references?path=<file|dir>  loads files on the server side, from
+//                                     under --reference-root only
+//   GET  /stats                       corpus size and p50/p99 latency
+//
+// Any web page the user has open can reach 127.0.0.1, and a text/plain
+// POST needs no preflight. So a request that carries an Origin header is
+// refused unless it is the one origin given with --allow-origin (use
+// "null" for index.html opened from file://). Only that origin is named
+// in the CORS headers.
+
+typedef struct ServerConfig {
+    int port;
+    int k;
+    int window;
+    int workers;
+    double lsh_threshold;      // 0 scores every reference
+    const char* allow_origin;  // the browser origin allowed in, NULL allows none
+    const char* reference_root;  // ?path= stays under it, NULL turns ?path= off
+} ServerConfig;
+
+// One parsed HTTP/1.x request; the body is read in full, up to
+// SERVER_MAX_BODY
+typedef struct HttpRequest {
+    char method[8];
+    char path[256];
+    char query[1024];
+    char origin[256];          // the Origin header, "" when absent
+    int has_origin;
+    char* body;
+    size_t body_length;
+} HttpRequest;
+
+int http_read_request(int fd, HttpRequest* request);
+int http_query_param(const char* query, const char* key, char* out, size_t size);
+int run_server(const ServerConfig* config, const char** paths, int path_count);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include "../plagiarism.h"
+
+// Behavior Tests
+// Each tests/test_*.c is its own program, run by `make test`. A failed
+// check prints where it failed and the program exits nonzero at the end,
+// so one run reports every failure rather than the first.
+
+static int check_failures = 0;
+
+#define CHECK(condition)                                                        \
+    do {                                                                        \
+        if (!(condition)) {                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                    #condition);                                                \
+            check_failures++;                                                   \
+        }                                                                       \
+    } while (0)
+
+#define CHECK_INT(actual, expected)                                             \
+    do {                                                                        \
+        long long check_a = (long long)(actual), check_e = (long long)(expected); \
+        if (check_a != check_e) {                                               \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__,     \
+                    __LINE__, #actual, check_a, check_e);                       \
+            check_failures++;                                                   \
+        }                                                                       \
+    } while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance)                                 \
+    do {                                                                        \
+        double check_a = (actual), check_e = (expected);                        \
+        if (fabs(check_a - check_e) > (tolerance)) {                            \
+            fprintf(stderr, "%s:%d: %s is %g, expected %g\n", __FILE__,         \
+                    __LINE__, #actual, check_a, check_e);                       \
+            check_failures++;                                                   \
+        }                                                                       \
+    } while (0)
+
+static inline int check_report(const char* name) {
+    printf("%-24s %s\n", name, check_failures == 0 ? "ok" : "FAILED");
+    return check_failures == 0 ? 0 : 1;
+}
+
+// Tokenizes and fingerprints `text` as a document called `name`
+static inline Document* check_document(const char* name, const char* text, int k, int window) {
+    Document* doc = create_document(name);
+    preprocess_document(doc, text);
+    generate_winnowed_kgrams(doc, k, window);
+    return doc;
+}
+
+// Deterministic text of `words` words over a vocabulary of `vocabulary`
+// made-up words, from `seed`. Words are 'w' and the word's number in
+// base-26 letters, since the tokenizer drops digits.
+static inline char* check_text(unsigned int seed, int words, int vocabulary) {
+    char* text = (char*)malloc((size_t)words * 12 + 1);
+    size_t used = 0;
+    for (int i = 0; i < words; i++) {
+        seed = seed * 1103515245u + 12345u;
+        unsigned int number = (seed >> 8) % (unsigned int)vocabulary;
+        if (i > 0) text[used++] = ' ';
+        text[used++] = 'w';
+        do {
+            text[used++] = (char)('a' + number % 26);
+            number /= 26;
+        } while (number > 0);
+    }
+    text[used] = '\0';
+    return text;
+}
+
+#endif
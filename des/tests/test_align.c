@@ -0,0 +1,140 @@
+#include "check.h"
+
+static unsigned int random_state = 12345u;
+
+static unsigned int next_random(void) {
+    random_state = random_state * 1103515245u + 12345u;
+    return random_state >> 8;
+}
+
+// Semi-global edit distance by the full table: the best score of
+// pattern[0..m) against any run of text[0..n), and the first text index
+// where a run scoring below m ends (-1 if none does)
+static int dp_search(const uint32_t* pattern, int m, const uint32_t* text, int n, int* end) {
+    int* previous = (int*)malloc((size_t)(m + 1) * sizeof(int));
+    int* current = (int*)malloc((size_t)(m + 1) * sizeof(int));
+    for (int i = 0; i <= m; i++) previous[i] = i;
+    int best = m;
+    *end = -1;
+    for (int j = 0; j < n; j++) {
+        current[0] = 0;
+        for (int i = 1; i <= m; i++) {
+            int substitute = previous[i - 1] + (pattern[i - 1] != text[j]);
+            int skip_text = previous[i] + 1;
+            int skip_pattern = current[i - 1] + 1;
+            int cost = substitute < skip_text ? substitute : skip_text;
+            current[i] = cost < skip_pattern ? cost : skip_pattern;
+        }
+        if (current[m] < best) {
+            best = current[m];
+            *end = j;
+        }
+        int* swap = previous; previous = current; current = swap;
+    }
+    free(previous);
+    free(current);
+    return best;
+}
+
+// Global edit distance between two token runs
+static int dp_distance(const uint32_t* a, int a_length, const uint32_t* b, int b_length) {
+    int* previous = (int*)malloc((size_t)(b_length + 1) * sizeof(int));
+    int* current = (int*)malloc((size_t)(b_length + 1) * sizeof(int));
+    for (int j = 0; j <= b_length; j++) previous[j] = j;
+    for (int i = 1; i <= a_length; i++) {
+        current[0] = i;
+        for (int j = 1; j <= b_length; j++) {
+            int substitute = previous[j - 1] + (a[i - 1] != b[j - 1]);
+            int deleted = previous[j] + 1;
+            int inserted = current[j - 1] + 1;
+            int cost = substitute < deleted ? substitute : deleted;
+            current[j] = cost < inserted ? cost : inserted;
+        }
+        int* swap = previous; previous = current; current = swap;
+    }
+    int distance = previous[b_length];
+    free(previous);
+    free(current);
+    return distance;
+}
+
+// The bit-parallel search agrees with the table across the single-word
+// case and patterns spanning several 64-row blocks; the text is an edited
+// copy of the pattern inside noise over a small alphabet
+static void test_search_matches_dp(void) {
+    uint32_t pattern[300], text[700];
+    for (int round = 0; round < 600; round++) {
+        int m = 1 + (int)(next_random() % (round < 300 ? 70 : 300));
+        int alphabet = 2 + (int)(next_random() % 6);
+        for (int i = 0; i < m; i++) pattern[i] = next_random() % (unsigned int)alphabet;
+        int n = 0;
+        int noise = (int)(next_random() % 100);
+        for (int i = 0; i < noise; i++) text[n++] = next_random() % (unsigned int)alphabet;
+        for (int i = 0; i < m; i++) {
+            unsigned int edit = next_random() % 10;
+            if (edit == 0) continue;                                   // deleted
+            if (edit == 1) text[n++] = next_random() % (unsigned int)alphabet;  // inserted
+            text[n++] = edit == 2 ? (pattern[i] + 1) % (unsigned int)alphabet : pattern[i];
+        }
+        noise = (int)(next_random() % 100);
+        for (int i = 0; i < noise; i++) text[n++] = next_random() % (unsigned int)alphabet;
+
+        int expected_end, end;
+        int expected = dp_search(pattern, m, text, n, &expected_end);
+        CHECK_INT(token_edit_search(pattern, m, text, n, &end), expected);
+        CHECK_INT(end, expected_end);
+    }
+    int end;
+    CHECK_INT(token_edit_search(pattern, 5, text, 0, &end), 5);
+    CHECK_INT(end, -1);
+}
+
+// A copied paragraph with scattered substitutions comes back as one fuzzy
+// passage, whose edit count is the distance between its two runs
+static void test_fuzzy_passage_edits(void) {
+    char* text = check_text(9u, 300, 5000);
+    char* edited = (char*)malloc(strlen(text) * 2 + 64);
+    size_t used = 0;
+    int word = 0;
+    for (const char* c = text; ; c++) {
+        if (*c == ' ' || *c == '\0') {
+            if (word % 40 == 20) used += (size_t)sprintf(edited + used, "zzchanged");
+            word++;
+        }
+        if (*c == '\0') break;
+        edited[used++] = *c;
+    }
+    edited[used] = '\0';
+
+    Document* target = check_document("target", edited, 5, 1);
+    Document* reference = check_document("reference", text, 5, 1);
+    fuzzy_min_similarity = 0.8;
+    SimilarityResult result;
+    memset(&result, 0, sizeof(result));
+    find_fuzzy_passages(target, reference, &result);
+    CHECK(result.fuzzy_passage_count >= 1);
+    if (result.fuzzy_passage_count >= 1) {
+        FuzzyPassage* passage = &result.fuzzy_passages[0];
+        CHECK(passage->length > 100);
+        CHECK(passage->edits > 0);
+        CHECK_INT(passage->edits,
+                  dp_distance(target->token_ids + passage->target_start, passage->length,
+                              reference->token_ids + passage->ref_start, passage->ref_length));
+        CHECK_NEAR(passage->similarity,
+                   1.0 - (double)passage->edits /
+                   (passage->length > passage->ref_length ? passage->length : passage->ref_length),
+                   1e-12);
+    }
+    free_similarity_result(&result);
+    fuzzy_min_similarity = 0.0;
+    free_document(target);
+    free_document(reference);
+    free(edited);
+    free(text);
+}
+
+int main(void) {
+    test_search_matches_dp();
+    test_fuzzy_passage_edits();
+    return check_report("align");
+}
@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200809L
+#include "check.h"
+#include "../allpairs.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define FAMILIES 4
+#define FAMILY_SIZE 3
+#define ALLPAIRS_TEST_DOCS (FAMILIES * FAMILY_SIZE)
+
+static char directory[64];
+static char paths[ALLPAIRS_TEST_DOCS][96];
+static const char* path_list[ALLPAIRS_TEST_DOCS];
+static Document* docs[ALLPAIRS_TEST_DOCS];
+
+// Silences the progress lines run_all_pairs prints
+static int saved_stdout = -1;
+
+static void quiet(int enabled) {
+    fflush(stdout);
+    if (enabled) {
+        saved_stdout = dup(STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    } else {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+}
+
+// Families of near-copies of one base text over a large vocabulary, so
+// different families share nothing but a boilerplate line every
+// document carries
+static void write_documents(void) {
+    strcpy(directory, "/tmp/plagiarism-allpairs-XXXXXX");
+    CHECK(mkdtemp(directory) != NULL);
+    char* boilerplate = check_text(77u, 40, 100000);
+    for (int d = 0; d < ALLPAIRS_TEST_DOCS; d++) {
+        snprintf(paths[d], sizeof(paths[d]), "%s/doc%02d.txt", directory, d);
+        path_list[d] = paths[d];
+        char* base = check_text(1000u + (unsigned int)(d / FAMILY_SIZE), 600, 100000);
+        char* edit = check_text(2000u + (unsigned int)d, 30, 100000);
+        size_t half = strlen(base) / 2;
+        while (base[half] != ' ') half++;
+        FILE* fp = fopen(paths[d], "w");
+        fprintf(fp, "%.*s %s%s\n%s\n", (int)half, base, edit, base + half, boilerplate);
+        fclose(fp);
+        docs[d] = load_document(paths[d], 4, 2);
+        free(edit);
+        free(base);
+    }
+    free(boilerplate);
+}
+
+static int run_matrix(int df_cap, int shared[ALLPAIRS_TEST_DOCS][ALLPAIRS_TEST_DOCS],
+                      int* clusters) {
+    AllPairsConfig config;
+    memset(&config, 0, sizeof(config));
+    config.k = 4;
+    config.window = 2;
+    config.threads = 3;
+    config.df_cap = df_cap;
+    config.cluster_threshold = 0.5;
+    config.io = PIPELINE_IO_THREADS;
+    FILE* output = tmpfile();
+    quiet(1);
+    CHECK_INT(run_all_pairs(&config, path_list, ALLPAIRS_TEST_DOCS, output), 0);
+    quiet(0);
+
+    memset(shared, 0, sizeof(int) * ALLPAIRS_TEST_DOCS * ALLPAIRS_TEST_DOCS);
+    *clusters = 0;
+    rewind(output);
+    char line[512];
+    int pairs = 0;
+    while (fgets(line, sizeof(line), output) != NULL) {
+        int a, b, matching;
+        const char* pair = strstr(line, "{\"a\": ");
+        const char* kgrams = strstr(line, "\"matching_kgrams\": ");
+        if (pair != NULL && kgrams != NULL && sscanf(pair, "{\"a\": %d, \"b\": %d", &a, &b) == 2 &&
+            sscanf(kgrams, "\"matching_kgrams\": %d", &matching) == 1) {
+            CHECK(a < b);
+            shared[a][b] = matching;
+            pairs++;
+        }
+        if (strstr(line, "{\"size\": ") != NULL) (*clusters)++;
+    }
+    fclose(output);
+    return pairs;
+}
+
+// Posting-list counting gives the pairs and overlaps a direct merge of
+// the two fingerprint sets gives
+static void test_counts_match_direct(void) {
+    int shared[ALLPAIRS_TEST_DOCS][ALLPAIRS_TEST_DOCS];
+    int clusters;
+    int pairs = run_matrix(0, shared, &clusters);
+    int expected = 0;
+    for (int a = 0; a < ALLPAIRS_TEST_DOCS; a++) {
+        for (int b = a + 1; b < ALLPAIRS_TEST_DOCS; b++) {
+            int direct = hash_set_intersection_size(docs[a]->kgrams, docs[b]->kgrams);
+            CHECK(direct > 0);
+            expected += direct > 0;
+            CHECK_INT(shared[a][b], direct);
+        }
+    }
+    CHECK_INT(pairs, expected);
+    CHECK_INT(clusters, FAMILIES);
+}
+
+// Past the df cap, the boilerplate no longer pairs families up, and the
+// pairs found through other fingerprints keep their exact overlap
+static void test_df_cap_keeps_found_pairs_exact(void) {
+    int shared[ALLPAIRS_TEST_DOCS][ALLPAIRS_TEST_DOCS];
+    int clusters;
+    int pairs = run_matrix(FAMILY_SIZE * 2, shared, &clusters);
+    for (int a = 0; a < ALLPAIRS_TEST_DOCS; a++) {
+        for (int b = a + 1; b < ALLPAIRS_TEST_DOCS; b++) {
+            int same_family = a / FAMILY_SIZE == b / FAMILY_SIZE;
+            int direct = hash_set_intersection_size(docs[a]->kgrams, docs[b]->kgrams);
+            CHECK_INT(shared[a][b], same_family ? direct : 0);
+        }
+    }
+    CHECK_INT(pairs, FAMILIES * FAMILY_SIZE * (FAMILY_SIZE - 1) / 2);
+    CHECK_INT(clusters, FAMILIES);
+}
+
+int main(void) {
+    write_documents();
+    test_counts_match_direct();
+    test_df_cap_keeps_found_pairs_exact();
+    for (int d = 0; d < ALLPAIRS_TEST_DOCS; d++) {
+        free_document(docs[d]);
+        unlink(paths[d]);
+    }
+    rmdir(directory);
+    return check_report("allpairs");
+}
@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L
+#include "check.h"
+#include "../cache.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char directory[64];
+static char text_path[96];
+
+static void write_file(const char* path, const char* text) {
+    FILE* fp = fopen(path, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+// Same k-gram set, sorted view and signature
+static void check_same_fingerprints(Document* actual, Document* expected) {
+    CHECK_INT(actual->kgrams->count, expected->kgrams->count);
+    CHECK_INT(actual->kgram_count, expected->kgram_count);
+    if (actual->kgrams->count != expected->kgrams->count) return;
+    const uint64_t* a = hash_set_sorted_fingerprints(actual->kgrams);
+    const uint64_t* b = hash_set_sorted_fingerprints(expected->kgrams);
+    CHECK(memcmp(a, b, (size_t)expected->kgrams->count * sizeof(uint64_t)) == 0);
+    CHECK(memcmp(actual->minhash, expected->minhash, sizeof(expected->minhash)) == 0);
+}
+
+// A miss stores the entry, a hit reads back what processing the text
+// directly gives, varint gaps and all, and tokens come on first use
+static void test_round_trip(void) {
+    char* text = check_text(5u, 3000, 4000);
+    write_file(text_path, text);
+    Document* direct = check_document(text_path, text, 5, 4);
+    free(text);
+
+    int hit = -1;
+    Document* stored = load_cached_document(directory, text_path, 5, 4, &hit);
+    CHECK_INT(hit, 0);
+    check_same_fingerprints(stored, direct);
+    free_document(stored);
+
+    Document* cached = load_cached_document(directory, text_path, 5, 4, &hit);
+    CHECK_INT(hit, 1);
+    CHECK_INT(cached->tokens_pending, 1);
+    check_same_fingerprints(cached, direct);
+    CHECK_INT(ensure_document_tokens(cached), 0);
+    CHECK_INT(cached->token_count, direct->token_count);
+    check_same_fingerprints(cached, direct);
+    free_document(cached);
+
+    // Another window is another entry
+    Document* other = load_cached_document(directory, text_path, 5, 1, &hit);
+    CHECK_INT(hit, 0);
+    free_document(other);
+    free_document(direct);
+}
+
+// A file rewritten between the cache answering and its tokens being read
+// is fingerprinted again from what is now on disk
+static void test_changed_file_is_refingerprinted(void) {
+    char* text = check_text(11u, 800, 300);
+    write_file(text_path, text);
+    free(text);
+    int hit = -1;
+    free_document(load_cached_document(directory, text_path, 4, 2, &hit));
+    Document* cached = load_cached_document(directory, text_path, 4, 2, &hit);
+    CHECK_INT(hit, 1);
+
+    text = check_text(12u, 500, 300);
+    write_file(text_path, text);
+    Document* direct = check_document(text_path, text, 4, 2);
+    free(text);
+
+    CHECK_INT(ensure_document_tokens(cached), 0);
+    CHECK_INT(cached->tokens_pending, 0);
+    CHECK_INT(cached->token_count, direct->token_count);
+    check_same_fingerprints(cached, direct);
+    CHECK_NEAR(jaccard_similarity(cached->kgrams, direct->kgrams), 1.0, 1e-9);
+    free_document(direct);
+    free_document(cached);
+}
+
+// Path of the one entry in the cache directory
+static int find_entry(char* path, size_t size) {
+    DIR* dir = opendir(directory);
+    struct dirent* entry;
+    int found = 0;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length > 3 && strcmp(entry->d_name + length - 3, ".fp") == 0) {
+            snprintf(path, size, "%s/%s", directory, entry->d_name);
+            found++;
+        }
+    }
+    if (dir != NULL) closedir(dir);
+    return found == 1;
+}
+
+// Rewrites the entry with its header changed by `corrupt` and `extra`
+// bytes appended; the next load must miss, fingerprint the text again and
+// replace the entry
+static void check_corrupt_entry(void (*corrupt)(CacheHeader*), int extra) {
+    char entry[512];
+    CHECK(find_entry(entry, sizeof(entry)));
+    FILE* fp = fopen(entry, "r+b");
+    CacheHeader header;
+    CHECK_INT(fread(&header, sizeof(header), 1, fp), 1);
+    if (corrupt != NULL) corrupt(&header);
+    rewind(fp);
+    fwrite(&header, sizeof(header), 1, fp);
+    fseek(fp, 0, SEEK_END);
+    for (int i = 0; i < extra; i++) fputc(0x01, fp);
+    if (extra > 0) {
+        // Keeps payload_size consistent, so only the varint walk can tell
+        long size = ftell(fp);
+        header.payload_size = (uint64_t)size - sizeof(CacheHeader) - MINHASH_SIZE * sizeof(uint64_t);
+        rewind(fp);
+        fwrite(&header, sizeof(header), 1, fp);
+    }
+    fclose(fp);
+
+    int hit = -1;
+    Document* doc = load_cached_document(directory, text_path, 4, 2, &hit);
+    CHECK_INT(hit, 0);
+    CHECK(doc != NULL && doc->kgrams->count > 0);
+    free_document(doc);
+    doc = load_cached_document(directory, text_path, 4, 2, &hit);
+    CHECK_INT(hit, 1);
+    free_document(doc);
+}
+
+static void huge_count(CacheHeader* header) {
+    header->fingerprint_count = 0xffffffffu;
+}
+
+static void count_past_payload(CacheHeader* header) {
+    header->fingerprint_count = (uint32_t)header->payload_size + 1;
+}
+
+static void short_count(CacheHeader* header) {
+    header->fingerprint_count--;
+}
+
+// Entries whose counts disagree with their payload are misses, never
+// trusted to size an allocation
+static void test_corrupt_entries_are_misses(void) {
+    char* text = check_text(13u, 700, 300);
+    write_file(text_path, text);
+    free(text);
+    int hit = -1;
+    free_document(load_cached_document(directory, text_path, 4, 2, &hit));
+    check_corrupt_entry(huge_count, 0);
+    check_corrupt_entry(count_past_payload, 0);
+    check_corrupt_entry(short_count, 0);
+    check_corrupt_entry(NULL, 3);
+}
+
+static void remove_directory(void) {
+    DIR* dir = opendir(directory);
+    struct dirent* entry;
+    char path[512];
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        unlink(path);
+    }
+    if (dir != NULL) closedir(dir);
+    rmdir(directory);
+}
+
+int main(void) {
+    strcpy(directory, "/tmp/plagiarism-cache-XXXXXX");
+    CHECK(mkdtemp(directory) != NULL);
+    snprintf(text_path, sizeof(text_path), "%s/text.txt", directory);
+    test_round_trip();
+    test_changed_file_is_refingerprinted();
+    remove_directory();
+    CHECK(mkdir(directory, 0700) == 0);
+    test_corrupt_entries_are_misses();
+    remove_directory();
+    return check_report("cache");
+}
@@ -0,0 +1,99 @@
+#include "check.h"
+
+// Counting occurrences (--tfidf) over a k range used to pass a negative
+// k-gram count for a document shorter than k and corrupt the heap
+static void test_short_document_with_counts_and_range(void) {
+    set_kgram_counts(1);
+    set_kgram_range(5, 7);
+    Document* doc = check_document("short", "tiny words", 5, 1);
+    CHECK_INT(doc->token_count, 2);
+    CHECK_INT(doc->kgram_count, 0);
+    CHECK_INT(doc->kgrams->count, 0);
+    for (int k = 5; k <= 7; k++) {
+        CHECK(doc->kgrams_by_k[k] != NULL);
+        CHECK_INT(doc->kgrams_by_k[k]->count, 0);
+    }
+    free_document(doc);
+    set_kgram_range(0, 0);
+    set_kgram_counts(0);
+}
+
+// Every window of w consecutive k-grams keeps its minimum fingerprint,
+// the rightmost on ties, and nothing else is kept; window 1 keeps all
+static void test_winnowing_keeps_each_window_minimum(void) {
+    char* text = check_text(3u, 1500, 40);
+    Document* all = check_document("all", text, 4, 1);
+    int* all_positions;
+    uint64_t* fingerprints;
+    int n = document_kept_kgrams(all, &all_positions, &fingerprints);
+    CHECK_INT(n, all->token_count - 4 + 1);
+    CHECK_INT(all->kgram_count, n);
+    for (int i = 0; i < n; i++) CHECK_INT(all_positions[i], i);
+
+    for (int window = 2; window <= 12; window += 5) {
+        Document* doc = check_document("winnowed", text, 4, window);
+        int* positions;
+        uint64_t* kept_fingerprints;
+        int kept = document_kept_kgrams(doc, &positions, &kept_fingerprints);
+        CHECK_INT(doc->kgram_count, kept);
+        CHECK(kept < n);
+        char* selected = (char*)calloc((size_t)n, 1);
+        for (int start = 0; start + window <= n; start++) {
+            int minimum = start;
+            for (int i = start + 1; i < start + window; i++) {
+                if (fingerprints[i] <= fingerprints[minimum]) minimum = i;
+            }
+            selected[minimum] = 1;
+        }
+        int expected = 0;
+        for (int i = 0; i < n; i++) expected += selected[i];
+        CHECK_INT(kept, expected);
+        for (int i = 0; i < kept; i++) {
+            CHECK(selected[positions[i]]);
+            CHECK(kept_fingerprints[i] == fingerprints[positions[i]]);
+            CHECK(hash_set_contains_fingerprint(doc->kgrams, kept_fingerprints[i]));
+        }
+        free(selected);
+        free(positions);
+        free(kept_fingerprints);
+        free_document(doc);
+    }
+    free(all_positions);
+    free(fingerprints);
+    free_document(all);
+    free(text);
+}
+
+// Two texts sharing any run of window + k - 1 tokens share a fingerprint
+static void test_winnowing_guarantee_threshold(void) {
+    const int k = 5, window = 4;
+    char* shared = check_text(21u, window + k - 1, 1000);
+    for (int round = 0; round < 50; round++) {
+        char* before = check_text(100u + (unsigned int)round, 60, 1000);
+        char* after = check_text(200u + (unsigned int)round, 60, 1000);
+        char* other = check_text(300u + (unsigned int)round, 90, 1000);
+        size_t size = strlen(before) + strlen(shared) + strlen(after) + strlen(other) + 4;
+        char* first = (char*)malloc(size);
+        char* second = (char*)malloc(size);
+        snprintf(first, size, "%s %s %s", before, shared, after);
+        snprintf(second, size, "%s %s", other, shared);
+        Document* a = check_document("first", first, k, window);
+        Document* b = check_document("second", second, k, window);
+        CHECK(hash_set_intersection_size(a->kgrams, b->kgrams) > 0);
+        free_document(a);
+        free_document(b);
+        free(first);
+        free(second);
+        free(before);
+        free(after);
+        free(other);
+    }
+    free(shared);
+}
+
+int main(void) {
+    test_short_document_with_counts_and_range();
+    test_winnowing_keeps_each_window_minimum();
+    test_winnowing_guarantee_threshold();
+    return check_report("fingerprints");
+}
@@ -0,0 +1,158 @@
+#define _POSIX_C_SOURCE 200809L
+#include "check.h"
+#include "../index.h"
+#include "../normalize.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define INDEX_TEST_DOCS 12
+
+static char directory[64];
+static char paths[INDEX_TEST_DOCS][96];
+
+// Silences stdout around calls expected to print their refusal
+static int saved_stdout = -1;
+
+static void quiet(int enabled) {
+    fflush(stdout);
+    if (enabled) {
+        saved_stdout = dup(STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    } else {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+}
+
+static void write_file(const char* path, const char* text) {
+    FILE* fp = fopen(path, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+// Reference texts over a small shared vocabulary, so most share k-grams
+// with the target; every third one uses words of its own and shares none
+static void write_references(void) {
+    strcpy(directory, "/tmp/plagiarism-index-XXXXXX");
+    CHECK(mkdtemp(directory) != NULL);
+    for (int i = 0; i < INDEX_TEST_DOCS; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/ref%02d.txt", directory, i);
+        char* text = check_text(100u + (unsigned int)i, 400, 25);
+        if (i % 3 == 0) {
+            for (char* c = text; *c; c++) {
+                if (*c == 'w') *c = 'v';
+            }
+        }
+        write_file(paths[i], text);
+        free(text);
+    }
+}
+
+// A query scores every reference it shares a k-gram with exactly as a
+// direct comparison does, across segments appended separately
+static void test_query_matches_direct_comparison(void) {
+    char index_dir[96];
+    snprintf(index_dir, sizeof(index_dir), "%s/index", directory);
+    const char* first[INDEX_TEST_DOCS / 2];
+    const char* second[INDEX_TEST_DOCS / 2];
+    for (int i = 0; i < INDEX_TEST_DOCS / 2; i++) {
+        first[i] = paths[i];
+        second[i] = paths[INDEX_TEST_DOCS / 2 + i];
+    }
+    CHECK_INT(index_add_documents(index_dir, 4, 3, first, INDEX_TEST_DOCS / 2), INDEX_TEST_DOCS / 2);
+    CHECK_INT(index_add_documents(index_dir, 4, 3, second, INDEX_TEST_DOCS / 2), INDEX_TEST_DOCS / 2);
+    quiet(1);
+    int added = index_add_documents(index_dir, 5, 3, first, 1);
+    quiet(0);
+    CHECK_INT(added, -1);
+
+    Index* index = index_open(index_dir);
+    CHECK(index != NULL);
+    if (index == NULL) return;
+    CHECK_INT(index->segment_count, 2);
+    CHECK_INT(index->doc_count, INDEX_TEST_DOCS);
+
+    char* text = check_text(999u, 600, 25);
+    Document* target = check_document("target", text, 4, 3);
+    free(text);
+    SimilarityResult* results = NULL;
+    int count = index_query(index, target, INDEX_TEST_DOCS, &results);
+
+    int expected = 0;
+    for (int i = 0; i < INDEX_TEST_DOCS; i++) {
+        Document* reference = load_document(paths[i], 4, 3);
+        SimilarityResult direct;
+        memset(&direct, 0, sizeof(direct));
+        compute_similarity(target->kgrams, reference->kgrams, &direct);
+        free_document(reference);
+        if (direct.matching_kgrams == 0) continue;
+        expected++;
+
+        int found = -1;
+        for (int r = 0; r < count; r++) {
+            if (strcmp(results[r].filename, paths[i]) == 0) found = r;
+        }
+        CHECK(found >= 0);
+        if (found < 0) continue;
+        CHECK_INT(results[found].matching_kgrams, direct.matching_kgrams);
+        CHECK_NEAR(results[found].jaccard, direct.jaccard, 1e-9);
+        CHECK_NEAR(results[found].overall, direct.overall, 1e-9);
+    }
+    CHECK_INT(count, expected);
+    CHECK(expected > 0 && expected < INDEX_TEST_DOCS);
+    for (int r = 1; r < count; r++) CHECK(results[r - 1].overall >= results[r].overall);
+
+    free(results);
+    free_document(target);
+    index_close(index);
+}
+
+// An index only answers under the normalization and exact mode it was
+// built with
+static void test_settings_mismatch_is_refused(void) {
+    char index_dir[96];
+    snprintf(index_dir, sizeof(index_dir), "%s/index", directory);
+    const char* one[1] = { paths[0] };
+
+    for (int setting = 0; setting < 2; setting++) {
+        if (setting == 0) set_stemming(1);
+        else set_kgram_exact_mode(1);
+        quiet(1);
+        int added = index_add_documents(index_dir, 4, 3, one, 1);
+        Index* refused = index_open(index_dir);
+        quiet(0);
+        CHECK_INT(added, -1);
+        CHECK(refused == NULL);
+        set_stemming(0);
+        set_kgram_exact_mode(0);
+    }
+
+    Index* index = index_open(index_dir);
+    CHECK(index != NULL);
+    index_close(index);
+}
+
+static void remove_directory(void) {
+    char path[128];
+    for (int i = 0; i < INDEX_TEST_DOCS; i++) unlink(paths[i]);
+    for (int s = 0; s < 2; s++) {
+        snprintf(path, sizeof(path), "%s/index/seg-%05d.idx", directory, s);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/index/meta", directory);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/index", directory);
+    rmdir(path);
+    rmdir(directory);
+}
+
+int main(void) {
+    write_references();
+    test_query_matches_direct_comparison();
+    test_settings_mismatch_is_refused();
+    remove_directory();
+    return check_report("index");
+}
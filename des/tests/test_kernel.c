@@ -0,0 +1,88 @@
+#include "check.h"
+
+static uint64_t random_state = 0x243f6a8885a308d3ULL;
+
+static uint64_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// `count` distinct ascending values; a fraction drawn from `shared`, the
+// rest anywhere in 64 bits, so both halves of the unsigned range appear
+static int random_sorted(uint64_t* out, int count, const uint64_t* shared, int shared_count,
+                         int shared_percent) {
+    for (int i = 0; i < count; i++) {
+        if (shared_count > 0 && (int)(next_random() % 100) < shared_percent) {
+            out[i] = shared[next_random() % (uint64_t)shared_count];
+        } else {
+            out[i] = next_random();
+        }
+    }
+    qsort(out, (size_t)count, sizeof(uint64_t), compare_u64);
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        if (unique == 0 || out[unique - 1] != out[i]) out[unique++] = out[i];
+    }
+    return unique;
+}
+
+static int naive_intersection(const uint64_t* a, int a_count, const uint64_t* b, int b_count) {
+    int count = 0;
+    for (int i = 0; i < a_count; i++) {
+        for (int j = 0; j < b_count; j++) count += a[i] == b[j];
+    }
+    return count;
+}
+
+// Whichever kernel the CPU selects counts what a nested loop counts, at
+// every length around the vector block sizes and every overlap
+static void test_intersection_matches_naive(void) {
+    enum { SHARED = 64, MAX_COUNT = 300 };
+    uint64_t shared[SHARED];
+    uint64_t a[MAX_COUNT], b[MAX_COUNT];
+    for (int i = 0; i < SHARED; i++) shared[i] = next_random();
+    for (int round = 0; round < 3000; round++) {
+        int a_target = round < 400 ? round % 20 : (int)(next_random() % MAX_COUNT);
+        int b_target = round < 400 ? round / 20 : (int)(next_random() % MAX_COUNT);
+        int percent = (int)(next_random() % 101);
+        int a_count = random_sorted(a, a_target, shared, SHARED, percent);
+        int b_count = random_sorted(b, b_target, shared, SHARED, percent);
+        int expected = naive_intersection(a, a_count, b, b_count);
+        CHECK_INT(sorted_intersection_size(a, a_count, b, b_count), expected);
+        CHECK_INT(sorted_intersection_size(b, b_count, a, a_count), expected);
+    }
+}
+
+// The fused scores agree with the per-metric functions they replace
+static void test_compute_similarity_matches_metrics(void) {
+    char* text_a = check_text(1u, 2000, 150);
+    char* text_b = check_text(2u, 1500, 150);
+    Document* a = check_document("a", text_a, 3, 2);
+    Document* b = check_document("b", text_b, 3, 2);
+    free(text_a);
+    free(text_b);
+    SimilarityResult result;
+    memset(&result, 0, sizeof(result));
+    compute_similarity(a->kgrams, b->kgrams, &result);
+    CHECK_INT(result.matching_kgrams, hash_set_intersection_size(a->kgrams, b->kgrams));
+    CHECK(result.matching_kgrams > 0);
+    CHECK_NEAR(result.jaccard, jaccard_similarity(a->kgrams, b->kgrams), 1e-12);
+    CHECK_NEAR(result.cosine, cosine_similarity(a->kgrams, b->kgrams), 1e-12);
+    CHECK_NEAR(result.containment, containment_similarity(a->kgrams, b->kgrams), 1e-12);
+    CHECK_NEAR(result.dice, dice_coefficient(a->kgrams, b->kgrams), 1e-12);
+    free_document(a);
+    free_document(b);
+}
+
+int main(void) {
+    test_intersection_matches_naive();
+    test_compute_similarity_matches_metrics();
+    return check_report("kernel");
+}
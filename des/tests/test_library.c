@@ -0,0 +1,171 @@
+#include "check.h"
+#include "../libplagiarism.h"
+
+// Linked against libplagiarism.a as well as the engine objects: the
+// archive must export only plag_* for this to link at all
+
+static const char* original =
+    "the quick brown fox jumps over the lazy dog while the cat sleeps in the warm sun";
+static const char* unrelated =
+    "completely different words appear here without any overlap to speak of at all";
+static const char* copied =
+    "a quick brown fox jumps over the lazy dog while the cat sleeps in a warm sun";
+
+typedef struct Collected {
+    int count;
+    int reference[8];
+    double jaccard[8];
+    int passages[8];
+    PlagCorpus* grow;          // added to from inside the callback when set
+    int stop_after;
+} Collected;
+
+static int collect(void* user, const PlagMatch* match) {
+    Collected* collected = (Collected*)user;
+    if (collected->count < 8) {
+        collected->reference[collected->count] = match->reference;
+        collected->jaccard[collected->count] = match->jaccard;
+        collected->passages[collected->count] = match->passage_count;
+    }
+    collected->count++;
+    if (collected->grow != NULL) {
+        CHECK_INT(plag_corpus_add_text(collected->grow, "late", original, strlen(original), NULL),
+                  PLAG_OK);
+    }
+    return collected->stop_after > 0 && collected->count >= collected->stop_after;
+}
+
+static PlagCorpus* two_reference_corpus(const PlagAllocator* allocator) {
+    PlagCorpusOptions options = { 3, 1, allocator };
+    PlagCorpus* corpus = NULL;
+    CHECK_INT(plag_corpus_create(&options, &corpus), PLAG_OK);
+    int id = -1;
+    CHECK_INT(plag_corpus_add_text(corpus, "original", original, strlen(original), &id), PLAG_OK);
+    CHECK_INT(id, 0);
+    CHECK_INT(plag_corpus_add_text(corpus, "unrelated", unrelated, strlen(unrelated), &id), PLAG_OK);
+    CHECK_INT(id, 1);
+    return corpus;
+}
+
+// Matches agree with the engine scoring the same texts directly, and
+// min_score filters the unrelated reference out
+static void test_check_matches_engine(void) {
+    PlagCorpus* corpus = two_reference_corpus(NULL);
+    PlagDocument* document = NULL;
+    CHECK_INT(plag_document_create(corpus, "target", copied, strlen(copied), &document), PLAG_OK);
+    PlagSessionOptions options = { 0.2, 1, 3 };
+    PlagSession* session = NULL;
+    CHECK_INT(plag_session_create(corpus, &options, &session), PLAG_OK);
+
+    Collected collected;
+    memset(&collected, 0, sizeof(collected));
+    CHECK_INT(plag_session_check(session, document, collect, &collected), PLAG_OK);
+    CHECK_INT(collected.count, 1);
+    CHECK_INT(collected.reference[0], 0);
+    CHECK(collected.passages[0] >= 1);
+
+    Document* target = check_document("target", copied, 3, 1);
+    Document* reference = check_document("original", original, 3, 1);
+    CHECK_NEAR(collected.jaccard[0], jaccard_similarity(target->kgrams, reference->kgrams), 1e-9);
+    free_document(target);
+    free_document(reference);
+
+    plag_session_destroy(session);
+    plag_document_destroy(document);
+    plag_corpus_destroy(corpus);
+}
+
+// A callback may add to the corpus; the running check does not see the
+// addition, the next one does. Returning nonzero stops the check.
+static void test_callback_adds_and_stops(void) {
+    PlagCorpus* corpus = two_reference_corpus(NULL);
+    PlagDocument* document = NULL;
+    CHECK_INT(plag_document_create(corpus, "target", copied, strlen(copied), &document), PLAG_OK);
+    PlagSession* session = NULL;
+    CHECK_INT(plag_session_create(corpus, NULL, &session), PLAG_OK);
+
+    Collected collected;
+    memset(&collected, 0, sizeof(collected));
+    collected.grow = corpus;
+    CHECK_INT(plag_session_check(session, document, collect, &collected), PLAG_OK);
+    CHECK_INT(collected.count, 2);
+    CHECK_INT(plag_corpus_size(corpus), 4);
+
+    memset(&collected, 0, sizeof(collected));
+    CHECK_INT(plag_session_check(session, document, collect, &collected), PLAG_OK);
+    CHECK_INT(collected.count, 4);
+    CHECK_NEAR(collected.jaccard[2], collected.jaccard[0], 1e-9);
+
+    memset(&collected, 0, sizeof(collected));
+    collected.stop_after = 1;
+    CHECK_INT(plag_session_check(session, document, collect, &collected), PLAG_STOPPED);
+    CHECK_INT(collected.count, 1);
+
+    plag_session_destroy(session);
+    plag_document_destroy(document);
+    plag_corpus_destroy(corpus);
+}
+
+typedef struct CountingAllocator {
+    long outstanding;
+    size_t bytes;
+} CountingAllocator;
+
+static void* counting_alloc(void* context, size_t size) {
+    CountingAllocator* counter = (CountingAllocator*)context;
+    counter->outstanding++;
+    counter->bytes += size;
+    return malloc(size);
+}
+
+static void counting_free(void* context, void* ptr, size_t size) {
+    CountingAllocator* counter = (CountingAllocator*)context;
+    counter->outstanding--;
+    counter->bytes -= size;
+    free(ptr);
+}
+
+// Everything drawn from a caller's allocator goes back to it, with the
+// sizes it was asked for
+static void test_allocator_balances(void) {
+    CountingAllocator counter = { 0, 0 };
+    PlagAllocator allocator = { counting_alloc, counting_free, &counter };
+    PlagCorpus* corpus = two_reference_corpus(&allocator);
+    PlagDocument* document = NULL;
+    CHECK_INT(plag_document_create(corpus, "target", copied, strlen(copied), &document), PLAG_OK);
+    PlagSession* session = NULL;
+    CHECK_INT(plag_session_create(corpus, NULL, &session), PLAG_OK);
+    Collected collected;
+    memset(&collected, 0, sizeof(collected));
+    CHECK_INT(plag_session_check(session, document, collect, &collected), PLAG_OK);
+    CHECK(counter.outstanding > 0);
+    plag_session_destroy(session);
+    plag_document_destroy(document);
+    plag_corpus_destroy(corpus);
+    CHECK_INT(counter.outstanding, 0);
+    CHECK_INT(counter.bytes, 0);
+}
+
+static void test_bad_arguments(void) {
+    PlagCorpus* corpus = NULL;
+    PlagCorpusOptions options = { 1, 1, NULL };
+    CHECK_INT(plag_corpus_create(&options, &corpus), PLAG_ERROR_ARGUMENT);
+    CHECK(corpus == NULL);
+    CHECK_INT(plag_corpus_create(NULL, &corpus), PLAG_ERROR_ARGUMENT);
+
+    corpus = two_reference_corpus(NULL);
+    PlagDocument* document = NULL;
+    CHECK_INT(plag_document_load(corpus, "/nonexistent/target.txt", &document), PLAG_ERROR_IO);
+    CHECK(document == NULL);
+    CHECK_INT(plag_session_check(NULL, NULL, collect, NULL), PLAG_ERROR_ARGUMENT);
+    plag_corpus_destroy(corpus);
+    CHECK(strcmp(plag_status_string(PLAG_STOPPED), "stopped by callback") == 0);
+}
+
+int main(void) {
+    test_check_matches_engine();
+    test_callback_adds_and_stops();
+    test_allocator_balances();
+    test_bad_arguments();
+    return check_report("library");
+}
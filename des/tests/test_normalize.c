@@ -0,0 +1,77 @@
+#include "check.h"
+#include "../normalize.h"
+
+static void check_stem(const char* word, const char* expected) {
+    char buffer[64];
+    strcpy(buffer, word);
+    size_t length = porter_stem(buffer, strlen(buffer));
+    buffer[length] = '\0';
+    if (strcmp(buffer, expected) != 0) {
+        fprintf(stderr, "porter_stem(\"%s\") is \"%s\", expected \"%s\"\n", word, buffer, expected);
+        check_failures++;
+    }
+}
+
+// Vectors from Porter's paper and the reference voc.txt/output.txt pairs
+static void test_porter_stemmer(void) {
+    check_stem("caresses", "caress");
+    check_stem("ponies", "poni");
+    check_stem("cats", "cat");
+    check_stem("feed", "feed");
+    check_stem("agreed", "agre");
+    check_stem("plastered", "plaster");
+    check_stem("motoring", "motor");
+    check_stem("sing", "sing");
+    check_stem("conflated", "conflat");
+    check_stem("hopping", "hop");
+    check_stem("falling", "fall");
+    check_stem("filing", "file");
+    check_stem("happy", "happi");
+    check_stem("relational", "relat");
+    check_stem("conditional", "condit");
+    check_stem("digitizer", "digit");
+    check_stem("generalization", "gener");
+    check_stem("electrical", "electr");
+    check_stem("hopefulness", "hope");
+    check_stem("adjustment", "adjust");
+    check_stem("controlling", "control");
+    check_stem("roll", "roll");
+    check_stem("generously", "gener");
+    check_stem("a", "a");
+    check_stem("is", "is");
+}
+
+// Stopword files are folded like tokens, in any script, so their words
+// drop the tokens they name
+static void test_stopword_file_folding(void) {
+    const char* path = "/tmp/plagiarism-test-stopwords.txt";
+    FILE* fp = fopen(path, "w");
+    fputs("# comment line\nÜBER  ΚΑΙ\nDon\xe2\x80\x99t\nE.G.\n", fp);
+    fclose(fp);
+    StopwordSet* set = load_stopword_file(path);
+    remove(path);
+    CHECK(set != NULL);
+    if (set == NULL) return;
+    CHECK(stopword_set_contains(set, "über", strlen("über")));
+    CHECK(stopword_set_contains(set, "και", strlen("και")));
+    CHECK(stopword_set_contains(set, "don't", 5));
+    CHECK(stopword_set_contains(set, "eg", 2));
+    CHECK(!stopword_set_contains(set, "comment", 7));
+
+    set_stopwords(set);
+    Document* doc = check_document("folded", "Über alles ΚΑΙ logos don\xe2\x80\x99t e.g. stop", 1, 1);
+    CHECK_INT(doc->token_count, 3);
+    if (doc->token_count == 3) {
+        CHECK(strcmp(document_token(doc, 0), "alles") == 0);
+        CHECK(strcmp(document_token(doc, 2), "stop") == 0);
+    }
+    free_document(doc);
+    set_stopwords(default_stopwords());
+    free_stopword_set(set);
+}
+
+int main(void) {
+    test_porter_stemmer();
+    test_stopword_file_folding();
+    return check_report("normalize");
+}
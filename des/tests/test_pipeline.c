@@ -0,0 +1,104 @@
+#define _POSIX_C_SOURCE 200809L
+#include "check.h"
+#include "../pipeline.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PIPELINE_TEST_FILES 40
+
+static char directory[64];
+static char paths[PIPELINE_TEST_FILES][96];
+static const char* path_list[PIPELINE_TEST_FILES];
+
+// Mostly small texts; one empty, one missing, and one spanning several
+// read chunks
+static void write_files(void) {
+    strcpy(directory, "/tmp/plagiarism-pipeline-XXXXXX");
+    CHECK(mkdtemp(directory) != NULL);
+    for (int i = 0; i < PIPELINE_TEST_FILES; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/doc%02d.txt", directory, i);
+        path_list[i] = paths[i];
+        if (i == 7) continue;
+        int words = i == 3 ? 0 : i == 5 ? 400000 : 200 + i * 37;
+        char* text = words > 0 ? check_text((unsigned int)i, words, 500) : NULL;
+        FILE* fp = fopen(paths[i], "w");
+        if (text != NULL) fputs(text, fp);
+        fclose(fp);
+        free(text);
+    }
+}
+
+static void check_same_document(Document* actual, Document* expected) {
+    CHECK_INT(actual->token_count, expected->token_count);
+    CHECK_INT(actual->kgram_count, expected->kgram_count);
+    CHECK_INT(actual->kgrams->count, expected->kgrams->count);
+    if (actual->kgrams->count != expected->kgrams->count) return;
+    CHECK(memcmp(hash_set_sorted_fingerprints(actual->kgrams),
+                 hash_set_sorted_fingerprints(expected->kgrams),
+                 (size_t)expected->kgrams->count * sizeof(uint64_t)) == 0);
+    CHECK(memcmp(actual->minhash, expected->minhash, sizeof(expected->minhash)) == 0);
+}
+
+// Every path comes out once, in its own slot, as load_document makes it,
+// whichever way it was read and however short the queues
+static void test_matches_load_document(const char* cache_dir) {
+    for (int io = 0; io < 2; io++) {
+        PipelineConfig config;
+        memset(&config, 0, sizeof(config));
+        config.k = 5;
+        config.window = 3;
+        config.workers = 3;
+        config.readers = 2;
+        config.depth = 2;
+        config.io = io == 0 ? PIPELINE_IO_AUTO : PIPELINE_IO_THREADS;
+        config.cache_dir = cache_dir;
+        Document* docs[PIPELINE_TEST_FILES];
+        PipelineStats stats;
+        CHECK_INT(pipeline_load_documents(&config, path_list, PIPELINE_TEST_FILES, docs, &stats),
+                  0);
+        CHECK_INT(stats.stages[PIPELINE_SCORE].items, PIPELINE_TEST_FILES);
+        if (cache_dir != NULL && io == 1) CHECK_INT(stats.cache_hits, PIPELINE_TEST_FILES - 1);
+
+        for (int i = 0; i < PIPELINE_TEST_FILES; i++) {
+            Document* expected = load_document(paths[i], 5, 3);
+            if (expected == NULL) {
+                CHECK(docs[i] == NULL);
+                continue;
+            }
+            CHECK(docs[i] != NULL);
+            if (docs[i] != NULL) {
+                CHECK(strcmp(docs[i]->filename, paths[i]) == 0);
+                CHECK_INT(ensure_document_tokens(docs[i]), 0);
+                check_same_document(docs[i], expected);
+                free_document(docs[i]);
+            }
+            free_document(expected);
+        }
+    }
+}
+
+static void remove_directory(const char* path) {
+    DIR* dir = opendir(path);
+    struct dirent* entry;
+    char child[512];
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (unlink(child) != 0) remove_directory(child);
+    }
+    if (dir != NULL) closedir(dir);
+    rmdir(path);
+}
+
+int main(void) {
+    write_files();
+    test_matches_load_document(NULL);
+    char cache_dir[96];
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", directory);
+    mkdir(cache_dir, 0755);
+    test_matches_load_document(cache_dir);
+    remove_directory(directory);
+    return check_report("pipeline");
+}
@@ -0,0 +1,135 @@
+#define _XOPEN_SOURCE 700
+#include "check.h"
+#include "../server.h"
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef struct Sender {
+    int fd;
+    const char* data;
+    size_t length;
+} Sender;
+
+// Writes from its own thread, so a request larger than the socket buffer
+// cannot block the reader, then closes its end
+static void* send_and_close(void* arg) {
+    Sender* sender = (Sender*)arg;
+    size_t sent = 0;
+    while (sent < sender->length) {
+        ssize_t wrote = write(sender->fd, sender->data + sent, sender->length - sent);
+        if (wrote <= 0) break;
+        sent += (size_t)wrote;
+    }
+    close(sender->fd);
+    return NULL;
+}
+
+static int parse(const char* data, size_t length, HttpRequest* request) {
+    int fds[2];
+    CHECK_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    Sender sender = { fds[1], data, length };
+    pthread_t thread;
+    pthread_create(&thread, NULL, send_and_close, &sender);
+    int status = http_read_request(fds[0], request);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+    return status;
+}
+
+static void test_request_fields(void) {
+    const char* text =
+        "POST /check?name=essay%201.txt&x=1 HTTP/1.1\r\n"
+        "Host: 127.0.0.1\r\n"
+        "content-length: 11\r\n"
+        "ORIGIN:  http://localhost:8000\r\n"
+        "\r\n"
+        "hello world";
+    HttpRequest request;
+    CHECK_INT(parse(text, strlen(text), &request), 0);
+    CHECK(strcmp(request.method, "POST") == 0);
+    CHECK(strcmp(request.path, "/check") == 0);
+    CHECK(strcmp(request.query, "name=essay%201.txt&x=1") == 0);
+    CHECK_INT(request.has_origin, 1);
+    CHECK(strcmp(request.origin, "http://localhost:8000") == 0);
+    CHECK_INT(request.body_length, 11);
+    CHECK(request.body != NULL && strcmp(request.body, "hello world") == 0);
+    free(request.body);
+
+    const char* bare = "GET /stats HTTP/1.1\r\n\r\n";
+    CHECK_INT(parse(bare, strlen(bare), &request), 0);
+    CHECK(strcmp(request.path, "/stats") == 0);
+    CHECK(request.query[0] == '\0');
+    CHECK_INT(request.has_origin, 0);
+    CHECK_INT(request.body_length, 0);
+    free(request.body);
+}
+
+// A body far past the first read arrives whole
+static void test_large_body(void) {
+    size_t body_length = 3 * 1024 * 1024;
+    char* text = (char*)malloc(body_length + 128);
+    int header = sprintf(text, "POST /references?name=big HTTP/1.1\r\nContent-Length: %zu\r\n\r\n",
+                         body_length);
+    for (size_t i = 0; i < body_length; i++) text[header + i] = (char)('a' + i % 26);
+    HttpRequest request;
+    CHECK_INT(parse(text, (size_t)header + body_length, &request), 0);
+    CHECK_INT(request.body_length, body_length);
+    CHECK(request.body != NULL && memcmp(request.body, text + header, body_length) == 0);
+    free(request.body);
+    free(text);
+}
+
+// Malformed, oversized and cut-off requests
+static void test_bad_requests(void) {
+    HttpRequest request;
+    const char* garbage = "\r\n\r\n";
+    CHECK_INT(parse(garbage, strlen(garbage), &request), 400);
+
+    char too_big[128];
+    snprintf(too_big, sizeof(too_big), "POST /check HTTP/1.1\r\nContent-Length: %d\r\n\r\n",
+             SERVER_MAX_BODY + 1);
+    CHECK_INT(parse(too_big, strlen(too_big), &request), 413);
+
+    size_t huge = 80 * 1024;
+    char* headers = (char*)malloc(huge);
+    memcpy(headers, "GET /stats HTTP/1.1\r\nX: ", 24);
+    memset(headers + 24, 'x', huge - 24);
+    CHECK_INT(parse(headers, huge, &request), 400);
+    free(headers);
+
+    const char* unfinished = "GET /stats HTTP/1.1\r\nHost: x\r\n";
+    CHECK_INT(parse(unfinished, strlen(unfinished), &request), -1);
+
+    const char* short_body = "POST /check HTTP/1.1\r\nContent-Length: 50\r\n\r\nonly this";
+    CHECK_INT(parse(short_body, strlen(short_body), &request), -1);
+    CHECK(request.body == NULL);
+}
+
+static void test_query_params(void) {
+    char out[16];
+    const char* query = "names=x&name=a%2Fb+c%zz&empty=&path=%2e%2E";
+    CHECK_INT(http_query_param(query, "name", out, sizeof(out)), 1);
+    CHECK(strcmp(out, "a/b c%zz") == 0);
+    CHECK_INT(http_query_param(query, "names", out, sizeof(out)), 1);
+    CHECK(strcmp(out, "x") == 0);
+    CHECK_INT(http_query_param(query, "path", out, sizeof(out)), 1);
+    CHECK(strcmp(out, "..") == 0);
+    CHECK_INT(http_query_param(query, "nam", out, sizeof(out)), 0);
+    CHECK_INT(http_query_param("", "name", out, sizeof(out)), 0);
+
+    // Present but empty, and cut to the buffer
+    CHECK_INT(http_query_param(query, "empty", out, sizeof(out)), 1);
+    CHECK(out[0] == '\0');
+    CHECK_INT(http_query_param("long=0123456789abcdefghij", "long", out, sizeof(out)), 1);
+    CHECK(strcmp(out, "0123456789abcde") == 0);
+}
+
+int main(void) {
+    test_request_fields();
+    test_large_body();
+    test_bad_requests();
+    test_query_params();
+    return check_report("server");
+}
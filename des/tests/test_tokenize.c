@@ -0,0 +1,99 @@
+#include "check.h"
+#include "../tokenize.h"
+
+// The vector block classifier and the character path agree on every ASCII
+// byte: same class, and the same folded letter
+static void test_block_matches_character_path(void) {
+    unsigned int seed = 7;
+    for (int round = 0; round < 2000; round++) {
+        char text[TOKENIZE_BLOCK];
+        for (int i = 0; i < TOKENIZE_BLOCK; i++) {
+            seed = seed * 1103515245u + 12345u;
+            text[i] = (char)((seed >> 16) % 128);
+        }
+        TokenBlock block;
+        if (!classify_ascii_block(text, &block)) return;  // no vector unit
+        for (int i = 0; i < TOKENIZE_BLOCK; i++) {
+            char folded[4];
+            int folded_length = 0, consumed = 0;
+            CharClass class = classify_char(text + i, 1, folded, &folded_length, &consumed);
+            CHECK_INT(consumed, 1);
+            CHECK_INT((block.letters >> i) & 1, class == CHAR_LETTER);
+            CHECK_INT((block.spaces >> i) & 1, class == CHAR_SPACE);
+            if (class == CHAR_LETTER) CHECK_INT(block.folded[i], (unsigned char)folded[0]);
+        }
+    }
+}
+
+// Letters of cased scripts fold and stay whole; Unicode spaces split;
+// punctuation goes; typographic apostrophes become '\''
+static void test_utf8_words(void) {
+    Document* doc = check_document("utf8", "ÄRGER\xe2\x80\x83Straße, ΣΟΦΙΑ don\xe2\x80\x99t", 1, 1);
+    CHECK_INT(doc->token_count, 4);
+    if (doc->token_count == 4) {
+        CHECK(strcmp(document_token(doc, 0), "ärger") == 0);
+        CHECK(strcmp(document_token(doc, 1), "straße") == 0);
+        CHECK(strcmp(document_token(doc, 2), "σοφια") == 0);
+        CHECK(strcmp(document_token(doc, 3), "don't") == 0);
+    }
+    free_document(doc);
+}
+
+// Scripts without spaces between words give one token per character, so
+// a sentence is not one giant token
+static void test_unspaced_scripts(void) {
+    Document* doc = check_document("cjk", "我们今天去公园。ひらがなカタカナ 한국어 ภาษาไทย mixed漢字", 1, 1);
+    CHECK_INT(doc->token_count, 7 + 8 + 3 + 7 + 3);
+    if (doc->token_count == 28) {
+        CHECK(strcmp(document_token(doc, 0), "我") == 0);
+        CHECK(strcmp(document_token(doc, 7), "ひ") == 0);
+        CHECK(strcmp(document_token(doc, 15), "한") == 0);
+        CHECK(strcmp(document_token(doc, 25), "mixed") == 0);
+        CHECK(strcmp(document_token(doc, 27), "字") == 0);
+        CHECK_INT(doc->tokens[0].source_offset, 0);
+        CHECK_INT(doc->tokens[0].source_length, 3);
+    }
+    free_document(doc);
+
+    // A near-copy in Chinese now scores as one
+    Document* a = check_document("a", "我们今天去公园散步天气非常好阳光明媚孩子们在草地上玩耍", 3, 1);
+    Document* b = check_document("b", "今天我们去公园散步天气非常好阳光明媚孩子们在草地上玩耍", 3, 1);
+    CHECK(jaccard_similarity(a->kgrams, b->kgrams) > 0.7);
+    free_document(a);
+    free_document(b);
+}
+
+// Single letters between unspaced characters need more token text than
+// input: "x中" is 4 bytes in and "x\0中\0" 6 out. This used to overrun the
+// token buffer.
+static void test_alternating_latin_and_cjk(void) {
+    const int pairs = 20000;
+    char* text = (char*)malloc((size_t)pairs * 4 + 1);
+    for (int i = 0; i < pairs; i++) memcpy(text + i * 4, "X中", 4);
+    text[pairs * 4] = '\0';
+    Document* doc = check_document("mixed", text, 3, 1);
+    CHECK_INT(doc->token_count, 2 * pairs);
+    CHECK(strcmp(document_token(doc, 0), "x") == 0);
+    CHECK(strcmp(document_token(doc, 2 * pairs - 1), "中") == 0);
+    free_document(doc);
+    free(text);
+}
+
+// Token offsets are 32 bits; a longer input is refused before it is read
+static void test_oversized_input_is_rejected(void) {
+    Document* doc = create_document("huge");
+    CHECK_INT(preprocess_document_buffer(doc, "x", MAX_DOCUMENT_BYTES + 1), -1);
+    CHECK_INT(doc->token_count, 0);
+    CHECK_INT(preprocess_document_buffer(doc, "some words", 10), 0);
+    CHECK_INT(doc->token_count, 2);
+    free_document(doc);
+}
+
+int main(void) {
+    test_block_matches_character_path();
+    test_utf8_words();
+    test_unspaced_scripts();
+    test_alternating_latin_and_cjk();
+    test_oversized_input_is_rejected();
+    return check_report("tokenize");
+}
@@ -0,0 +1,74 @@
+#include "tfidf.h"
+
+// Document frequencies come from one sort of every document's distinct
+// fingerprints; NULL entries of `docs` are skipped
+IdfTable* build_idf_table(Document** docs, int doc_count) {
+    IdfTable* table = (IdfTable*)malloc(sizeof(IdfTable));
+    int total = 0, present = 0;
+    for (int d = 0; d < doc_count; d++) {
+        if (docs[d] == NULL) continue;
+        total += docs[d]->kgrams->count;
+        present++;
+    }
+
+    uint64_t* all = (uint64_t*)malloc((total > 0 ? total : 1) * sizeof(uint64_t));
+    int n = 0;
+    for (int d = 0; d < doc_count; d++) {
+        if (docs[d] == NULL) continue;
+        const uint64_t* sorted = hash_set_sorted_fingerprints(docs[d]->kgrams);
+        memcpy(all + n, sorted, docs[d]->kgrams->count * sizeof(uint64_t));
+        n += docs[d]->kgrams->count;
+    }
+    uint64_t* scratch = (uint64_t*)malloc((total > 0 ? total : 1) * sizeof(uint64_t));
+    radix_sort_u64(all, scratch, n);
+    free(scratch);
+
+    // Runs of equal fingerprints give the document frequencies
+    table->fingerprints = all;
+    table->idf = (double*)malloc((n > 0 ? n : 1) * sizeof(double));
+    table->doc_count = present;
+    table->count = 0;
+    for (int i = 0; i < n; ) {
+        int end = i + 1;
+        while (end < n && all[end] == all[i]) end++;
+        table->fingerprints[table->count] = all[i];
+        table->idf[table->count] = log((present + 1.0) / (end - i + 1.0)) + 1.0;
+        table->count++;
+        i = end;
+    }
+    table->unseen_idf = log(present + 1.0) + 1.0;
+    return table;
+}
+
+// Fills doc->tfidf_weights and doc->tfidf_norm against `table`
+void tfidf_weigh_document(const IdfTable* table, Document* doc) {
+    HashSet* set = doc->kgrams;
+    const uint64_t* sorted = hash_set_sorted_fingerprints(set);
+    doc->tfidf_weights = (double*)arena_alloc(&doc->arena,
+                                              (set->count > 0 ? set->count : 1) * sizeof(double));
+    double norm = 0.0;
+    int t = 0;
+    for (int i = 0; i < set->count; i++) {
+        while (t < table->count && table->fingerprints[t] < sorted[i]) t++;
+        double idf = t < table->count && table->fingerprints[t] == sorted[i]
+                         ? table->idf[t] : table->unseen_idf;
+        double tf = doc->kgram_counts != NULL ? doc->kgram_counts[i] : 1.0;
+        doc->tfidf_weights[i] = tf * idf;
+        norm += doc->tfidf_weights[i] * doc->tfidf_weights[i];
+    }
+    doc->tfidf_norm = sqrt(norm);
+}
+
+double tfidf_cosine(const Document* doc1, const Document* doc2) {
+    if (doc1->tfidf_weights == NULL || doc2->tfidf_weights == NULL) return 0.0;
+    if (doc1->tfidf_norm <= 0.0 || doc2->tfidf_norm <= 0.0) return 0.0;
+    double dot = sorted_weighted_dot(doc1->kgrams->sorted, doc1->tfidf_weights, doc1->kgrams->count,
+                                     doc2->kgrams->sorted, doc2->tfidf_weights, doc2->kgrams->count);
+    return dot / (doc1->tfidf_norm * doc2->tfidf_norm);
+}
+
+void free_idf_table(IdfTable* table) {
+    free(table->fingerprints);
+    free(table->idf);
+    free(table);
+}
@@ -0,0 +1,29 @@
+#ifndef TFIDF_H
+#define TFIDF_H
+
+#include "plagiarism.h"
+
+// TF-IDF Weighting
+// A document is a sparse vector over its kept fingerprints: ascending
+// fingerprints (kgrams->sorted) paired with weights tf * idf, where tf is
+// the k-gram's occurrence count (needs set_kgram_counts(1) before the
+// document is fingerprinted) and idf = ln((N + 1) / (df + 1)) + 1 over the
+// N documents of the reference corpus. Boilerplate shared by much of the
+// corpus weighs little, and cosine runs as a sparse dot product of the
+// two vectors. The table is built once per corpus; weighing a document
+// against it is one merge with the table's sorted fingerprints.
+
+typedef struct IdfTable {
+    uint64_t* fingerprints;    // ascending, one per distinct corpus fingerprint
+    double* idf;
+    int count;
+    int doc_count;
+    double unseen_idf;         // for fingerprints no reference has
+} IdfTable;
+
+IdfTable* build_idf_table(Document** docs, int doc_count);
+void tfidf_weigh_document(const IdfTable* table, Document* doc);
+double tfidf_cosine(const Document* doc1, const Document* doc2);
+void free_idf_table(IdfTable* table);
+
+#endif
@@ -0,0 +1,196 @@
+#include "threadpool.h"
+
+#include <stdlib.h>
+
+typedef struct WorkerStart {
+    ThreadPool* pool;
+    int id;
+} WorkerStart;
+
+// Deque Operations
+static int deque_pop(WorkDeque* deque, int* item) {
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        *item = deque->items[--deque->bottom];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int deque_steal(WorkDeque* deque, int* item) {
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        *item = deque->items[deque->top++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int next_task(ThreadPool* pool, int id, int* item) {
+    if (deque_pop(&pool->deques[id], item)) return 1;
+    for (int i = 1; i < pool->thread_count; i++) {
+        int victim = (id + i) % pool->thread_count;
+        if (deque_steal(&pool->deques[victim], item)) return 1;
+    }
+    return 0;
+}
+
+// Runs tasks until every deque is empty, then reports how many it ran
+static void drain(ThreadPool* pool, int id) {
+    int item, done = 0;
+    while (next_task(pool, id, &item)) {
+        pool->task(pool->task_arg, item);
+        done++;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending -= done;
+    if (pool->pending == 0) {
+        pthread_cond_broadcast(&pool->work_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* worker_main(void* arg) {
+    WorkerStart* start = (WorkerStart*)arg;
+    ThreadPool* pool = start->pool;
+    int id = start->id;
+    free(start);
+
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        drain(pool, id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_broadcast(&pool->work_done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+// Thread Pool
+ThreadPool* create_thread_pool(int thread_count) {
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > THREAD_POOL_MAX_THREADS) thread_count = THREAD_POOL_MAX_THREADS;
+
+    ThreadPool* pool = (ThreadPool*)malloc(sizeof(ThreadPool));
+    pool->thread_count = thread_count;
+    pool->threads = (pthread_t*)malloc(thread_count * sizeof(pthread_t));
+    pool->deques = (WorkDeque*)malloc(thread_count * sizeof(WorkDeque));
+    for (int i = 0; i < thread_count; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].items = NULL;
+        pool->deques[i].top = pool->deques[i].bottom = 0;
+        pool->deques[i].capacity = 0;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->task = NULL;
+    pool->task_arg = NULL;
+    pool->pending = 0;
+    pool->active = 0;
+    pool->generation = 0;
+    pool->shutdown = 0;
+
+    // Work is only dealt to workers that started; a pool whose threads
+    // all fail to start still runs everything on the caller
+    int started = 1;
+    for (int i = 1; i < thread_count; i++) {
+        WorkerStart* start = (WorkerStart*)malloc(sizeof(WorkerStart));
+        start->pool = pool;
+        start->id = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, start) != 0) {
+            free(start);
+            break;
+        }
+        started++;
+    }
+    for (int i = started; i < thread_count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    pool->thread_count = started;
+    return pool;
+}
+
+void thread_pool_run(ThreadPool* pool, int count, ThreadTask task, void* arg) {
+    if (count <= 0) return;
+
+    // Deal the range out in contiguous blocks, one per worker
+    int workers = pool->thread_count;
+    for (int w = 0; w < workers; w++) {
+        WorkDeque* deque = &pool->deques[w];
+        int first = (int)((long long)count * w / workers);
+        int last = (int)((long long)count * (w + 1) / workers);
+        pthread_mutex_lock(&deque->lock);
+        if (deque->capacity < last - first) {
+            deque->capacity = last - first;
+            deque->items = (int*)realloc(deque->items, deque->capacity * sizeof(int));
+        }
+        // Stored in reverse so the owner pops its block front to back
+        for (int i = first; i < last; i++) {
+            deque->items[last - 1 - i] = i;
+        }
+        deque->top = 0;
+        deque->bottom = last - first;
+        pthread_mutex_unlock(&deque->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->task_arg = arg;
+    pool->pending = count;
+    pool->active = workers - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    drain(pool, 0);
+
+    // Wait for the tasks and for every worker to leave this run, so the
+    // deques can be refilled safely by the next call
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0 || pool->active > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void free_thread_pool(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
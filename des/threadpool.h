@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+
+#define THREAD_POOL_MAX_THREADS 256
+
+// Work-Stealing Thread Pool
+// thread_pool_run(pool, n, fn, arg) calls fn(arg, i) once for every i in
+// [0, n) and returns when all calls are done. The range is dealt out in
+// contiguous blocks to per-worker deques; a worker pops its own deque from
+// the bottom and, once it runs dry, steals from the top of the others.
+// The calling thread works as worker 0, so a pool of one thread runs
+// everything inline. Tasks write their output by index, which keeps
+// results in input order regardless of scheduling.
+
+typedef void (*ThreadTask)(void* arg, int index);
+
+typedef struct WorkDeque {
+    pthread_mutex_t lock;
+    int* items;
+    int top;                   // next index to steal
+    int bottom;                // one past the next index to pop
+    int capacity;
+} WorkDeque;
+
+typedef struct ThreadPool {
+    int thread_count;          // workers that started, the caller included
+    pthread_t* threads;
+    WorkDeque* deques;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    ThreadTask task;
+    void* task_arg;
+    int pending;               // tasks not yet finished in this run
+    int active;                // spawned workers still inside this run
+    unsigned long generation;
+    int shutdown;
+} ThreadPool;
+
+ThreadPool* create_thread_pool(int thread_count);
+void thread_pool_run(ThreadPool* pool, int count, ThreadTask task, void* arg);
+void free_thread_pool(ThreadPool* pool);
+
+#endif
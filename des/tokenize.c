@@ -0,0 +1,292 @@
+#include "tokenize.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZE_X86 1
+#endif
+
+// Vector Block Classifier
+// Works on ASCII only, where the rules are the byte tests of the character
+// path: letters are [A-Za-z] and ', lowercased by setting bit 0x20;
+// spaces are ' ' and \t through \r. A block holding any byte >= 0x80 is
+// handed back so multibyte characters are never split.
+
+#ifdef TOKENIZE_X86
+__attribute__((target("avx2")))
+static int classify_block_avx2(const char* text, TokenBlock* block) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)text);
+    if (_mm256_movemask_epi8(v) != 0) return 0;
+
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                       _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    letters = _mm256_or_si256(letters, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+    __m256i spaces = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+                                      _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v));
+    spaces = _mm256_or_si256(spaces, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+
+    _mm256_storeu_si256((__m256i*)block->folded, lower);
+    block->letters = (uint32_t)_mm256_movemask_epi8(letters);
+    block->spaces = (uint32_t)_mm256_movemask_epi8(spaces);
+    return 1;
+}
+
+__attribute__((target("sse2")))
+static int classify_half_sse2(const char* text, unsigned char* folded, uint32_t* letter_bits,
+                              uint32_t* space_bits) {
+    __m128i v = _mm_loadu_si128((const __m128i*)text);
+    if (_mm_movemask_epi8(v) != 0) return 0;
+
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                    _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    letters = _mm_or_si128(letters, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    __m128i spaces = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                   _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    spaces = _mm_or_si128(spaces, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+
+    _mm_storeu_si128((__m128i*)folded, lower);
+    *letter_bits = (uint32_t)_mm_movemask_epi8(letters);
+    *space_bits = (uint32_t)_mm_movemask_epi8(spaces);
+    return 1;
+}
+
+__attribute__((target("sse2")))
+static int classify_block_sse2(const char* text, TokenBlock* block) {
+    uint32_t letters_lo, spaces_lo, letters_hi, spaces_hi;
+    if (!classify_half_sse2(text, block->folded, &letters_lo, &spaces_lo) ||
+        !classify_half_sse2(text + 16, block->folded + 16, &letters_hi, &spaces_hi)) {
+        return 0;
+    }
+    block->letters = letters_lo | (uint64_t)letters_hi << 16;
+    block->spaces = spaces_lo | (uint64_t)spaces_hi << 16;
+    return 1;
+}
+#endif
+
+typedef int (*ClassifyFn)(const char*, TokenBlock*);
+
+static int classify_block_none(const char* text, TokenBlock* block) {
+    (void)text;
+    (void)block;
+    return 0;
+}
+
+static ClassifyFn classify_block = classify_block_none;
+static pthread_once_t classify_once = PTHREAD_ONCE_INIT;
+
+static void select_classifier(void) {
+#ifdef TOKENIZE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        classify_block = classify_block_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        classify_block = classify_block_sse2;
+    }
+#endif
+}
+
+int classify_ascii_block(const char* text, TokenBlock* block) {
+    pthread_once(&classify_once, select_classifier);
+    return classify_block(text, block);
+}
+
+// Unicode Classes
+// Code points at or above U+0080 are letters unless a range below says
+// otherwise. The table covers spaces, the punctuation and symbol blocks,
+// the common non-ASCII digits and the scripts written without spaces
+// between words (Thai, Lao, Myanmar, Khmer, CJK ideographs, kana, Hangul,
+// Yi); it is sorted for binary search.
+typedef struct CodeRange {
+    uint32_t lo;
+    uint32_t hi;
+    CharClass class;
+} CodeRange;
+
+static const CodeRange code_ranges[] = {
+    { 0x0080, 0x0084, CHAR_OTHER },  { 0x0085, 0x0085, CHAR_SPACE },
+    { 0x0086, 0x009F, CHAR_OTHER },  { 0x00A0, 0x00A0, CHAR_SPACE },
+    { 0x00A1, 0x00A9, CHAR_OTHER },  { 0x00AB, 0x00B4, CHAR_OTHER },
+    { 0x00B6, 0x00B9, CHAR_OTHER },  { 0x00BB, 0x00BF, CHAR_OTHER },
+    { 0x00D7, 0x00D7, CHAR_OTHER },  { 0x00F7, 0x00F7, CHAR_OTHER },
+    { 0x037E, 0x037E, CHAR_OTHER },  { 0x0387, 0x0387, CHAR_OTHER },
+    { 0x055A, 0x055F, CHAR_OTHER },  { 0x0589, 0x058A, CHAR_OTHER },
+    { 0x05BE, 0x05BE, CHAR_OTHER },  { 0x05C0, 0x05C0, CHAR_OTHER },
+    { 0x05C3, 0x05C3, CHAR_OTHER },  { 0x05C6, 0x05C6, CHAR_OTHER },
+    { 0x05F3, 0x05F4, CHAR_OTHER },  { 0x060C, 0x060D, CHAR_OTHER },
+    { 0x061B, 0x061B, CHAR_OTHER },  { 0x061E, 0x061F, CHAR_OTHER },
+    { 0x0660, 0x066D, CHAR_OTHER },  { 0x06D4, 0x06D4, CHAR_OTHER },
+    { 0x06F0, 0x06F9, CHAR_OTHER },  { 0x0964, 0x096F, CHAR_OTHER },
+    { 0x0E01, 0x0E3A, CHAR_UNSPACED },  { 0x0E3F, 0x0E3F, CHAR_OTHER },
+    { 0x0E40, 0x0E4E, CHAR_UNSPACED },  { 0x0E4F, 0x0E5B, CHAR_OTHER },
+    { 0x0E81, 0x0EDF, CHAR_UNSPACED },  { 0x1000, 0x103F, CHAR_UNSPACED },
+    { 0x1040, 0x104F, CHAR_OTHER },  { 0x1050, 0x109F, CHAR_UNSPACED },
+    { 0x1680, 0x1680, CHAR_SPACE },  { 0x1780, 0x17D3, CHAR_UNSPACED },
+    { 0x17D4, 0x17DB, CHAR_OTHER },  { 0x17DC, 0x17DD, CHAR_UNSPACED },
+    { 0x17E0, 0x17F9, CHAR_OTHER },  { 0x2000, 0x200A, CHAR_SPACE },
+    { 0x200B, 0x2018, CHAR_OTHER },  { 0x201A, 0x2027, CHAR_OTHER },
+    { 0x2028, 0x2029, CHAR_SPACE },  { 0x202A, 0x202E, CHAR_OTHER },
+    { 0x202F, 0x202F, CHAR_SPACE },  { 0x2030, 0x205E, CHAR_OTHER },
+    { 0x205F, 0x205F, CHAR_SPACE },  { 0x2060, 0x2BFF, CHAR_OTHER },
+    { 0x2E00, 0x2E7F, CHAR_OTHER },  { 0x2E80, 0x2FDF, CHAR_UNSPACED },
+    { 0x3000, 0x3000, CHAR_SPACE },  { 0x3001, 0x3004, CHAR_OTHER },
+    { 0x3005, 0x3007, CHAR_UNSPACED },  { 0x3008, 0x3020, CHAR_OTHER },
+    { 0x3021, 0x302F, CHAR_UNSPACED },  { 0x3030, 0x3030, CHAR_OTHER },
+    { 0x3031, 0x3035, CHAR_UNSPACED },  { 0x303D, 0x303F, CHAR_OTHER },
+    { 0x3041, 0x30FA, CHAR_UNSPACED },  { 0x30FB, 0x30FB, CHAR_OTHER },
+    { 0x30FC, 0x318F, CHAR_UNSPACED },  { 0x31A0, 0x31BF, CHAR_UNSPACED },
+    { 0x31F0, 0x31FF, CHAR_UNSPACED },  { 0x3400, 0x4DBF, CHAR_UNSPACED },
+    { 0x4E00, 0xA4CF, CHAR_UNSPACED },  { 0xAC00, 0xD7AF, CHAR_UNSPACED },
+    { 0xD800, 0xF8FF, CHAR_OTHER },  { 0xF900, 0xFAFF, CHAR_UNSPACED },
+    { 0xFD3E, 0xFD3F, CHAR_OTHER },  { 0xFE10, 0xFE19, CHAR_OTHER },
+    { 0xFE30, 0xFE6F, CHAR_OTHER },  { 0xFEFF, 0xFEFF, CHAR_OTHER },
+    { 0xFF01, 0xFF20, CHAR_OTHER },  { 0xFF3B, 0xFF40, CHAR_OTHER },
+    { 0xFF5B, 0xFF65, CHAR_OTHER },  { 0xFF66, 0xFFDC, CHAR_UNSPACED },
+    { 0xFFE0, 0xFFFF, CHAR_OTHER },  { 0x1F000, 0x1FAFF, CHAR_OTHER },
+    { 0x20000, 0x3FFFF, CHAR_UNSPACED },  { 0xE0000, 0x10FFFF, CHAR_OTHER },
+};
+
+static CharClass code_point_class(uint32_t cp) {
+    int lo = 0, hi = (int)(sizeof(code_ranges) / sizeof(code_ranges[0])) - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp < code_ranges[mid].lo) hi = mid - 1;
+        else if (cp > code_ranges[mid].hi) lo = mid + 1;
+        else return code_ranges[mid].class;
+    }
+    return CHAR_LETTER;
+}
+
+// Simple case folding for the cased scripts most submissions use: Latin-1,
+// Latin Extended-A and Additional, Greek, Cyrillic, Armenian and
+// fullwidth Latin. Every mapping keeps the encoded length.
+static uint32_t fold_code_point(uint32_t cp) {
+    if (cp < 0x00C0) return cp;
+    if (cp <= 0x00DE) return cp == 0x00D7 ? cp : cp + 0x20;
+    if (cp >= 0x0100 && cp <= 0x017F) {
+        if (cp == 0x0130 || cp == 0x0131 || cp == 0x0138 || cp == 0x0149 || cp == 0x017F) return cp;
+        if (cp == 0x0178) return 0x00FF;
+        int odd_upper = (cp >= 0x0139 && cp <= 0x0148) || (cp >= 0x0179 && cp <= 0x017E);
+        return (cp & 1) == (uint32_t)odd_upper ? cp + 1 : cp;
+    }
+    if (cp >= 0x0386 && cp <= 0x03AB) {
+        if (cp == 0x0386) return 0x03AC;
+        if (cp >= 0x0388 && cp <= 0x038A) return cp + 0x25;
+        if (cp == 0x038C) return 0x03CC;
+        if (cp == 0x038E || cp == 0x038F) return cp + 0x3F;
+        if (cp >= 0x0391 && cp != 0x03A2) return cp + 0x20;
+        return cp;
+    }
+    if (cp == 0x03C2) return 0x03C3;
+    if (cp >= 0x0400 && cp <= 0x040F) return cp + 0x50;
+    if (cp >= 0x0410 && cp <= 0x042F) return cp + 0x20;
+    if ((cp >= 0x0460 && cp <= 0x0481) || (cp >= 0x048A && cp <= 0x04BF) ||
+        (cp >= 0x04D0 && cp <= 0x04FF)) {
+        return (cp & 1) == 0 ? cp + 1 : cp;
+    }
+    if (cp >= 0x0531 && cp <= 0x0556) return cp + 0x30;
+    if ((cp >= 0x1E00 && cp <= 0x1E95) || (cp >= 0x1EA0 && cp <= 0x1EFF)) {
+        return (cp & 1) == 0 ? cp + 1 : cp;
+    }
+    if (cp >= 0xFF21 && cp <= 0xFF3A) return cp + 0x20;
+    return cp;
+}
+
+static int encode_utf8(uint32_t cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Decodes one well-formed UTF-8 sequence (no overlongs or surrogates).
+// Returns its length, or 0 if the bytes at `s` do not start one.
+static int decode_utf8(const unsigned char* s, size_t length, uint32_t* cp) {
+    unsigned char c = s[0];
+    int n;
+    uint32_t value, min;
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2; value = c & 0x1F; min = 0x80;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3; value = c & 0x0F; min = 0x800;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4; value = c & 0x07; min = 0x10000;
+    } else {
+        return 0;
+    }
+    if ((size_t)n > length) return 0;
+    for (int i = 1; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+        value = (value << 6) | (s[i] & 0x3F);
+    }
+    if (value < min || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) return 0;
+    *cp = value;
+    return n;
+}
+
+CharClass classify_char(const char* text, size_t length, char* folded, int* folded_length,
+                        int* consumed) {
+    unsigned char c = (unsigned char)text[0];
+    if (c < 0x80) {
+        *consumed = 1;
+        if (c == ' ' || (c >= '\t' && c <= '\r')) return CHAR_SPACE;
+        if (((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '\'') {
+            folded[0] = (char)(c == '\'' ? c : (c | 0x20));
+            *folded_length = 1;
+            return CHAR_LETTER;
+        }
+        return CHAR_OTHER;
+    }
+
+    uint32_t cp;
+    int n = decode_utf8((const unsigned char*)text, length, &cp);
+    if (n == 0) {
+        *consumed = 1;         // a stray byte, dropped on its own
+        return CHAR_OTHER;
+    }
+    *consumed = n;
+    if (cp == 0x2019 || cp == 0x02BC) {
+        folded[0] = '\'';
+        *folded_length = 1;
+        return CHAR_LETTER;
+    }
+    CharClass class = code_point_class(cp);
+    if (class == CHAR_LETTER || class == CHAR_UNSPACED) {
+        *folded_length = encode_utf8(fold_code_point(cp), folded);
+    }
+    return class;
+}
+
+size_t fold_word(char* word, size_t length) {
+    size_t used = 0;
+    for (size_t i = 0; i < length; ) {
+        char folded[4];
+        int folded_length = 0, consumed = 1;
+        CharClass class = classify_char(word + i, length - i, folded, &folded_length, &consumed);
+        if (class == CHAR_LETTER || class == CHAR_UNSPACED) {
+            memcpy(word + used, folded, folded_length);
+            used += (size_t)folded_length;
+        }
+        i += (size_t)consumed;
+    }
+    return used;
+}
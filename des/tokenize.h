@@ -0,0 +1,50 @@
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TOKENIZE_BLOCK 32
+
+// Character Classes
+// Tokens are whitespace-delimited runs; within a run only letters and
+// apostrophes are kept, case-folded. This holds for UTF-8 text as well:
+// letters of any script are kept whole, Unicode spaces split tokens, and
+// punctuation, symbols, digits and malformed bytes are dropped. The
+// typographic apostrophes U+2019 and U+02BC fold to '\''. Scripts that do
+// not put spaces between words (CJK, kana, Hangul, Thai and its
+// neighbours) have no runs to find, so each of their characters is a
+// token of its own.
+typedef enum CharClass {
+    CHAR_OTHER,
+    CHAR_SPACE,
+    CHAR_LETTER,               // letters and apostrophes
+    CHAR_UNSPACED              // a letter that forms a token by itself
+} CharClass;
+
+// Classification of TOKENIZE_BLOCK ASCII bytes at once: bit i of each mask
+// describes byte i, and `folded` holds the bytes lowercased (meaningful at
+// letter positions only).
+typedef struct TokenBlock {
+    uint64_t letters;
+    uint64_t spaces;
+    unsigned char folded[TOKENIZE_BLOCK];
+} TokenBlock;
+
+// Fills `block` from the TOKENIZE_BLOCK bytes at `text` with the widest
+// vector unit the CPU has. Returns 0, leaving the block to the character
+// path, when a byte is not ASCII or no vector unit is available.
+int classify_ascii_block(const char* text, TokenBlock* block);
+
+// Classifies the character at `text` (`length` bytes available) and sets
+// *consumed to its encoded length. For a letter of either class, writes its case-folded
+// UTF-8 encoding (at most 4 bytes) to `folded` and sets *folded_length.
+CharClass classify_char(const char* text, size_t length, char* folded, int* folded_length,
+                        int* consumed);
+
+// Folds the `length` bytes of `word` in place as the tokenizer folds a
+// token's characters: letters are case-folded and everything else is
+// dropped. Returns the new length, never more than `length`.
+size_t fold_word(char* word, size_t length);
+
+#endif